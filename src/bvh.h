@@ -0,0 +1,426 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Bounding volume hierarchy over bounding spheres
+// Primitives are referenced by their index in the sphere array the tree is built and refit from. Nodes bound the
+// spheres with boxes, split with the surface area heuristic over binned centroids. Children are always allocated
+// after their parent, so a single reverse walk over the nodes refits the whole tree bottom up.
+namespace Bvh
+{
+	constexpr uint32_t maxLeafSize = 4;
+	constexpr uint32_t binCount = 16;
+	// Leaves are forced below this, which is also the size of the traversal stacks
+	constexpr uint32_t maxDepth = 48;
+
+	struct Node
+	{
+		glm::vec3 min;
+		uint32_t first; // first primitive of a leaf, left child of an inner node, the right one follows it
+		glm::vec3 max;
+		uint32_t count; // primitives of a leaf, 0 for inner nodes
+	};
+
+	struct Stats
+	{
+		uint32_t nodesVisited = 0;
+		uint32_t spheresTested = 0;
+	};
+
+	class Tree
+	{
+	public:
+		void Build(const glm::vec4* spheres, uint32_t count);
+		// Recomputes every box from the spheres, the topology stays. Returns the new Cost().
+		float Refit(const glm::vec4* spheres);
+		void Clear();
+
+		// SAH cost of the tree relative to testing its root, it grows as refits move primitives away from their siblings
+		float Cost() const { return cost; }
+		float BuildCost() const { return buildCost; }
+		uint32_t NodeCount() const { return (uint32_t)nodes.size(); }
+		uint32_t PrimitiveCount() const { return (uint32_t)primitives.size(); }
+
+		// Calls visible(primitive) for every sphere intersecting the frustum (planes point inside, see ExtractFrustumPlanes).
+		// Subtrees entirely inside a plane stop testing it, subtrees entirely inside all of them are accepted without tests.
+		template <typename F> Stats CullFrustum(const glm::vec4* spheres, const glm::vec4 planes[6], F&& visible) const;
+		// Closest sphere hit by the ray, with distance in units of direction. Returns false when nothing is hit.
+		bool Raycast(const glm::vec4* spheres, const glm::vec3& origin, const glm::vec3& direction, uint32_t& primitive, float& distance) const;
+
+	private:
+		struct Box
+		{
+			glm::vec3 min = glm::vec3(FLT_MAX);
+			glm::vec3 max = glm::vec3(-FLT_MAX);
+
+			void Grow(const glm::vec3& point) { min = glm::min(min, point); max = glm::max(max, point); }
+			void Grow(const Box& box) { min = glm::min(min, box.min); max = glm::max(max, box.max); }
+			float Area() const
+			{
+				const glm::vec3 extent = max - min;
+				return extent.x < 0.0f ? 0.0f : 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+			}
+		};
+
+		static Box SphereBox(const glm::vec4& sphere)
+		{
+			Box box;
+			box.min = glm::vec3(sphere) - sphere.w;
+			box.max = glm::vec3(sphere) + sphere.w;
+			return box;
+		}
+
+		void Subdivide(const glm::vec4* spheres, uint32_t node, uint32_t depth);
+		Box LeafBox(const glm::vec4* spheres, const Node& node) const;
+		float ComputeCost() const;
+
+		std::vector<Node> nodes;
+		std::vector<uint32_t> primitives;
+		std::vector<glm::vec3> centroids; // build scratch, by primitive
+		float cost = 0.0f;
+		float buildCost = 0.0f;
+	};
+
+	inline void Tree::Build(const glm::vec4* spheres, uint32_t count)
+	{
+		Clear();
+		if (count == 0)
+			return;
+
+		primitives.resize(count);
+		centroids.resize(count);
+		for (uint32_t i = 0; i < count; i++)
+		{
+			primitives[i] = i;
+			centroids[i] = glm::vec3(spheres[i]);
+		}
+
+		nodes.reserve(2 * count - 1);
+		nodes.push_back({});
+		nodes[0].first = 0;
+		nodes[0].count = count;
+		Subdivide(spheres, 0, 0);
+
+		cost = buildCost = ComputeCost();
+	}
+
+	inline void Tree::Subdivide(const glm::vec4* spheres, uint32_t nodeIndex, uint32_t depth)
+	{
+		const uint32_t first = nodes[nodeIndex].first;
+		const uint32_t count = nodes[nodeIndex].count;
+
+		Box bounds;
+		Box centroidBounds;
+		for (uint32_t i = first; i < first + count; i++)
+		{
+			bounds.Grow(SphereBox(spheres[primitives[i]]));
+			centroidBounds.Grow(centroids[primitives[i]]);
+		}
+		nodes[nodeIndex].min = bounds.min;
+		nodes[nodeIndex].max = bounds.max;
+
+		if (count <= 2 || depth + 1 >= maxDepth)
+			return;
+
+		// Best binned split over the three axes, costs are in units of one sphere test with a node test costing one too
+		int bestAxis = -1;
+		uint32_t bestSplit = 0;
+		float bestCost = FLT_MAX;
+		const glm::vec3 extent = centroidBounds.max - centroidBounds.min;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			if (extent[axis] <= 0.0f)
+				continue;
+
+			Box binBoxes[binCount];
+			uint32_t binCounts[binCount] = {};
+			const float binScale = float(binCount) / extent[axis];
+			for (uint32_t i = first; i < first + count; i++)
+			{
+				const uint32_t primitive = primitives[i];
+				const uint32_t bin = std::min(uint32_t((centroids[primitive][axis] - centroidBounds.min[axis]) * binScale), binCount - 1);
+				binBoxes[bin].Grow(SphereBox(spheres[primitive]));
+				binCounts[bin]++;
+			}
+
+			// Sweep from the right to get the right side of every split, then from the left to evaluate them
+			float rightAreas[binCount];
+			uint32_t rightCounts[binCount];
+			Box right;
+			uint32_t rightCount = 0;
+			for (uint32_t bin = binCount - 1; bin > 0; bin--)
+			{
+				right.Grow(binBoxes[bin]);
+				rightCount += binCounts[bin];
+				rightAreas[bin] = right.Area();
+				rightCounts[bin] = rightCount;
+			}
+			Box left;
+			uint32_t leftCount = 0;
+			for (uint32_t split = 1; split < binCount; split++)
+			{
+				left.Grow(binBoxes[split - 1]);
+				leftCount += binCounts[split - 1];
+				if (leftCount == 0 || rightCounts[split] == 0)
+					continue;
+				const float splitCost = left.Area() * leftCount + rightAreas[split] * rightCounts[split];
+				if (splitCost < bestCost)
+				{
+					bestCost = splitCost;
+					bestAxis = axis;
+					bestSplit = split;
+				}
+			}
+		}
+
+		const float area = bounds.Area();
+		const float leafCost = float(count);
+		uint32_t middle = first;
+		if (bestAxis >= 0 && (area <= 0.0f || 1.0f + bestCost / area < leafCost || count > maxLeafSize))
+		{
+			const float binScale = float(binCount) / extent[bestAxis];
+			uint32_t* begin = primitives.data() + first;
+			middle = uint32_t(std::partition(begin, begin + count, [&](uint32_t primitive)
+			{
+				return std::min(uint32_t((centroids[primitive][bestAxis] - centroidBounds.min[bestAxis]) * binScale), binCount - 1) < bestSplit;
+			}) - primitives.data());
+		}
+		else if (count > maxLeafSize)
+		{
+			// Every centroid is in the same place, no split separates them, halve the range so leaves stay small
+			middle = first + count / 2;
+		}
+		else
+		{
+			return;
+		}
+
+		const uint32_t leftChild = (uint32_t)nodes.size();
+		nodes.push_back({});
+		nodes.push_back({});
+		nodes[leftChild].first = first;
+		nodes[leftChild].count = middle - first;
+		nodes[leftChild + 1].first = middle;
+		nodes[leftChild + 1].count = first + count - middle;
+		nodes[nodeIndex].first = leftChild;
+		nodes[nodeIndex].count = 0;
+
+		Subdivide(spheres, leftChild, depth + 1);
+		Subdivide(spheres, leftChild + 1, depth + 1);
+	}
+
+	inline Tree::Box Tree::LeafBox(const glm::vec4* spheres, const Node& node) const
+	{
+		Box box;
+		for (uint32_t i = node.first; i < node.first + node.count; i++)
+			box.Grow(SphereBox(spheres[primitives[i]]));
+		return box;
+	}
+
+	inline float Tree::Refit(const glm::vec4* spheres)
+	{
+		for (uint32_t i = (uint32_t)nodes.size(); i-- > 0;)
+		{
+			Node& node = nodes[i];
+			Box box;
+			if (node.count > 0)
+			{
+				box = LeafBox(spheres, node);
+			}
+			else
+			{
+				const Node& left = nodes[node.first];
+				const Node& right = nodes[node.first + 1];
+				box.min = glm::min(left.min, right.min);
+				box.max = glm::max(left.max, right.max);
+			}
+			node.min = box.min;
+			node.max = box.max;
+		}
+		cost = ComputeCost();
+		return cost;
+	}
+
+	inline void Tree::Clear()
+	{
+		nodes.clear();
+		primitives.clear();
+		centroids.clear();
+		cost = 0.0f;
+		buildCost = 0.0f;
+	}
+
+	inline float Tree::ComputeCost() const
+	{
+		if (nodes.empty())
+			return 0.0f;
+		Box root;
+		root.min = nodes[0].min;
+		root.max = nodes[0].max;
+		const float rootArea = root.Area();
+		if (rootArea <= 0.0f)
+			return float(primitives.size());
+
+		float total = 0.0f;
+		for (const Node& node : nodes)
+		{
+			Box box;
+			box.min = node.min;
+			box.max = node.max;
+			total += box.Area() * (node.count > 0 ? float(node.count) : 1.0f);
+		}
+		return total / rootArea;
+	}
+
+	template <typename F>
+	Stats Tree::CullFrustum(const glm::vec4* spheres, const glm::vec4 planes[6], F&& visible) const
+	{
+		Stats stats;
+		if (nodes.empty())
+			return stats;
+
+		struct Entry
+		{
+			uint32_t node;
+			uint32_t planeMask; // planes the node is not known to be inside of
+		};
+		Entry stack[maxDepth + 1];
+		uint32_t stackSize = 0;
+		stack[stackSize++] = { 0, 0x3F };
+
+		while (stackSize > 0)
+		{
+			const Entry entry = stack[--stackSize];
+			const Node& node = nodes[entry.node];
+			stats.nodesVisited++;
+
+			uint32_t planeMask = entry.planeMask;
+			if (planeMask != 0)
+			{
+				const glm::vec3 center = (node.min + node.max) * 0.5f;
+				const glm::vec3 halfExtent = (node.max - node.min) * 0.5f;
+				bool outside = false;
+				for (int i = 0; i < 6 && !outside; i++)
+				{
+					if ((planeMask & (1u << i)) == 0)
+						continue;
+					const glm::vec3 normal = glm::vec3(planes[i]);
+					const float distance = glm::dot(normal, center) + planes[i].w;
+					const float radius = glm::dot(glm::abs(normal), halfExtent);
+					if (distance < -radius)
+						outside = true;
+					else if (distance >= radius)
+						planeMask &= ~(1u << i);
+				}
+				if (outside)
+					continue;
+			}
+
+			if (node.count == 0)
+			{
+				stack[stackSize++] = { node.first, planeMask };
+				stack[stackSize++] = { node.first + 1, planeMask };
+				continue;
+			}
+
+			for (uint32_t i = node.first; i < node.first + node.count; i++)
+			{
+				const uint32_t primitive = primitives[i];
+				bool inside = true;
+				if (planeMask != 0)
+				{
+					stats.spheresTested++;
+					const glm::vec4& sphere = spheres[primitive];
+					for (int p = 0; p < 6 && inside; p++)
+					{
+						if ((planeMask & (1u << p)) != 0)
+							inside = glm::dot(glm::vec3(planes[p]), glm::vec3(sphere)) + planes[p].w >= -sphere.w;
+					}
+				}
+				if (inside)
+					visible(primitive);
+			}
+		}
+		return stats;
+	}
+
+	inline bool Tree::Raycast(const glm::vec4* spheres, const glm::vec3& origin, const glm::vec3& direction, uint32_t& primitive, float& distance) const
+	{
+		if (nodes.empty())
+			return false;
+
+		const glm::vec3 inverseDirection = 1.0f / direction;
+		// Entry distance of the ray into the node's box, FLT_MAX when it misses or enters beyond closest
+		auto boxEntry = [&](const Node& node, float closest)
+		{
+			const glm::vec3 t0 = (node.min - origin) * inverseDirection;
+			const glm::vec3 t1 = (node.max - origin) * inverseDirection;
+			const glm::vec3 tNear = glm::min(t0, t1);
+			const glm::vec3 tFar = glm::max(t0, t1);
+			const float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+			const float exit = std::min(std::min(tFar.x, tFar.y), tFar.z);
+			return enter <= exit && enter < closest ? enter : FLT_MAX;
+		};
+
+		float closest = FLT_MAX;
+		uint32_t stack[maxDepth + 1];
+		uint32_t stackSize = 0;
+		if (boxEntry(nodes[0], closest) != FLT_MAX)
+			stack[stackSize++] = 0;
+
+		const float a = glm::dot(direction, direction);
+		while (stackSize > 0)
+		{
+			const Node& node = nodes[stack[--stackSize]];
+			if (node.count == 0)
+			{
+				// Nearer child on top so its hits prune the farther one
+				uint32_t nearChild = node.first;
+				uint32_t farChild = node.first + 1;
+				float nearEntry = boxEntry(nodes[nearChild], closest);
+				float farEntry = boxEntry(nodes[farChild], closest);
+				if (farEntry < nearEntry)
+				{
+					std::swap(nearChild, farChild);
+					std::swap(nearEntry, farEntry);
+				}
+				if (farEntry != FLT_MAX)
+					stack[stackSize++] = farChild;
+				if (nearEntry != FLT_MAX)
+					stack[stackSize++] = nearChild;
+				continue;
+			}
+
+			for (uint32_t i = node.first; i < node.first + node.count; i++)
+			{
+				const glm::vec4& sphere = spheres[primitives[i]];
+				const glm::vec3 offset = origin - glm::vec3(sphere);
+				const float b = glm::dot(offset, direction);
+				const float c = glm::dot(offset, offset) - sphere.w * sphere.w;
+				const float discriminant = b * b - a * c;
+				if (discriminant < 0.0f)
+					continue;
+				// Starting inside the sphere counts as a hit at the origin
+				const float root = std::sqrt(discriminant);
+				const float t = std::max((-b - root) / a, 0.0f);
+				if (-b + root >= 0.0f && t < closest)
+				{
+					closest = t;
+					primitive = primitives[i];
+				}
+			}
+		}
+
+		if (closest == FLT_MAX)
+			return false;
+		distance = closest;
+		return true;
+	}
+}
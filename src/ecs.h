@@ -0,0 +1,430 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+// Archetype based entity component store
+// Entities with the same set of components share an archetype, which keeps them in fixed size chunks. Every
+// component has its own array inside a chunk, so a system reading two components streams through two contiguous
+// arrays and never touches the others. Chunks are independent of each other, systems can run over them in parallel.
+// Components are plain data: entities are moved between rows and archetypes with memcpy.
+namespace Ecs
+{
+	constexpr uint32_t chunkBytes = 16 * 1024;
+	constexpr uint32_t maxComponentTypes = 64;
+
+	using ComponentMask = uint64_t;
+
+	struct Entity
+	{
+		uint32_t index = UINT32_MAX;
+		uint32_t generation = 0; // tells a destroyed entity from the one that reused its index
+
+		bool operator==(const Entity& other) const { return index == other.index && generation == other.generation; }
+		bool operator!=(const Entity& other) const { return !(*this == other); }
+	};
+
+	namespace Detail
+	{
+		struct ComponentInfo
+		{
+			uint32_t size;
+			uint32_t alignment;
+		};
+
+		inline std::vector<ComponentInfo>& ComponentInfos()
+		{
+			static std::vector<ComponentInfo> infos;
+			return infos;
+		}
+
+		inline uint32_t RegisterComponent(uint32_t size, uint32_t alignment)
+		{
+			std::vector<ComponentInfo>& infos = ComponentInfos();
+			assert(infos.size() < maxComponentTypes);
+			infos.push_back({ size, alignment });
+			return (uint32_t)infos.size() - 1;
+		}
+	}
+
+	// Ids are handed out on first use, which has to happen on one thread, creating the first entity with a type does it
+	template <typename T>
+	uint32_t ComponentId()
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "components are moved with memcpy");
+		static const uint32_t id = Detail::RegisterComponent(sizeof(T), alignof(T));
+		return id;
+	}
+
+	template <typename... Ts>
+	ComponentMask MaskOf()
+	{
+		return (ComponentMask(0) | ... | (ComponentMask(1) << ComponentId<Ts>()));
+	}
+
+	class Archetype;
+
+	class Chunk
+	{
+	public:
+		uint32_t Count() const { return count; }
+		const Entity* Entities() const;
+		// Array of Count() components, the chunk's archetype has to have T
+		template <typename T> T* Get();
+		template <typename T> const T* Get() const;
+
+	private:
+		friend class Archetype;
+		friend class World;
+
+		struct alignas(64) Storage
+		{
+			uint8_t bytes[chunkBytes];
+		};
+
+		uint8_t* Row(uint32_t component, uint32_t row) const;
+
+		Archetype* archetype = nullptr;
+		std::unique_ptr<Storage> storage = std::make_unique<Storage>();
+		uint32_t count = 0;
+	};
+
+	// One layout for all chunks of a component set: the entity array, then one array per component, each aligned
+	class Archetype
+	{
+	public:
+		explicit Archetype(ComponentMask mask);
+
+		ComponentMask Mask() const { return mask; }
+		bool Has(uint32_t component) const { return (mask >> component) & 1; }
+		uint32_t Capacity() const { return capacity; }
+
+	private:
+		friend class Chunk;
+		friend class World;
+
+		ComponentMask mask;
+		uint32_t capacity = 0; // entities per chunk
+		uint32_t entityOffset = 0;
+		uint32_t offsets[maxComponentTypes];
+		std::vector<std::unique_ptr<Chunk>> chunks; // every chunk but the last is full
+	};
+
+	// A chunk and the number of entities of the query's chunks before it, so systems can index per frame arrays
+	struct ChunkRef
+	{
+		Chunk* chunk;
+		uint32_t firstIndex;
+	};
+
+	class World
+	{
+	public:
+		template <typename... Ts> Entity Create(const Ts&... components);
+		void Destroy(Entity entity);
+		bool Alive(Entity entity) const;
+		void Clear();
+		uint32_t EntityCount() const { return entityCount; }
+		// Changes whenever a row is added, removed or moved, the order Query sees entities in only changes with it
+		uint64_t StructureVersion() const { return structureVersion; }
+
+		// nullptr when the entity does not have T
+		template <typename T> T* Get(Entity entity);
+		// Moves the entity to the archetype with T, or overwrites T if it has it already
+		template <typename T> void Add(Entity entity, const T& component);
+		template <typename T> void Remove(Entity entity);
+
+		// Every chunk of the archetypes having all of Ts, in archetype creation order. Returns the matching entity count.
+		template <typename... Ts> uint32_t Query(std::vector<ChunkRef>& chunks);
+		// Calls function(Entity, Ts&...) on every entity having all of Ts, chunk by chunk
+		template <typename... Ts, typename F> void ForEach(F&& function);
+
+	private:
+		struct EntityRecord
+		{
+			Archetype* archetype = nullptr;
+			uint32_t chunk = 0;
+			uint32_t row = 0;
+			uint32_t generation = 0;
+		};
+
+		Archetype& GetArchetype(ComponentMask mask);
+		Entity AllocateEntity();
+		// Appends a row for entity to archetype, its components are left uninitialized
+		void AppendRow(Archetype& archetype, Entity entity);
+		// Fills the row with the archetype's last row so every chunk stays packed
+		void RemoveRow(Archetype& archetype, uint32_t chunk, uint32_t row);
+		void MoveEntity(Entity entity, ComponentMask mask);
+
+		std::vector<EntityRecord> records;
+		std::vector<uint32_t> freeIndices;
+		std::vector<std::unique_ptr<Archetype>> archetypes;
+		std::unordered_map<ComponentMask, Archetype*> archetypeMap;
+		uint32_t entityCount = 0;
+		uint64_t structureVersion = 0;
+	};
+
+	inline Archetype::Archetype(ComponentMask mask) : mask(mask)
+	{
+		const std::vector<Detail::ComponentInfo>& infos = Detail::ComponentInfos();
+		uint32_t rowBytes = sizeof(Entity);
+		for (uint32_t i = 0; i < maxComponentTypes; i++)
+		{
+			offsets[i] = UINT32_MAX;
+			if (Has(i))
+				rowBytes += infos[i].size;
+		}
+
+		// Alignment padding between the arrays may not fit, shrink until the layout does
+		capacity = chunkBytes / rowBytes;
+		for (; capacity > 0; capacity--)
+		{
+			uint32_t offset = 0;
+			entityOffset = offset;
+			offset += capacity * (uint32_t)sizeof(Entity);
+			for (uint32_t i = 0; i < maxComponentTypes; i++)
+			{
+				if (!Has(i))
+					continue;
+				offset = (offset + infos[i].alignment - 1) / infos[i].alignment * infos[i].alignment;
+				offsets[i] = offset;
+				offset += capacity * infos[i].size;
+			}
+			if (offset <= chunkBytes)
+				break;
+		}
+		assert(capacity > 0);
+	}
+
+	inline uint8_t* Chunk::Row(uint32_t component, uint32_t row) const
+	{
+		return storage->bytes + archetype->offsets[component] + row * Detail::ComponentInfos()[component].size;
+	}
+
+	inline const Entity* Chunk::Entities() const
+	{
+		return reinterpret_cast<const Entity*>(storage->bytes + archetype->entityOffset);
+	}
+
+	template <typename T>
+	T* Chunk::Get()
+	{
+		assert(archetype->Has(ComponentId<T>()));
+		return reinterpret_cast<T*>(storage->bytes + archetype->offsets[ComponentId<T>()]);
+	}
+
+	template <typename T>
+	const T* Chunk::Get() const
+	{
+		assert(archetype->Has(ComponentId<T>()));
+		return reinterpret_cast<const T*>(storage->bytes + archetype->offsets[ComponentId<T>()]);
+	}
+
+	inline Archetype& World::GetArchetype(ComponentMask mask)
+	{
+		auto it = archetypeMap.find(mask);
+		if (it != archetypeMap.end())
+			return *it->second;
+		archetypes.push_back(std::make_unique<Archetype>(mask));
+		archetypeMap[mask] = archetypes.back().get();
+		return *archetypes.back();
+	}
+
+	inline Entity World::AllocateEntity()
+	{
+		Entity entity;
+		if (!freeIndices.empty())
+		{
+			entity.index = freeIndices.back();
+			freeIndices.pop_back();
+		}
+		else
+		{
+			entity.index = (uint32_t)records.size();
+			records.emplace_back();
+		}
+		entity.generation = records[entity.index].generation;
+		entityCount++;
+		return entity;
+	}
+
+	inline void World::AppendRow(Archetype& archetype, Entity entity)
+	{
+		if (archetype.chunks.empty() || archetype.chunks.back()->count == archetype.capacity)
+		{
+			archetype.chunks.push_back(std::make_unique<Chunk>());
+			archetype.chunks.back()->archetype = &archetype;
+		}
+		Chunk& chunk = *archetype.chunks.back();
+		const uint32_t row = chunk.count++;
+		const_cast<Entity*>(chunk.Entities())[row] = entity;
+		structureVersion++;
+
+		EntityRecord& record = records[entity.index];
+		record.archetype = &archetype;
+		record.chunk = (uint32_t)archetype.chunks.size() - 1;
+		record.row = row;
+	}
+
+	inline void World::RemoveRow(Archetype& archetype, uint32_t chunkIndex, uint32_t row)
+	{
+		Chunk& chunk = *archetype.chunks[chunkIndex];
+		Chunk& last = *archetype.chunks.back();
+		const uint32_t lastRow = last.count - 1;
+		structureVersion++;
+		if (&chunk != &last || row != lastRow)
+		{
+			const Entity moved = last.Entities()[lastRow];
+			const_cast<Entity*>(chunk.Entities())[row] = moved;
+			const std::vector<Detail::ComponentInfo>& infos = Detail::ComponentInfos();
+			for (uint32_t i = 0; i < maxComponentTypes; i++)
+			{
+				if (archetype.Has(i))
+					memcpy(chunk.Row(i, row), last.Row(i, lastRow), infos[i].size);
+			}
+			records[moved.index].chunk = chunkIndex;
+			records[moved.index].row = row;
+		}
+		if (--last.count == 0)
+			archetype.chunks.pop_back();
+	}
+
+	inline void World::MoveEntity(Entity entity, ComponentMask mask)
+	{
+		EntityRecord record = records[entity.index];
+		Archetype& source = *record.archetype;
+		Archetype& destination = GetArchetype(mask);
+		AppendRow(destination, entity);
+
+		const EntityRecord& moved = records[entity.index];
+		Chunk& from = *source.chunks[record.chunk];
+		Chunk& to = *destination.chunks[moved.chunk];
+		const std::vector<Detail::ComponentInfo>& infos = Detail::ComponentInfos();
+		for (uint32_t i = 0; i < maxComponentTypes; i++)
+		{
+			if (source.Has(i) && destination.Has(i))
+				memcpy(to.Row(i, moved.row), from.Row(i, record.row), infos[i].size);
+		}
+		RemoveRow(source, record.chunk, record.row);
+	}
+
+	template <typename... Ts>
+	Entity World::Create(const Ts&... components)
+	{
+		Archetype& archetype = GetArchetype(MaskOf<Ts...>());
+		Entity entity = AllocateEntity();
+		AppendRow(archetype, entity);
+		const EntityRecord& record = records[entity.index];
+		Chunk& chunk = *archetype.chunks[record.chunk];
+		((chunk.Get<Ts>()[record.row] = components), ...);
+		return entity;
+	}
+
+	inline void World::Destroy(Entity entity)
+	{
+		if (!Alive(entity))
+			return;
+		EntityRecord& record = records[entity.index];
+		RemoveRow(*record.archetype, record.chunk, record.row);
+		record.archetype = nullptr;
+		record.generation++;
+		freeIndices.push_back(entity.index);
+		entityCount--;
+	}
+
+	inline bool World::Alive(Entity entity) const
+	{
+		return entity.index < records.size() && records[entity.index].archetype != nullptr && records[entity.index].generation == entity.generation;
+	}
+
+	inline void World::Clear()
+	{
+		// Keeps the archetypes, their layouts do not depend on what was in them
+		for (std::unique_ptr<Archetype>& archetype : archetypes)
+			archetype->chunks.clear();
+		for (uint32_t i = 0; i < records.size(); i++)
+		{
+			if (records[i].archetype != nullptr)
+			{
+				records[i].archetype = nullptr;
+				records[i].generation++;
+				freeIndices.push_back(i);
+			}
+		}
+		entityCount = 0;
+		structureVersion++;
+	}
+
+	template <typename T>
+	T* World::Get(Entity entity)
+	{
+		if (!Alive(entity))
+			return nullptr;
+		const EntityRecord& record = records[entity.index];
+		if (!record.archetype->Has(ComponentId<T>()))
+			return nullptr;
+		return record.archetype->chunks[record.chunk]->Get<T>() + record.row;
+	}
+
+	template <typename T>
+	void World::Add(Entity entity, const T& component)
+	{
+		assert(Alive(entity));
+		const ComponentMask mask = records[entity.index].archetype->Mask() | MaskOf<T>();
+		if (mask != records[entity.index].archetype->Mask())
+			MoveEntity(entity, mask);
+		*Get<T>(entity) = component;
+	}
+
+	template <typename T>
+	void World::Remove(Entity entity)
+	{
+		assert(Alive(entity));
+		const ComponentMask mask = records[entity.index].archetype->Mask() & ~MaskOf<T>();
+		if (mask != records[entity.index].archetype->Mask())
+			MoveEntity(entity, mask);
+	}
+
+	template <typename... Ts>
+	uint32_t World::Query(std::vector<ChunkRef>& chunks)
+	{
+		const ComponentMask mask = MaskOf<Ts...>();
+		chunks.clear();
+		uint32_t count = 0;
+		for (std::unique_ptr<Archetype>& archetype : archetypes)
+		{
+			if ((archetype->Mask() & mask) != mask)
+				continue;
+			for (std::unique_ptr<Chunk>& chunk : archetype->chunks)
+			{
+				chunks.push_back({ chunk.get(), count });
+				count += chunk->count;
+			}
+		}
+		return count;
+	}
+
+	template <typename... Ts, typename F>
+	void World::ForEach(F&& function)
+	{
+		const ComponentMask mask = MaskOf<Ts...>();
+		for (std::unique_ptr<Archetype>& archetype : archetypes)
+		{
+			if ((archetype->Mask() & mask) != mask)
+				continue;
+			for (std::unique_ptr<Chunk>& chunk : archetype->chunks)
+			{
+				const Entity* entities = chunk->Entities();
+				auto arrays = std::make_tuple(chunk->Get<Ts>()...);
+				for (uint32_t row = 0; row < chunk->count; row++)
+					std::apply([&](Ts*... components) { function(entities[row], components[row]...); }, arrays);
+			}
+		}
+	}
+}
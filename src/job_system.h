@@ -0,0 +1,297 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing job system
+// Every worker owns a deque: it pushes and pops its own jobs at the back (most recent, still hot in cache)
+// and steals from the front of the other deques when it runs dry. The thread calling Start is worker 0,
+// it never sleeps in the pool and only runs jobs while it waits on a counter.
+namespace Jobs
+{
+	using JobCounter = std::atomic<uint32_t>;
+
+	struct Job
+	{
+		std::function<void()> function;
+		JobCounter* counter = nullptr; // decremented once the job ran
+	};
+
+	// Index of the worker running on this thread
+	inline thread_local uint32_t currentWorker = 0;
+
+	class JobSystem
+	{
+	public:
+		void Start(uint32_t workerCount);
+		void Stop();
+
+		// Only the first count workers take jobs, used to measure how work scales with cores
+		void SetActiveWorkers(uint32_t count);
+		uint32_t ActiveWorkers() const { return activeWorkers; }
+		uint32_t WorkerCount() const { return (uint32_t)queues.size(); }
+
+		// Pushes a job on the calling worker's deque, counter is incremented now and decremented when it finished
+		void Schedule(std::function<void()> function, JobCounter* counter);
+		// Runs other jobs until counter reaches zero
+		void Wait(const JobCounter& counter);
+		// Splits [0, count) in ranges of at most grainSize, the calling thread helps until all of them ran
+		void ParallelFor(uint32_t count, uint32_t grainSize, const std::function<void(uint32_t begin, uint32_t end)>& function);
+
+	private:
+		struct WorkerQueue
+		{
+			std::mutex mutex;
+			std::deque<Job> jobs;
+		};
+
+		bool Pop(uint32_t worker, Job& job);
+		bool Steal(uint32_t worker, Job& job);
+		bool RunOne(uint32_t worker);
+		void WorkerLoop(uint32_t worker);
+
+		std::vector<std::unique_ptr<WorkerQueue>> queues;
+		std::vector<std::thread> threads;
+		std::atomic<uint32_t> activeWorkers = 1;
+		std::atomic<uint32_t> queuedJobs = 0;
+		std::atomic<bool> quit = false;
+		std::mutex sleepMutex;
+		std::condition_variable sleepCondition;
+	};
+
+	// Named tasks with dependencies, a task is scheduled as soon as every task it depends on finished
+	class TaskGraph
+	{
+	public:
+		using TaskId = uint32_t;
+
+		TaskId Add(const char* name, std::function<void()> function);
+		void DependsOn(TaskId task, TaskId dependency);
+		void Clear() { tasks.clear(); }
+
+		// Runs the whole graph on the job system and returns once every task finished
+		void Run(JobSystem& jobSystem);
+
+		uint32_t TaskCount() const { return (uint32_t)tasks.size(); }
+		const char* TaskName(TaskId task) const { return tasks[task].name; }
+		// Duration of the task's last run in milliseconds
+		double TaskTime(TaskId task) const { return tasks[task].time; }
+
+	private:
+		struct Task
+		{
+			const char* name;
+			std::function<void()> function;
+			std::vector<TaskId> dependents;
+			uint32_t dependencyCount = 0;
+			std::atomic<uint32_t> remainingDependencies = 0;
+			double time = 0.0;
+		};
+
+		void Schedule(JobSystem& jobSystem, TaskId task, JobCounter* counter);
+
+		std::deque<Task> tasks; // deque so Task, which holds an atomic, never has to move
+	};
+
+	inline void JobSystem::Start(uint32_t workerCount)
+	{
+		workerCount = std::max(workerCount, 1u);
+		quit = false;
+		currentWorker = 0;
+		for (uint32_t i = 0; i < workerCount; i++)
+			queues.push_back(std::make_unique<WorkerQueue>());
+
+		activeWorkers = workerCount;
+		for (uint32_t i = 1; i < workerCount; i++)
+			threads.emplace_back(&JobSystem::WorkerLoop, this, i);
+	}
+
+	inline void JobSystem::Stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(sleepMutex);
+			quit = true;
+		}
+		sleepCondition.notify_all();
+		for (std::thread& thread : threads)
+			thread.join();
+		threads.clear();
+		queues.clear();
+	}
+
+	inline void JobSystem::SetActiveWorkers(uint32_t count)
+	{
+		{
+			std::lock_guard<std::mutex> lock(sleepMutex);
+			activeWorkers = std::min(std::max(count, 1u), WorkerCount());
+		}
+		sleepCondition.notify_all();
+	}
+
+	inline void JobSystem::Schedule(std::function<void()> function, JobCounter* counter)
+	{
+		if (counter)
+			counter->fetch_add(1);
+
+		{
+			WorkerQueue& queue = *queues[currentWorker];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			queue.jobs.push_back({ std::move(function), counter });
+		}
+		queuedJobs++;
+
+		// Taking the lock makes sure a worker that just found no job is either already asleep or sees the new one
+		{
+			std::lock_guard<std::mutex> lock(sleepMutex);
+		}
+		// Parked workers wait on the same condition, one wakeup could land on one of them and leave active workers asleep
+		if (activeWorkers < WorkerCount())
+			sleepCondition.notify_all();
+		else
+			sleepCondition.notify_one();
+	}
+
+	inline bool JobSystem::Pop(uint32_t worker, Job& job)
+	{
+		WorkerQueue& queue = *queues[worker];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.jobs.empty())
+			return false;
+
+		job = std::move(queue.jobs.back());
+		queue.jobs.pop_back();
+		return true;
+	}
+
+	inline bool JobSystem::Steal(uint32_t worker, Job& job)
+	{
+		const uint32_t workerCount = WorkerCount();
+		for (uint32_t i = 1; i < workerCount; i++)
+		{
+			WorkerQueue& queue = *queues[(worker + i) % workerCount];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			if (queue.jobs.empty())
+				continue;
+
+			job = std::move(queue.jobs.front());
+			queue.jobs.pop_front();
+			return true;
+		}
+		return false;
+	}
+
+	inline bool JobSystem::RunOne(uint32_t worker)
+	{
+		Job job;
+		if (!Pop(worker, job) && !Steal(worker, job))
+			return false;
+
+		queuedJobs--;
+		job.function();
+		if (job.counter)
+			job.counter->fetch_sub(1);
+		return true;
+	}
+
+	inline void JobSystem::Wait(const JobCounter& counter)
+	{
+		while (counter.load() > 0)
+		{
+			if (!RunOne(currentWorker))
+				std::this_thread::yield();
+		}
+	}
+
+	inline void JobSystem::ParallelFor(uint32_t count, uint32_t grainSize, const std::function<void(uint32_t begin, uint32_t end)>& function)
+	{
+		grainSize = std::max(grainSize, 1u);
+		if (count <= grainSize || activeWorkers == 1)
+		{
+			function(0, count);
+			return;
+		}
+
+		JobCounter counter = 0;
+		for (uint32_t begin = grainSize; begin < count; begin += grainSize)
+		{
+			const uint32_t end = std::min(begin + grainSize, count);
+			Schedule([&function, begin, end] { function(begin, end); }, &counter);
+		}
+
+		// The first range runs here, the others are stolen while we are busy
+		function(0, grainSize);
+		Wait(counter);
+	}
+
+	inline void JobSystem::WorkerLoop(uint32_t worker)
+	{
+		currentWorker = worker;
+		while (true)
+		{
+			{
+				std::unique_lock<std::mutex> lock(sleepMutex);
+				sleepCondition.wait(lock, [&] { return quit || (worker < activeWorkers && queuedJobs > 0); });
+				if (quit)
+					return;
+			}
+
+			while (worker < activeWorkers && RunOne(worker))
+			{
+			}
+		}
+	}
+
+	inline TaskGraph::TaskId TaskGraph::Add(const char* name, std::function<void()> function)
+	{
+		Task& task = tasks.emplace_back();
+		task.name = name;
+		task.function = std::move(function);
+		return (TaskId)tasks.size() - 1;
+	}
+
+	inline void TaskGraph::DependsOn(TaskId task, TaskId dependency)
+	{
+		tasks[dependency].dependents.push_back(task);
+		tasks[task].dependencyCount++;
+	}
+
+	inline void TaskGraph::Schedule(JobSystem& jobSystem, TaskId id, JobCounter* counter)
+	{
+		jobSystem.Schedule([this, &jobSystem, id, counter]
+		{
+			Task& task = tasks[id];
+			auto start = std::chrono::high_resolution_clock::now();
+			task.function();
+			task.time = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+			for (TaskId dependent : task.dependents)
+			{
+				if (tasks[dependent].remainingDependencies.fetch_sub(1) == 1)
+					Schedule(jobSystem, dependent, counter);
+			}
+		}, counter);
+	}
+
+	inline void TaskGraph::Run(JobSystem& jobSystem)
+	{
+		for (Task& task : tasks)
+			task.remainingDependencies = task.dependencyCount;
+
+		// Dependents are scheduled before their parent's job finishes, so the counter only reaches zero at the very end
+		JobCounter pending = 0;
+		for (TaskId i = 0; i < (TaskId)tasks.size(); i++)
+		{
+			if (tasks[i].dependencyCount == 0)
+				Schedule(jobSystem, i, &pending);
+		}
+		jobSystem.Wait(pending);
+	}
+}
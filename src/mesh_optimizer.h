@@ -0,0 +1,377 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Index buffer optimizations run once when a mesh is cooked, before it is uploaded to the geometry pool
+// 1. OptimizeVertexCache reorders triangles for the post-transform cache (Forsyth's linear-speed algorithm)
+// 2. OptimizeOverdraw reorders clusters of that order so outward facing geometry draws first, keeping most of the cache gains
+// 3. OptimizeVertexFetch renumbers vertices in first-use order so vertex fetches walk memory linearly
+namespace MeshOptimizer
+{
+	struct VertexCacheStats
+	{
+		uint32_t triangles = 0;
+		uint32_t vertices = 0;       // referenced by the index buffer
+		uint32_t transforms = 0;     // vertex shader invocations
+		float acmr = 0.0f;           // transforms per triangle, 0.5 is the best a regular grid can do, 3 is no reuse
+		float atvr = 0.0f;           // transforms per vertex, 1 is optimal
+	};
+
+	// Simulates a FIFO post-transform cache, 16 entries is conservative for current GPUs
+	inline VertexCacheStats AnalyzeVertexCache(const std::vector<uint32_t>& indices, uint32_t vertexCount, uint32_t cacheSize = 16)
+	{
+		VertexCacheStats stats;
+		std::vector<uint32_t> cacheTimestamps(vertexCount, 0);
+		std::vector<uint8_t> referenced(vertexCount, 0);
+		uint32_t timestamp = cacheSize + 1;
+
+		for (uint32_t index : indices)
+		{
+			// In the cache while fewer than cacheSize misses happened since it was loaded
+			if (timestamp - cacheTimestamps[index] > cacheSize)
+			{
+				cacheTimestamps[index] = timestamp++;
+				stats.transforms++;
+			}
+			if (!referenced[index])
+			{
+				referenced[index] = 1;
+				stats.vertices++;
+			}
+		}
+
+		stats.triangles = (uint32_t)indices.size() / 3;
+		stats.acmr = stats.triangles > 0 ? float(stats.transforms) / float(stats.triangles) : 0.0f;
+		stats.atvr = stats.vertices > 0 ? float(stats.transforms) / float(stats.vertices) : 0.0f;
+		return stats;
+	}
+
+	namespace Detail
+	{
+		constexpr uint32_t cacheSize = 32;
+		constexpr uint32_t maxValence = 8; // valences above this all get the smallest boost
+
+		// Forsyth's scores: the last triangle's vertices get a fixed score so the next triangle does not just reuse them,
+		// older cache entries decay, and vertices with few triangles left are boosted so they get finished and leave
+		struct ScoreTable
+		{
+			float cache[cacheSize + 3];
+			float valence[maxValence + 1];
+
+			ScoreTable()
+			{
+				for (uint32_t i = 0; i < cacheSize + 3; i++)
+				{
+					if (i < 3)
+						cache[i] = 0.75f;
+					else if (i < cacheSize)
+						cache[i] = powf(1.0f - float(i - 3) / float(cacheSize - 3), 1.5f);
+					else
+						cache[i] = 0.0f;
+				}
+				valence[0] = 0.0f;
+				for (uint32_t i = 1; i <= maxValence; i++)
+					valence[i] = 2.0f / sqrtf(float(i));
+			}
+		};
+
+		inline float VertexScore(const ScoreTable& table, int32_t cachePosition, uint32_t remaining)
+		{
+			if (remaining == 0)
+				return -1.0f;
+			const float cacheScore = cachePosition >= 0 ? table.cache[cachePosition] : 0.0f;
+			return cacheScore + table.valence[std::min(remaining, maxValence)];
+		}
+	}
+
+	// Reorders triangles in place so consecutive triangles share vertices
+	inline void OptimizeVertexCache(std::vector<uint32_t>& indices, uint32_t vertexCount)
+	{
+		using namespace Detail;
+		static const ScoreTable table;
+
+		const uint32_t triangleCount = (uint32_t)indices.size() / 3;
+		if (triangleCount == 0)
+			return;
+
+		// Triangles of every vertex, as offsets into one array
+		std::vector<uint32_t> triangleOffsets(vertexCount + 1, 0);
+		for (uint32_t index : indices)
+			triangleOffsets[index + 1]++;
+		for (uint32_t v = 0; v < vertexCount; v++)
+			triangleOffsets[v + 1] += triangleOffsets[v];
+		std::vector<uint32_t> remaining(vertexCount);
+		for (uint32_t v = 0; v < vertexCount; v++)
+			remaining[v] = triangleOffsets[v + 1] - triangleOffsets[v];
+
+		std::vector<uint32_t> adjacency(indices.size());
+		{
+			std::vector<uint32_t> fill(triangleOffsets.begin(), triangleOffsets.end() - 1);
+			for (uint32_t t = 0; t < triangleCount; t++)
+			{
+				for (uint32_t k = 0; k < 3; k++)
+					adjacency[fill[indices[t * 3 + k]]++] = t;
+			}
+		}
+
+		// Emitted triangles are swapped to the end of their vertices' lists, remaining[v] counts the live prefix
+		std::vector<int32_t> cachePosition(vertexCount, -1);
+		std::vector<float> vertexScores(vertexCount);
+		for (uint32_t v = 0; v < vertexCount; v++)
+			vertexScores[v] = VertexScore(table, -1, remaining[v]);
+
+		std::vector<float> triangleScores(triangleCount);
+		for (uint32_t t = 0; t < triangleCount; t++)
+			triangleScores[t] = vertexScores[indices[t * 3 + 0]] + vertexScores[indices[t * 3 + 1]] + vertexScores[indices[t * 3 + 2]];
+
+		std::vector<uint8_t> emitted(triangleCount, 0);
+		std::vector<uint32_t> result;
+		result.reserve(indices.size());
+
+		uint32_t cache[cacheSize + 3];
+		uint32_t cacheCount = 0;
+		uint32_t scanPosition = 0; // triangles before it are all emitted
+
+		uint32_t best = 0;
+		while (result.size() < indices.size())
+		{
+			const uint32_t a = indices[best * 3 + 0];
+			const uint32_t b = indices[best * 3 + 1];
+			const uint32_t c = indices[best * 3 + 2];
+			result.push_back(a);
+			result.push_back(b);
+			result.push_back(c);
+			emitted[best] = 1;
+
+			// Move the triangle's vertices to the front of the LRU cache, degenerate triangles only take one slot per vertex
+			uint32_t newCache[cacheSize + 3] = { a };
+			uint32_t newCount = 1;
+			if (b != a)
+				newCache[newCount++] = b;
+			if (c != a && c != b)
+				newCache[newCount++] = c;
+			const uint32_t triangleVertexCount = newCount;
+			for (uint32_t i = 0; i < cacheCount; i++)
+			{
+				const uint32_t v = cache[i];
+				if (v != a && v != b && v != c)
+					newCache[newCount++] = v;
+			}
+
+			// A triangle that repeats an index is listed twice by that vertex, every copy goes or it would be emitted again
+			for (uint32_t k = 0; k < triangleVertexCount; k++)
+			{
+				const uint32_t v = newCache[k];
+				uint32_t* triangles = &adjacency[triangleOffsets[v]];
+				for (uint32_t i = 0; i < remaining[v];)
+				{
+					if (triangles[i] == best)
+					{
+						std::swap(triangles[i], triangles[remaining[v] - 1]);
+						remaining[v]--;
+					}
+					else
+					{
+						i++;
+					}
+				}
+			}
+
+			// Rescore everything that was in the cache, including vertices that just dropped out of it
+			for (uint32_t i = 0; i < newCount; i++)
+			{
+				const uint32_t v = newCache[i];
+				cachePosition[v] = i < cacheSize ? (int32_t)i : -1;
+				const float score = VertexScore(table, cachePosition[v], remaining[v]);
+				const float delta = score - vertexScores[v];
+				vertexScores[v] = score;
+
+				const uint32_t* triangles = &adjacency[triangleOffsets[v]];
+				for (uint32_t j = 0; j < remaining[v]; j++)
+					triangleScores[triangles[j]] += delta;
+			}
+			cacheCount = std::min(newCount, cacheSize);
+			std::copy(newCache, newCache + cacheCount, cache);
+
+			// The next triangle is the best one touching the cache, only when none is left fall back to a scan
+			float bestScore = -1.0f;
+			for (uint32_t i = 0; i < cacheCount; i++)
+			{
+				const uint32_t v = cache[i];
+				const uint32_t* triangles = &adjacency[triangleOffsets[v]];
+				for (uint32_t j = 0; j < remaining[v]; j++)
+				{
+					if (triangleScores[triangles[j]] > bestScore)
+					{
+						bestScore = triangleScores[triangles[j]];
+						best = triangles[j];
+					}
+				}
+			}
+
+			if (bestScore < 0.0f)
+			{
+				while (scanPosition < triangleCount && emitted[scanPosition])
+					scanPosition++;
+				if (scanPosition == triangleCount)
+					break;
+				best = scanPosition;
+			}
+		}
+
+#ifndef NDEBUG
+		// Every input triangle comes out exactly once
+		auto sortedTriangles = [](const std::vector<uint32_t>& list)
+		{
+			std::vector<std::array<uint32_t, 3>> triangles(list.size() / 3);
+			for (size_t t = 0; t < triangles.size(); t++)
+				triangles[t] = { list[t * 3 + 0], list[t * 3 + 1], list[t * 3 + 2] };
+			std::sort(triangles.begin(), triangles.end());
+			return triangles;
+		};
+		assert(sortedTriangles(result) == sortedTriangles(indices));
+#endif
+
+		indices.swap(result);
+	}
+
+	// Splits a cache optimized order into clusters and sorts them front to back from the outside of the mesh in,
+	// threshold is how much ACMR may grow (1.05 = 5%) in exchange for smaller clusters that sort better
+	template <typename VertexT>
+	void OptimizeOverdraw(std::vector<uint32_t>& indices, const std::vector<VertexT>& vertices, float threshold = 1.05f)
+	{
+		const uint32_t triangleCount = (uint32_t)indices.size() / 3;
+		if (triangleCount == 0)
+			return;
+
+		const uint32_t cacheSize = 16;
+		std::vector<uint32_t> cacheTimestamps(vertices.size(), 0);
+		uint32_t timestamp = cacheSize + 1;
+		auto triangleMisses = [&](uint32_t t)
+		{
+			uint32_t misses = 0;
+			for (uint32_t k = 0; k < 3; k++)
+			{
+				const uint32_t index = indices[t * 3 + k];
+				if (timestamp - cacheTimestamps[index] > cacheSize)
+				{
+					cacheTimestamps[index] = timestamp++;
+					misses++;
+				}
+			}
+			return misses;
+		};
+		auto flushCache = [&] { timestamp += cacheSize + 1; };
+
+		// Hard boundaries: a triangle missing all three vertices starts a new patch of the mesh
+		std::vector<uint32_t> hardClusters;
+		for (uint32_t t = 0; t < triangleCount; t++)
+		{
+			if (triangleMisses(t) == 3 || t == 0)
+				hardClusters.push_back(t);
+		}
+
+		// Soft boundaries: split patches further every time the running ACMR gets within threshold of the patch's ACMR,
+		// the cache is flushed at every split so this never assumes reuse across clusters
+		std::vector<uint32_t> clusters;
+		for (size_t h = 0; h < hardClusters.size(); h++)
+		{
+			const uint32_t start = hardClusters[h];
+			const uint32_t end = h + 1 < hardClusters.size() ? hardClusters[h + 1] : triangleCount;
+
+			flushCache();
+			uint32_t clusterMisses = 0;
+			for (uint32_t t = start; t < end; t++)
+				clusterMisses += triangleMisses(t);
+			const float clusterThreshold = threshold * float(clusterMisses) / float(end - start);
+
+			flushCache();
+			clusters.push_back(start);
+			uint32_t runningMisses = 0;
+			uint32_t runningTriangles = 0;
+			for (uint32_t t = start; t < end; t++)
+			{
+				runningMisses += triangleMisses(t);
+				runningTriangles++;
+				if (float(runningMisses) / float(runningTriangles) <= clusterThreshold && t + 1 < end)
+				{
+					clusters.push_back(t + 1);
+					flushCache();
+					runningMisses = 0;
+					runningTriangles = 0;
+				}
+			}
+		}
+
+		// Clusters facing away from the mesh's center are likely in front of the rest from any view
+		glm::vec3 meshCentroid = glm::vec3(0.0f);
+		for (uint32_t index : indices)
+			meshCentroid += vertices[index].position;
+		meshCentroid /= float(indices.size());
+
+		const uint32_t clusterCount = (uint32_t)clusters.size();
+		std::vector<float> sortKeys(clusterCount);
+		for (uint32_t c = 0; c < clusterCount; c++)
+		{
+			const uint32_t end = c + 1 < clusterCount ? clusters[c + 1] : triangleCount;
+			glm::vec3 centroid = glm::vec3(0.0f);
+			glm::vec3 normal = glm::vec3(0.0f);
+			float area = 0.0f;
+			for (uint32_t t = clusters[c]; t < end; t++)
+			{
+				const glm::vec3 p0 = vertices[indices[t * 3 + 0]].position;
+				const glm::vec3 p1 = vertices[indices[t * 3 + 1]].position;
+				const glm::vec3 p2 = vertices[indices[t * 3 + 2]].position;
+				const glm::vec3 triangleNormal = glm::cross(p1 - p0, p2 - p0);
+				const float triangleArea = glm::length(triangleNormal);
+				centroid += (p0 + p1 + p2) * (triangleArea / 3.0f);
+				normal += triangleNormal;
+				area += triangleArea;
+			}
+			centroid = area > 0.0f ? centroid / area : centroid;
+			const float normalLength = glm::length(normal);
+			normal = normalLength > 0.0f ? normal / normalLength : normal;
+			sortKeys[c] = glm::dot(centroid - meshCentroid, normal);
+		}
+
+		std::vector<uint32_t> order(clusterCount);
+		for (uint32_t c = 0; c < clusterCount; c++)
+			order[c] = c;
+		std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return sortKeys[a] > sortKeys[b]; });
+
+		std::vector<uint32_t> result;
+		result.reserve(indices.size());
+		for (uint32_t c : order)
+		{
+			const uint32_t end = c + 1 < clusterCount ? clusters[c + 1] : triangleCount;
+			result.insert(result.end(), indices.begin() + clusters[c] * 3, indices.begin() + end * 3);
+		}
+		indices.swap(result);
+	}
+
+	// Renumbers vertices in the order the index buffer first uses them and drops unreferenced ones
+	template <typename VertexT>
+	void OptimizeVertexFetch(std::vector<VertexT>& vertices, std::vector<uint32_t>& indices)
+	{
+		std::vector<uint32_t> remap(vertices.size(), UINT32_MAX);
+		std::vector<VertexT> result;
+		result.reserve(vertices.size());
+		for (uint32_t& index : indices)
+		{
+			if (remap[index] == UINT32_MAX)
+			{
+				remap[index] = (uint32_t)result.size();
+				result.push_back(vertices[index]);
+			}
+			index = remap[index];
+		}
+		vertices.swap(result);
+	}
+}
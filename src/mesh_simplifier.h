@@ -0,0 +1,357 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Quadric error edge collapse simplifier (Garland & Heckbert)
+// Vertices only collapse onto existing vertices, so every LOD indexes the original vertex buffer and only needs its own indices.
+// Vertices that share a position (UV or normal seams) collapse together, seam vertices only slide along their seam.
+namespace MeshSimplifier
+{
+	namespace Detail
+	{
+		// Symmetric 4x4 error matrix of the squared distance to a set of planes, weighted by area
+		struct Quadric
+		{
+			double a2 = 0, b2 = 0, c2 = 0, d2 = 0;
+			double ab = 0, ac = 0, ad = 0, bc = 0, bd = 0, cd = 0;
+			double weight = 0;
+
+			static Quadric FromPlane(glm::dvec3 normal, double distance, double weight)
+			{
+				Quadric q;
+				q.a2 = normal.x * normal.x * weight;
+				q.b2 = normal.y * normal.y * weight;
+				q.c2 = normal.z * normal.z * weight;
+				q.d2 = distance * distance * weight;
+				q.ab = normal.x * normal.y * weight;
+				q.ac = normal.x * normal.z * weight;
+				q.ad = normal.x * distance * weight;
+				q.bc = normal.y * normal.z * weight;
+				q.bd = normal.y * distance * weight;
+				q.cd = normal.z * distance * weight;
+				q.weight = weight;
+				return q;
+			}
+
+			void Add(const Quadric& other)
+			{
+				a2 += other.a2; b2 += other.b2; c2 += other.c2; d2 += other.d2;
+				ab += other.ab; ac += other.ac; ad += other.ad;
+				bc += other.bc; bd += other.bd; cd += other.cd;
+				weight += other.weight;
+			}
+
+			// Weighted mean squared distance of p to the planes
+			double Error(glm::dvec3 p) const
+			{
+				const double rx = a2 * p.x + ab * p.y + ac * p.z;
+				const double ry = ab * p.x + b2 * p.y + bc * p.z;
+				const double rz = ac * p.x + bc * p.y + c2 * p.z;
+				const double error = rx * p.x + ry * p.y + rz * p.z + 2.0 * (ad * p.x + bd * p.y + cd * p.z) + d2;
+				return weight > 0.0 ? fabs(error) / weight : 0.0;
+			}
+		};
+
+		struct Collapse
+		{
+			uint32_t from;
+			uint32_t to;
+			double error;
+		};
+
+		inline uint64_t EdgeKey(uint32_t a, uint32_t b)
+		{
+			return a < b ? (uint64_t(a) << 32) | b : (uint64_t(b) << 32) | a;
+		}
+
+		// Border edges are much stiffer than the surface so open meshes keep their outline
+		constexpr double borderWeight = 10.0;
+		constexpr uint32_t maxPasses = 64;
+	}
+
+	// Writes a simplified copy of indices with at most targetIndexCount indices, as long as no collapse moves the surface by more
+	// than targetError (relative to the mesh's largest extent). Returns the reached error in object space units.
+	template <typename VertexT>
+	float Simplify(std::vector<uint32_t>& result, const std::vector<VertexT>& vertices, const std::vector<uint32_t>& indices,
+				   size_t targetIndexCount, float targetError)
+	{
+		using namespace Detail;
+		const uint32_t vertexCount = (uint32_t)vertices.size();
+		result = indices;
+		if (indices.empty())
+			return 0.0f;
+
+		// Positions normalized to the unit cube so errors do not depend on the mesh's size
+		glm::vec3 boxMin = glm::vec3(FLT_MAX);
+		glm::vec3 boxMax = glm::vec3(-FLT_MAX);
+		for (const VertexT& vertex : vertices)
+		{
+			boxMin = glm::min(boxMin, vertex.position);
+			boxMax = glm::max(boxMax, vertex.position);
+		}
+		const glm::vec3 boxSize = boxMax - boxMin;
+		const float extent = std::max(std::max(boxSize.x, boxSize.y), std::max(boxSize.z, FLT_MIN));
+		std::vector<glm::dvec3> positions(vertexCount);
+		for (uint32_t v = 0; v < vertexCount; v++)
+			positions[v] = glm::dvec3((vertices[v].position - boxMin) / extent);
+
+		// Vertices at the same position form a ring of wedges, the first one of the ring stands for all of them
+		std::vector<uint32_t> representative(vertexCount);
+		std::vector<uint32_t> nextWedge(vertexCount);
+		{
+			struct PositionHash
+			{
+				size_t operator()(const glm::vec3& p) const
+				{
+					uint32_t bits[3];
+					memcpy(bits, &p, sizeof(bits));
+					return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+				}
+			};
+			std::unordered_map<glm::vec3, uint32_t, PositionHash> firstAtPosition;
+			for (uint32_t v = 0; v < vertexCount; v++)
+			{
+				auto inserted = firstAtPosition.emplace(vertices[v].position, v);
+				const uint32_t first = inserted.first->second;
+				representative[v] = first;
+				if (first == v)
+				{
+					nextWedge[v] = v;
+				}
+				else
+				{
+					nextWedge[v] = nextWedge[first];
+					nextWedge[first] = v;
+				}
+			}
+		}
+
+		std::vector<Quadric> quadrics(vertexCount);
+		{
+			std::unordered_map<uint64_t, uint32_t> edgeUse;
+			for (size_t i = 0; i < indices.size(); i += 3)
+			{
+				for (uint32_t k = 0; k < 3; k++)
+					edgeUse[EdgeKey(representative[indices[i + k]], representative[indices[i + (k + 1) % 3]])]++;
+			}
+
+			for (size_t i = 0; i < indices.size(); i += 3)
+			{
+				const uint32_t r[3] = { representative[indices[i]], representative[indices[i + 1]], representative[indices[i + 2]] };
+				const glm::dvec3 p0 = positions[r[0]], p1 = positions[r[1]], p2 = positions[r[2]];
+				glm::dvec3 normal = glm::cross(p1 - p0, p2 - p0);
+				const double area = glm::length(normal);
+				if (area <= 0.0)
+					continue;
+				normal /= area;
+
+				const Quadric plane = Quadric::FromPlane(normal, -glm::dot(normal, p0), area);
+				for (uint32_t k = 0; k < 3; k++)
+					quadrics[r[k]].Add(plane);
+
+				for (uint32_t k = 0; k < 3; k++)
+				{
+					const uint32_t a = r[k];
+					const uint32_t b = r[(k + 1) % 3];
+					if (edgeUse[EdgeKey(a, b)] != 1)
+						continue;
+
+					const glm::dvec3 edge = positions[b] - positions[a];
+					const double length = glm::length(edge);
+					if (length <= 0.0)
+						continue;
+					const glm::dvec3 borderNormal = glm::normalize(glm::cross(edge / length, normal));
+					const Quadric border = Quadric::FromPlane(borderNormal, -glm::dot(borderNormal, positions[a]), length * length * borderWeight);
+					quadrics[a].Add(border);
+					quadrics[b].Add(border);
+				}
+			}
+		}
+
+		const double maxError = double(targetError) * double(targetError);
+		double reachedError = 0.0;
+		std::vector<uint32_t> remap(vertexCount);
+		std::vector<uint8_t> locked(vertexCount);
+		std::vector<uint32_t> triangleOffsets(vertexCount + 1);
+		std::vector<uint32_t> adjacency;
+		std::vector<uint64_t> edges;
+		std::vector<Collapse> collapses;
+
+		for (uint32_t pass = 0; pass < maxPasses && result.size() > targetIndexCount; pass++)
+		{
+			const uint32_t triangleCount = (uint32_t)result.size() / 3;
+
+			// Triangles around every representative, rebuilt each pass since collapses change them
+			std::fill(triangleOffsets.begin(), triangleOffsets.end(), 0);
+			for (uint32_t index : result)
+				triangleOffsets[representative[index] + 1]++;
+			for (uint32_t v = 0; v < vertexCount; v++)
+				triangleOffsets[v + 1] += triangleOffsets[v];
+			adjacency.resize(result.size());
+			{
+				std::vector<uint32_t> fill(triangleOffsets.begin(), triangleOffsets.end() - 1);
+				for (uint32_t t = 0; t < triangleCount; t++)
+				{
+					for (uint32_t k = 0; k < 3; k++)
+						adjacency[fill[representative[result[t * 3 + k]]]++] = t;
+				}
+			}
+
+			edges.clear();
+			for (uint32_t t = 0; t < triangleCount; t++)
+			{
+				for (uint32_t k = 0; k < 3; k++)
+					edges.push_back(EdgeKey(representative[result[t * 3 + k]], representative[result[t * 3 + (k + 1) % 3]]));
+			}
+			std::sort(edges.begin(), edges.end());
+			edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+			// Each edge collapses in the cheaper direction
+			collapses.clear();
+			for (uint64_t edge : edges)
+			{
+				const uint32_t a = uint32_t(edge >> 32);
+				const uint32_t b = uint32_t(edge);
+				Quadric q = quadrics[a];
+				q.Add(quadrics[b]);
+				const double errorAB = q.Error(positions[b]);
+				const double errorBA = q.Error(positions[a]);
+				if (errorAB <= errorBA)
+					collapses.push_back({ a, b, errorAB });
+				else
+					collapses.push_back({ b, a, errorBA });
+			}
+			std::sort(collapses.begin(), collapses.end(), [](const Collapse& x, const Collapse& y) { return x.error < y.error; });
+
+			for (uint32_t v = 0; v < vertexCount; v++)
+				remap[v] = v;
+			std::fill(locked.begin(), locked.end(), 0);
+
+			// Collapses whose one-rings do not overlap can all be applied in the same pass
+			const uint32_t trianglesToRemove = triangleCount - uint32_t(targetIndexCount / 3);
+			uint32_t removed = 0;
+			uint32_t applied = 0;
+			for (const Collapse& collapse : collapses)
+			{
+				if (collapse.error > maxError || removed >= trianglesToRemove)
+					break;
+				if (locked[collapse.from] || locked[collapse.to])
+					continue;
+
+				const uint32_t* triangles = &adjacency[triangleOffsets[collapse.from]];
+				const uint32_t aroundCount = triangleOffsets[collapse.from + 1] - triangleOffsets[collapse.from];
+
+				// Reject collapses that fold a triangle over, and seam collapses that would leave the seam
+				bool valid = true;
+				uint32_t collapsedTriangles = 0;
+				for (uint32_t i = 0; i < aroundCount && valid; i++)
+				{
+					const uint32_t* triangle = &result[triangles[i] * 3];
+					uint32_t r[3] = { representative[triangle[0]], representative[triangle[1]], representative[triangle[2]] };
+					if (r[0] == collapse.to || r[1] == collapse.to || r[2] == collapse.to)
+					{
+						collapsedTriangles++;
+						continue;
+					}
+
+					const glm::dvec3 before = glm::cross(positions[r[1]] - positions[r[0]], positions[r[2]] - positions[r[0]]);
+					for (uint32_t k = 0; k < 3; k++)
+					{
+						if (r[k] == collapse.from)
+							r[k] = collapse.to;
+					}
+					const glm::dvec3 after = glm::cross(positions[r[1]] - positions[r[0]], positions[r[2]] - positions[r[0]]);
+					valid = glm::dot(before, after) > 0.0;
+				}
+				if (!valid)
+					continue;
+
+				// Every wedge of from moves onto the wedge of to it shares a triangle with
+				bool seamSafe = true;
+				uint32_t wedge = collapse.from;
+				do
+				{
+					bool used = false;
+					remap[wedge] = UINT32_MAX;
+					for (uint32_t i = 0; i < aroundCount && remap[wedge] == UINT32_MAX; i++)
+					{
+						const uint32_t* triangle = &result[triangles[i] * 3];
+						for (uint32_t k = 0; k < 3; k++)
+						{
+							if (triangle[k] != wedge)
+								continue;
+							used = true;
+							for (uint32_t j = 0; j < 3; j++)
+							{
+								if (representative[triangle[j]] == collapse.to)
+									remap[wedge] = triangle[j];
+							}
+						}
+					}
+					if (!used)
+					{
+						remap[wedge] = wedge; // no longer indexed
+					}
+					else if (remap[wedge] == UINT32_MAX)
+					{
+						// Only a wedge that is alone at its position may take the representative's attributes
+						seamSafe = seamSafe && nextWedge[collapse.from] == collapse.from;
+						remap[wedge] = collapse.to;
+					}
+					wedge = nextWedge[wedge];
+				} while (wedge != collapse.from);
+
+				if (!seamSafe)
+				{
+					wedge = collapse.from;
+					do
+					{
+						remap[wedge] = wedge;
+						wedge = nextWedge[wedge];
+					} while (wedge != collapse.from);
+					continue;
+				}
+
+				// Lock the whole one-ring, later collapses this pass would invalidate the checks above
+				for (uint32_t i = 0; i < aroundCount; i++)
+				{
+					const uint32_t* triangle = &result[triangles[i] * 3];
+					for (uint32_t k = 0; k < 3; k++)
+						locked[representative[triangle[k]]] = 1;
+				}
+
+				quadrics[collapse.to].Add(quadrics[collapse.from]);
+				reachedError = std::max(reachedError, collapse.error);
+				removed += collapsedTriangles;
+				applied++;
+			}
+
+			if (applied == 0)
+				break;
+
+			// Apply the remap and drop triangles that became degenerate
+			size_t write = 0;
+			for (size_t i = 0; i < result.size(); i += 3)
+			{
+				const uint32_t a = remap[result[i]], b = remap[result[i + 1]], c = remap[result[i + 2]];
+				const uint32_t ra = representative[a], rb = representative[b], rc = representative[c];
+				if (ra == rb || rb == rc || rc == ra)
+					continue;
+				result[write++] = a;
+				result[write++] = b;
+				result[write++] = c;
+			}
+			result.resize(write);
+		}
+
+		return float(sqrt(reachedError)) * extent;
+	}
+}
@@ -0,0 +1,254 @@
+#pragma once
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "mesh_optimizer.h"
+
+// Meshlets are small clusters of a mesh's triangles with their own bounds, so the GPU can cull parts of a mesh.
+// They are contiguous ranges of the index buffer: Build reorders the triangles of an index range so every meshlet
+// is drawn by a single vkCmdDrawIndexed(Indirect) with the standard vertex shaders, no mesh shaders needed.
+namespace Meshlets
+{
+	// 64 vertices and 124 triangles fit the per-meshlet budgets mesh shading hardware is built around,
+	// the same clusters would port to mesh shaders as they are
+	constexpr uint32_t maxVertices = 64;
+	constexpr uint32_t maxTriangles = 124;
+
+	struct Meshlet
+	{
+		uint32_t indexOffset; // first index, in the same index array as the range given to Build
+		uint32_t triangleCount;
+		uint32_t vertexCount; // unique vertices
+		glm::vec4 sphere;     // object space, xyz = center, w = radius
+		// Normal cone: every triangle faces away from a camera for which dot(normalize(coneApex - camera), coneAxis) >= coneCutoff.
+		// A cutoff above 1 means the normals are too spread for the test to ever succeed.
+		glm::vec3 coneApex;
+		glm::vec3 coneAxis;
+		float coneCutoff;
+	};
+
+	template <typename VertexT>
+	void ComputeBounds(Meshlet& meshlet, const uint32_t* indices, const std::vector<VertexT>& vertices)
+	{
+		glm::vec3 minPosition = glm::vec3(FLT_MAX);
+		glm::vec3 maxPosition = glm::vec3(-FLT_MAX);
+		for (uint32_t i = 0; i < meshlet.triangleCount * 3; i++)
+		{
+			minPosition = glm::min(minPosition, vertices[indices[i]].position);
+			maxPosition = glm::max(maxPosition, vertices[indices[i]].position);
+		}
+		glm::vec3 center = (minPosition + maxPosition) * 0.5f;
+		float radius = 0.0f;
+		for (uint32_t i = 0; i < meshlet.triangleCount * 3; i++)
+			radius = std::max(radius, glm::length(vertices[indices[i]].position - center));
+		meshlet.sphere = glm::vec4(center, radius);
+
+		// Average of the unit face normals, degenerate triangles face nowhere and are left out
+		std::vector<glm::vec3> normals;
+		normals.reserve(meshlet.triangleCount);
+		glm::vec3 axis = glm::vec3(0.0f);
+		for (uint32_t t = 0; t < meshlet.triangleCount; t++)
+		{
+			const glm::vec3& p0 = vertices[indices[t * 3 + 0]].position;
+			const glm::vec3& p1 = vertices[indices[t * 3 + 1]].position;
+			const glm::vec3& p2 = vertices[indices[t * 3 + 2]].position;
+			glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+			float length = glm::length(normal);
+			normals.push_back(length > 0.0f ? normal / length : glm::vec3(0.0f));
+			axis += normals.back();
+		}
+
+		meshlet.coneApex = center;
+		meshlet.coneAxis = glm::vec3(0.0f, 0.0f, 1.0f);
+		meshlet.coneCutoff = 2.0f;
+		float axisLength = glm::length(axis);
+		if (axisLength == 0.0f)
+			return;
+		axis /= axisLength;
+
+		float minDot = 1.0f;
+		for (const glm::vec3& normal : normals)
+		{
+			if (normal != glm::vec3(0.0f))
+				minDot = std::min(minDot, glm::dot(normal, axis));
+		}
+		// Close to a half sphere of normals the cone only culls from inside the apex's tiny back region, not worth the test
+		if (minDot <= 0.1f)
+			return;
+
+		// The apex moves back along the axis until it lies behind every triangle's plane, from there on
+		// seeing the back of the cone means seeing the back of every triangle, wherever the camera is
+		float maxT = 0.0f;
+		for (uint32_t t = 0; t < meshlet.triangleCount; t++)
+		{
+			if (normals[t] == glm::vec3(0.0f))
+				continue;
+			const glm::vec3& p0 = vertices[indices[t * 3]].position;
+			float distance = glm::dot(center - p0, normals[t]);
+			maxT = std::max(maxT, distance / glm::dot(axis, normals[t]));
+		}
+
+		meshlet.coneApex = center - axis * maxT;
+		meshlet.coneAxis = axis;
+		meshlet.coneCutoff = sqrtf(1.0f - minDot * minDot);
+	}
+
+	// Splits the triangles of indices[first, first + count) into meshlets, appended to meshlets, and rewrites
+	// that range in meshlet order. Meshlets grow greedily through shared vertices, preferring triangles that add
+	// the fewest vertices and then the ones closest to the meshlet's center. When nothing adjacent fits anymore the
+	// next unused triangle of the input order continues the meshlet, so the input's cache order keeps them local.
+	template <typename VertexT>
+	void Build(std::vector<Meshlet>& meshlets, std::vector<uint32_t>& indices, uint32_t first, uint32_t count, const std::vector<VertexT>& vertices)
+	{
+		const uint32_t triangleCount = count / 3;
+		const uint32_t vertexCount = (uint32_t)vertices.size();
+		const uint32_t* triangles = indices.data() + first;
+		if (triangleCount == 0)
+			return;
+
+		// Triangles of every vertex
+		std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+		for (uint32_t i = 0; i < triangleCount * 3; i++)
+			adjacencyOffsets[triangles[i] + 1]++;
+		for (uint32_t v = 0; v < vertexCount; v++)
+			adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+		std::vector<uint32_t> adjacency(triangleCount * 3);
+		std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+		for (uint32_t i = 0; i < triangleCount * 3; i++)
+			adjacency[fill[triangles[i]]++] = i / 3;
+
+		std::vector<glm::vec3> centroids(triangleCount);
+		for (uint32_t t = 0; t < triangleCount; t++)
+			centroids[t] = (vertices[triangles[t * 3]].position + vertices[triangles[t * 3 + 1]].position + vertices[triangles[t * 3 + 2]].position) / 3.0f;
+
+		std::vector<uint8_t> emitted(triangleCount, 0);
+		std::vector<uint32_t> vertexMeshlet(vertexCount, UINT32_MAX); // last meshlet that used the vertex
+		std::vector<uint32_t> order;
+		order.reserve(triangleCount);
+
+		uint32_t meshletId = 0;
+		uint32_t meshletStart = 0; // into order
+		std::vector<uint32_t> meshletVertices;
+		meshletVertices.reserve(maxVertices);
+		glm::vec3 centroidSum = glm::vec3(0.0f);
+		uint32_t cursor = 0;
+
+		auto newVertices = [&](uint32_t t)
+		{
+			const uint32_t a = triangles[t * 3], b = triangles[t * 3 + 1], c = triangles[t * 3 + 2];
+			// Degenerate triangles may repeat a vertex, it only counts once
+			return uint32_t(vertexMeshlet[a] != meshletId)
+				+ uint32_t(vertexMeshlet[b] != meshletId && b != a)
+				+ uint32_t(vertexMeshlet[c] != meshletId && c != a && c != b);
+		};
+
+		auto flush = [&]
+		{
+			Meshlet meshlet = {};
+			meshlet.indexOffset = first + meshletStart * 3;
+			meshlet.triangleCount = (uint32_t)order.size() - meshletStart;
+			meshlet.vertexCount = (uint32_t)meshletVertices.size();
+			meshlets.push_back(meshlet);
+
+			meshletId++;
+			meshletStart = (uint32_t)order.size();
+			meshletVertices.clear();
+			centroidSum = glm::vec3(0.0f);
+		};
+
+		while (order.size() < triangleCount)
+		{
+			const uint32_t meshletTriangles = (uint32_t)order.size() - meshletStart;
+			const glm::vec3 center = meshletTriangles > 0 ? centroidSum / float(meshletTriangles) : glm::vec3(0.0f);
+
+			uint32_t best = UINT32_MAX;
+			uint32_t bestExtra = UINT32_MAX;
+			float bestDistance = FLT_MAX;
+			for (uint32_t v : meshletVertices)
+			{
+				for (uint32_t a = adjacencyOffsets[v]; a < adjacencyOffsets[v + 1]; a++)
+				{
+					uint32_t t = adjacency[a];
+					if (emitted[t])
+						continue;
+					uint32_t extra = newVertices(t);
+					if (meshletVertices.size() + extra > maxVertices)
+						continue;
+					glm::vec3 offset = centroids[t] - center;
+					float distance = glm::dot(offset, offset);
+					if (extra < bestExtra || (extra == bestExtra && distance < bestDistance))
+					{
+						best = t;
+						bestExtra = extra;
+						bestDistance = distance;
+					}
+				}
+			}
+
+			if (best == UINT32_MAX)
+			{
+				while (emitted[cursor])
+					cursor++;
+				best = cursor;
+				if (meshletVertices.size() + newVertices(best) > maxVertices)
+					flush();
+			}
+
+			emitted[best] = 1;
+			order.push_back(best);
+			centroidSum += centroids[best];
+			for (uint32_t k = 0; k < 3; k++)
+			{
+				uint32_t v = triangles[best * 3 + k];
+				if (vertexMeshlet[v] != meshletId)
+				{
+					vertexMeshlet[v] = meshletId;
+					meshletVertices.push_back(v);
+				}
+			}
+
+			if (order.size() - meshletStart == maxTriangles)
+				flush();
+		}
+		if (order.size() > meshletStart)
+			flush();
+
+		std::vector<uint32_t> reordered(triangleCount * 3);
+		for (uint32_t i = 0; i < triangleCount; i++)
+		{
+			for (uint32_t k = 0; k < 3; k++)
+				reordered[i * 3 + k] = triangles[order[i] * 3 + k];
+		}
+		std::copy(reordered.begin(), reordered.end(), indices.begin() + first);
+
+		// Growing by adjacency loses some of the input's cache order, each meshlet is reordered again on its own,
+		// in meshlet local indices so the optimizer only has to track the meshlet's vertices
+		std::vector<uint32_t> localIndices;
+		std::vector<uint32_t> localVertices;
+		for (size_t m = meshlets.size() - meshletId; m < meshlets.size(); m++)
+		{
+			Meshlet& meshlet = meshlets[m];
+			uint32_t* meshletIndices = indices.data() + meshlet.indexOffset;
+			localIndices.resize(meshlet.triangleCount * 3);
+			localVertices.clear();
+			for (uint32_t i = 0; i < meshlet.triangleCount * 3; i++)
+			{
+				auto it = std::find(localVertices.begin(), localVertices.end(), meshletIndices[i]);
+				localIndices[i] = uint32_t(it - localVertices.begin());
+				if (it == localVertices.end())
+					localVertices.push_back(meshletIndices[i]);
+			}
+			MeshOptimizer::OptimizeVertexCache(localIndices, (uint32_t)localVertices.size());
+			for (uint32_t i = 0; i < meshlet.triangleCount * 3; i++)
+				meshletIndices[i] = localVertices[localIndices[i]];
+
+			ComputeBounds(meshlet, meshletIndices, vertices);
+		}
+	}
+}
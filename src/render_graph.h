@@ -0,0 +1,679 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+#include "VulkanMemoryAllocator/vk_mem_alloc.h"
+#include "vk_check.h"
+
+// Render graph
+// Passes declare which images and buffers they read and write and how, the graph then
+//  - culls passes whose results nobody uses,
+//  - inserts the barriers between passes, one vkCmdPipelineBarrier2 per pass holding everything it needs,
+//  - creates the transient images and aliases those whose lifetimes don't overlap onto the same VMA memory.
+// The graph is declared again every frame, the transient images are kept as long as the declaration doesn't change.
+namespace RenderGraph
+{
+	using ResourceId = uint32_t;
+	using PassId = uint32_t;
+
+	// How a pass uses a resource, each maps to a stage, access mask and (for images) layout
+	enum class Access : uint32_t
+	{
+		ColorAttachment,        // read and write, covers blending and LOAD
+		DepthAttachment,        // read and write
+		DepthAttachmentRead,    // depth test without writes
+		FragmentSampled,
+		ComputeSampled,
+		ComputeStorageRead,
+		ComputeStorageWrite,
+		VertexStorageRead,
+		FragmentStorageRead,
+		IndirectRead,
+		TransferRead,
+		TransferWrite,
+		Count
+	};
+
+	struct AccessInfo
+	{
+		VkPipelineStageFlags2 stage;
+		VkAccessFlags2 access;
+		VkImageLayout layout;
+		bool write;
+	};
+
+	inline AccessInfo GetAccessInfo(Access access)
+	{
+		const VkPipelineStageFlags2 depthStages = VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT;
+		switch (access)
+		{
+		case Access::ColorAttachment:
+			return { VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, true };
+		case Access::DepthAttachment:
+			return { depthStages, VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL, true };
+		case Access::DepthAttachmentRead:
+			return { depthStages, VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT, VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL, false };
+		case Access::FragmentSampled:
+			return { VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, false };
+		case Access::ComputeSampled:
+			return { VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, false };
+		case Access::ComputeStorageRead:
+			return { VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT, VK_IMAGE_LAYOUT_GENERAL, false };
+		case Access::ComputeStorageWrite:
+			return { VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL, true };
+		case Access::VertexStorageRead:
+			return { VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT, VK_IMAGE_LAYOUT_GENERAL, false };
+		case Access::FragmentStorageRead:
+			return { VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT, VK_IMAGE_LAYOUT_GENERAL, false };
+		case Access::IndirectRead:
+			return { VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED, false };
+		case Access::TransferRead:
+			return { VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, false };
+		case Access::TransferWrite:
+			return { VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, true };
+		default:
+			assert(false);
+			return {};
+		}
+	}
+
+	// Synchronization state of a resource between passes
+	// writeStage/writeAccess: the last write, which everything after has to wait on
+	// readStages/readAccess: what has been made to wait on that write already, and what a following write has to wait on
+	struct ResourceState
+	{
+		VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+		VkPipelineStageFlags2 writeStage = VK_PIPELINE_STAGE_2_NONE;
+		VkAccessFlags2 writeAccess = VK_ACCESS_2_NONE;
+		VkPipelineStageFlags2 readStages = VK_PIPELINE_STAGE_2_NONE;
+		VkAccessFlags2 readAccess = VK_ACCESS_2_NONE;
+	};
+
+	struct ImageDesc
+	{
+		VkFormat format;
+		VkExtent2D extent;
+		VkImageUsageFlags usage;
+		VkImageAspectFlags aspect;
+
+		bool operator==(const ImageDesc& other) const
+		{
+			return format == other.format && extent.width == other.extent.width && extent.height == other.extent.height
+				&& usage == other.usage && aspect == other.aspect;
+		}
+	};
+
+	struct GraphStats
+	{
+		uint32_t passCount = 0;
+		uint32_t culledPassCount = 0;
+		uint32_t barrierBatchCount = 0;
+		uint32_t imageBarrierCount = 0;
+		uint32_t bufferBarrierCount = 0;
+		uint32_t transientImageCount = 0;
+		uint32_t transientMemoryBlocks = 0;
+		VkDeviceSize transientBytes = 0;        // memory actually allocated
+		VkDeviceSize transientBytesUnaliased = 0; // what one allocation per image would take
+	};
+
+	class Graph
+	{
+	public:
+		// retire receives the destruction of transient images that may still be used by frames in flight
+		void Init(VkDevice device, VmaAllocator allocator, std::function<void(std::function<void()>&&)> retire);
+		// Destroys the transient images right away, the device must be idle
+		void Destroy();
+
+		// Starts a new declaration, the transient images of the previous one are kept for reuse
+		void Reset();
+
+		ResourceId CreateImage(const char* name, const ImageDesc& desc);
+		// External resources come with their current state, output ones are what keeps passes from being culled
+		ResourceId ImportImage(const char* name, VkImage image, VkImageView view, VkImageAspectFlags aspect, const ResourceState& state, bool output);
+		ResourceId ImportBuffer(const char* name, VkBuffer buffer, const ResourceState& state, bool output);
+
+		PassId AddPass(const char* name, std::function<void(VkCommandBuffer cmd)> execute);
+		void Read(PassId pass, ResourceId resource, Access access);
+		void Write(PassId pass, ResourceId resource, Access access);
+		// The pass does something outside the graph (readback, present...) and must never be culled
+		void SetSideEffects(PassId pass);
+
+		// Culls passes and creates or reuses the transient images, called once the frame is declared
+		void Compile();
+		// Records the live passes with their barriers
+		void Execute(VkCommandBuffer cmd);
+
+		VkImage GetImage(ResourceId resource) const { return resources[resource].image; }
+		VkImageView GetImageView(ResourceId resource) const { return resources[resource].view; }
+		VkBuffer GetBuffer(ResourceId resource) const { return resources[resource].buffer; }
+		const ImageDesc& GetImageDesc(ResourceId resource) const { return resources[resource].desc; }
+
+		uint32_t PassCount() const { return (uint32_t)passes.size(); }
+		const char* PassName(PassId pass) const { return passes[pass].name; }
+		bool PassCulled(PassId pass) const { return passes[pass].culled; }
+		const GraphStats& Stats() const { return stats; }
+
+	private:
+		enum class ResourceType { TransientImage, ImportedImage, ImportedBuffer };
+
+		struct Resource
+		{
+			const char* name;
+			ResourceType type;
+			bool output = false;
+			ImageDesc desc = {};
+			VkImageAspectFlags aspect = 0;
+			VkImage image = VK_NULL_HANDLE;
+			VkImageView view = VK_NULL_HANDLE;
+			VkBuffer buffer = VK_NULL_HANDLE;
+			ResourceState state;
+			uint32_t transientIndex = UINT32_MAX; // into physicalImages
+			bool started = false; // transient got its first barrier this frame
+		};
+
+		struct ResourceAccess
+		{
+			ResourceId resource;
+			Access access;
+		};
+
+		struct Pass
+		{
+			const char* name;
+			std::function<void(VkCommandBuffer cmd)> execute;
+			std::vector<ResourceAccess> reads;
+			std::vector<ResourceAccess> writes;
+			bool sideEffects = false;
+			bool culled = false;
+		};
+
+		// A transient image as it was declared, used to tell whether the physical images can be reused
+		struct TransientKey
+		{
+			ImageDesc desc;
+			uint32_t firstPass;
+			uint32_t lastPass;
+
+			bool operator==(const TransientKey& other) const
+			{
+				return desc == other.desc && firstPass == other.firstPass && lastPass == other.lastPass;
+			}
+		};
+
+		struct PhysicalImage
+		{
+			VkImage image = VK_NULL_HANDLE;
+			VkImageView view = VK_NULL_HANDLE;
+			uint32_t memoryBlock = 0;
+		};
+
+		// Memory shared by every transient image placed in it, lastStages/lastWrites follow whichever image used it
+		// last, this frame or the previous one, so the next image placed in it waits for that use to finish
+		struct MemoryBlock
+		{
+			VmaAllocation allocation = VK_NULL_HANDLE;
+			VkMemoryRequirements requirements = {};
+			uint32_t lastPass = 0;
+			VkPipelineStageFlags2 lastStages = VK_PIPELINE_STAGE_2_NONE;
+			VkAccessFlags2 lastWrites = VK_ACCESS_2_NONE;
+		};
+
+		void Cull();
+		void AllocateTransients();
+		void ReleaseTransients(bool immediate);
+		void AddBarrier(ResourceId resourceId, Access access, std::vector<VkImageMemoryBarrier2>& imageBarriers, std::vector<VkBufferMemoryBarrier2>& bufferBarriers);
+
+		VkDevice device = VK_NULL_HANDLE;
+		VmaAllocator allocator = VK_NULL_HANDLE;
+		std::function<void(std::function<void()>&&)> retire;
+
+		std::vector<Resource> resources;
+		std::vector<Pass> passes;
+
+		std::vector<TransientKey> transientKeys;
+		std::vector<PhysicalImage> physicalImages;
+		std::vector<MemoryBlock> memoryBlocks;
+
+		GraphStats stats;
+	};
+
+	inline void Graph::Init(VkDevice device, VmaAllocator allocator, std::function<void(std::function<void()>&&)> retire)
+	{
+		this->device = device;
+		this->allocator = allocator;
+		this->retire = std::move(retire);
+	}
+
+	inline void Graph::Destroy()
+	{
+		ReleaseTransients(true);
+	}
+
+	inline void Graph::Reset()
+	{
+		resources.clear();
+		passes.clear();
+	}
+
+	inline ResourceId Graph::CreateImage(const char* name, const ImageDesc& desc)
+	{
+		Resource& resource = resources.emplace_back();
+		resource.name = name;
+		resource.type = ResourceType::TransientImage;
+		resource.desc = desc;
+		resource.aspect = desc.aspect;
+		return (ResourceId)resources.size() - 1;
+	}
+
+	inline ResourceId Graph::ImportImage(const char* name, VkImage image, VkImageView view, VkImageAspectFlags aspect, const ResourceState& state, bool output)
+	{
+		Resource& resource = resources.emplace_back();
+		resource.name = name;
+		resource.type = ResourceType::ImportedImage;
+		resource.output = output;
+		resource.image = image;
+		resource.view = view;
+		resource.aspect = aspect;
+		resource.state = state;
+		return (ResourceId)resources.size() - 1;
+	}
+
+	inline ResourceId Graph::ImportBuffer(const char* name, VkBuffer buffer, const ResourceState& state, bool output)
+	{
+		Resource& resource = resources.emplace_back();
+		resource.name = name;
+		resource.type = ResourceType::ImportedBuffer;
+		resource.output = output;
+		resource.buffer = buffer;
+		resource.state = state;
+		return (ResourceId)resources.size() - 1;
+	}
+
+	inline PassId Graph::AddPass(const char* name, std::function<void(VkCommandBuffer cmd)> execute)
+	{
+		Pass& pass = passes.emplace_back();
+		pass.name = name;
+		pass.execute = std::move(execute);
+		return (PassId)passes.size() - 1;
+	}
+
+	inline void Graph::Read(PassId pass, ResourceId resource, Access access)
+	{
+		passes[pass].reads.push_back({ resource, access });
+	}
+
+	inline void Graph::Write(PassId pass, ResourceId resource, Access access)
+	{
+		passes[pass].writes.push_back({ resource, access });
+	}
+
+	inline void Graph::SetSideEffects(PassId pass)
+	{
+		passes[pass].sideEffects = true;
+	}
+
+	inline void Graph::Cull()
+	{
+		// Walk backwards, a pass lives if it has side effects or writes something that is output or read by a live pass
+		std::vector<bool> needed(resources.size(), false);
+		for (ResourceId i = 0; i < (ResourceId)resources.size(); i++)
+			needed[i] = resources[i].output;
+
+		for (PassId i = (PassId)passes.size(); i-- > 0;)
+		{
+			Pass& pass = passes[i];
+			bool alive = pass.sideEffects;
+			for (const ResourceAccess& write : pass.writes)
+				alive = alive || needed[write.resource];
+
+			pass.culled = !alive;
+			if (pass.culled)
+				continue;
+
+			for (const ResourceAccess& read : pass.reads)
+				needed[read.resource] = true;
+		}
+	}
+
+	inline void Graph::Compile()
+	{
+		Cull();
+
+		stats = {};
+		stats.passCount = (uint32_t)passes.size();
+		for (const Pass& pass : passes)
+			stats.culledPassCount += pass.culled ? 1 : 0;
+
+		// Lifetimes of the transient images over the live passes
+		std::vector<TransientKey> keys;
+		for (ResourceId i = 0; i < (ResourceId)resources.size(); i++)
+		{
+			Resource& resource = resources[i];
+			if (resource.type != ResourceType::TransientImage)
+				continue;
+
+			TransientKey key = { resource.desc, UINT32_MAX, 0 };
+			for (PassId p = 0; p < (PassId)passes.size(); p++)
+			{
+				if (passes[p].culled)
+					continue;
+				for (const std::vector<ResourceAccess>* list : { &passes[p].reads, &passes[p].writes })
+				{
+					for (const ResourceAccess& access : *list)
+					{
+						if (access.resource != i)
+							continue;
+						key.firstPass = std::min(key.firstPass, p);
+						key.lastPass = std::max(key.lastPass, p);
+					}
+				}
+			}
+
+			// Unused transients take no memory
+			if (key.firstPass == UINT32_MAX)
+				continue;
+
+			resource.transientIndex = (uint32_t)keys.size();
+			keys.push_back(key);
+		}
+
+		if (!(keys == transientKeys))
+		{
+			ReleaseTransients(false);
+			transientKeys = keys;
+			AllocateTransients();
+		}
+
+		for (Resource& resource : resources)
+		{
+			if (resource.transientIndex == UINT32_MAX)
+				continue;
+			const PhysicalImage& physical = physicalImages[resource.transientIndex];
+			resource.image = physical.image;
+			resource.view = physical.view;
+		}
+
+		stats.transientImageCount = (uint32_t)physicalImages.size();
+		stats.transientMemoryBlocks = (uint32_t)memoryBlocks.size();
+		for (const MemoryBlock& block : memoryBlocks)
+			stats.transientBytes += block.requirements.size;
+		for (const PhysicalImage& physical : physicalImages)
+		{
+			VkMemoryRequirements requirements;
+			vkGetImageMemoryRequirements(device, physical.image, &requirements);
+			stats.transientBytesUnaliased += requirements.size;
+		}
+	}
+
+	inline void Graph::AllocateTransients()
+	{
+		// Place images by order of first use, an image can go in a block once the block's last user is done
+		std::vector<uint32_t> order(transientKeys.size());
+		for (uint32_t i = 0; i < order.size(); i++)
+			order[i] = i;
+		std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return transientKeys[a].firstPass < transientKeys[b].firstPass; });
+
+		physicalImages.resize(transientKeys.size());
+		std::vector<VkMemoryRequirements> imageRequirements(transientKeys.size());
+		for (uint32_t i : order)
+		{
+			const TransientKey& key = transientKeys[i];
+
+			VkImageCreateInfo imageInfo = {};
+			imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+			imageInfo.imageType = VK_IMAGE_TYPE_2D;
+			imageInfo.format = key.desc.format;
+			imageInfo.extent = { key.desc.extent.width, key.desc.extent.height, 1 };
+			imageInfo.mipLevels = 1;
+			imageInfo.arrayLayers = 1;
+			imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+			imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+			imageInfo.usage = key.desc.usage;
+			imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+			vkCheck(vkCreateImage(device, &imageInfo, nullptr, &physicalImages[i].image));
+			vkGetImageMemoryRequirements(device, physicalImages[i].image, &imageRequirements[i]);
+			const VkMemoryRequirements& requirements = imageRequirements[i];
+
+			// Best fit among the free compatible blocks, growing a block is fine before it is allocated
+			uint32_t bestBlock = UINT32_MAX;
+			for (uint32_t b = 0; b < memoryBlocks.size(); b++)
+			{
+				const MemoryBlock& block = memoryBlocks[b];
+				if (block.lastPass >= key.firstPass || !(block.requirements.memoryTypeBits & requirements.memoryTypeBits))
+					continue;
+				if (bestBlock == UINT32_MAX || std::abs((int64_t)block.requirements.size - (int64_t)requirements.size)
+					< std::abs((int64_t)memoryBlocks[bestBlock].requirements.size - (int64_t)requirements.size))
+					bestBlock = b;
+			}
+
+			if (bestBlock == UINT32_MAX)
+			{
+				bestBlock = (uint32_t)memoryBlocks.size();
+				MemoryBlock& block = memoryBlocks.emplace_back();
+				block.requirements = requirements;
+			}
+			else
+			{
+				VkMemoryRequirements& blockRequirements = memoryBlocks[bestBlock].requirements;
+				blockRequirements.size = std::max(blockRequirements.size, requirements.size);
+				blockRequirements.alignment = std::max(blockRequirements.alignment, requirements.alignment);
+				blockRequirements.memoryTypeBits &= requirements.memoryTypeBits;
+			}
+			memoryBlocks[bestBlock].lastPass = key.lastPass;
+			physicalImages[i].memoryBlock = bestBlock;
+		}
+
+		for (MemoryBlock& block : memoryBlocks)
+		{
+			VmaAllocationCreateInfo allocInfo = {};
+			allocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+			allocInfo.requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+			vkCheck(vmaAllocateMemory(allocator, &block.requirements, &allocInfo, &block.allocation, nullptr));
+		}
+
+		for (uint32_t i = 0; i < physicalImages.size(); i++)
+		{
+			PhysicalImage& physical = physicalImages[i];
+			vkCheck(vmaBindImageMemory(allocator, memoryBlocks[physical.memoryBlock].allocation, physical.image));
+
+			VkImageViewCreateInfo viewInfo = {};
+			viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+			viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+			viewInfo.image = physical.image;
+			viewInfo.format = transientKeys[i].desc.format;
+			viewInfo.subresourceRange.aspectMask = transientKeys[i].desc.aspect;
+			viewInfo.subresourceRange.levelCount = 1;
+			viewInfo.subresourceRange.layerCount = 1;
+			vkCheck(vkCreateImageView(device, &viewInfo, nullptr, &physical.view));
+		}
+	}
+
+	inline void Graph::ReleaseTransients(bool immediate)
+	{
+		if (physicalImages.empty() && memoryBlocks.empty())
+			return;
+
+		std::vector<PhysicalImage> images = std::move(physicalImages);
+		std::vector<MemoryBlock> blocks = std::move(memoryBlocks);
+		physicalImages.clear();
+		memoryBlocks.clear();
+		transientKeys.clear();
+
+		VkDevice device = this->device;
+		VmaAllocator allocator = this->allocator;
+		auto destroy = [device, allocator, images, blocks]
+		{
+			for (const PhysicalImage& physical : images)
+			{
+				vkDestroyImageView(device, physical.view, nullptr);
+				vkDestroyImage(device, physical.image, nullptr);
+			}
+			for (const MemoryBlock& block : blocks)
+				vmaFreeMemory(allocator, block.allocation);
+		};
+
+		if (immediate)
+			destroy();
+		else
+			retire(destroy);
+	}
+
+	inline void Graph::AddBarrier(ResourceId resourceId, Access access, std::vector<VkImageMemoryBarrier2>& imageBarriers, std::vector<VkBufferMemoryBarrier2>& bufferBarriers)
+	{
+		Resource& resource = resources[resourceId];
+		ResourceState& state = resource.state;
+		MemoryBlock* block = resource.transientIndex != UINT32_MAX ? &memoryBlocks[physicalImages[resource.transientIndex].memoryBlock] : nullptr;
+		if (block && !resource.started)
+		{
+			// Transient contents never survive, the image starts undefined after whatever used its memory before
+			state = {};
+			state.writeStage = block->lastStages;
+			state.writeAccess = block->lastWrites;
+			resource.started = true;
+		}
+
+		const AccessInfo info = GetAccessInfo(access);
+		const bool isImage = resource.type != ResourceType::ImportedBuffer;
+		const bool layoutChange = isImage && state.layout != info.layout;
+
+		VkPipelineStageFlags2 srcStage;
+		VkAccessFlags2 srcAccess;
+		// The state is updated whether or not a barrier was needed, this keeps the memory block in sync
+		auto updateBlock = [&]
+		{
+			if (!block)
+				return;
+			block->lastStages = state.writeStage | state.readStages;
+			block->lastWrites = state.writeAccess;
+		};
+
+		if (info.write || layoutChange)
+		{
+			// Writes and layout transitions wait for the last write and every read since
+			srcStage = state.writeStage | state.readStages;
+			srcAccess = state.writeAccess;
+		}
+		else
+		{
+			// Reads only wait for the last write, and only once per stage and access
+			if (state.writeStage == VK_PIPELINE_STAGE_2_NONE
+				|| ((info.stage & ~state.readStages) == 0 && (info.access & ~state.readAccess) == 0))
+			{
+				state.readStages |= info.stage;
+				state.readAccess |= info.access;
+				updateBlock();
+				return;
+			}
+			srcStage = state.writeStage;
+			srcAccess = state.writeAccess;
+		}
+
+		if (isImage)
+		{
+			VkImageMemoryBarrier2 barrier = {};
+			barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+			barrier.srcStageMask = srcStage;
+			barrier.srcAccessMask = srcAccess;
+			barrier.dstStageMask = info.stage;
+			barrier.dstAccessMask = info.access;
+			barrier.oldLayout = state.layout;
+			barrier.newLayout = info.layout;
+			barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.image = resource.image;
+			barrier.subresourceRange.aspectMask = resource.aspect;
+			barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+			barrier.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
+			imageBarriers.push_back(barrier);
+		}
+		else
+		{
+			VkBufferMemoryBarrier2 barrier = {};
+			barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2;
+			barrier.srcStageMask = srcStage;
+			barrier.srcAccessMask = srcAccess;
+			barrier.dstStageMask = info.stage;
+			barrier.dstAccessMask = info.access;
+			barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.buffer = resource.buffer;
+			barrier.offset = 0;
+			barrier.size = VK_WHOLE_SIZE;
+			bufferBarriers.push_back(barrier);
+		}
+
+		state.layout = isImage ? info.layout : state.layout;
+		if (info.write)
+		{
+			state.writeStage = info.stage;
+			state.writeAccess = info.access & (VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT
+											   | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT | VK_ACCESS_2_TRANSFER_WRITE_BIT);
+			state.readStages = VK_PIPELINE_STAGE_2_NONE;
+			state.readAccess = VK_ACCESS_2_NONE;
+		}
+		else if (layoutChange)
+		{
+			// The transition is the last write now, it is visible to this stage only
+			state.writeStage = info.stage;
+			state.writeAccess = VK_ACCESS_2_NONE;
+			state.readStages = info.stage;
+			state.readAccess = info.access;
+		}
+		else
+		{
+			state.readStages |= info.stage;
+			state.readAccess |= info.access;
+		}
+		updateBlock();
+	}
+
+	inline void Graph::Execute(VkCommandBuffer cmd)
+	{
+		std::vector<VkImageMemoryBarrier2> imageBarriers;
+		std::vector<VkBufferMemoryBarrier2> bufferBarriers;
+		for (Pass& pass : passes)
+		{
+			if (pass.culled)
+				continue;
+
+			imageBarriers.clear();
+			bufferBarriers.clear();
+			for (const ResourceAccess& read : pass.reads)
+				AddBarrier(read.resource, read.access, imageBarriers, bufferBarriers);
+			for (const ResourceAccess& write : pass.writes)
+			{
+				// Read-write in the same pass already got its barrier from the read
+				bool alsoRead = false;
+				for (const ResourceAccess& read : pass.reads)
+					alsoRead = alsoRead || (read.resource == write.resource && read.access == write.access);
+				if (!alsoRead)
+					AddBarrier(write.resource, write.access, imageBarriers, bufferBarriers);
+			}
+
+			if (!imageBarriers.empty() || !bufferBarriers.empty())
+			{
+				VkDependencyInfo dependencyInfo = {};
+				dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+				dependencyInfo.imageMemoryBarrierCount = (uint32_t)imageBarriers.size();
+				dependencyInfo.pImageMemoryBarriers = imageBarriers.data();
+				dependencyInfo.bufferMemoryBarrierCount = (uint32_t)bufferBarriers.size();
+				dependencyInfo.pBufferMemoryBarriers = bufferBarriers.data();
+				vkCmdPipelineBarrier2(cmd, &dependencyInfo);
+
+				stats.barrierBatchCount++;
+				stats.imageBarrierCount += (uint32_t)imageBarriers.size();
+				stats.bufferBarrierCount += (uint32_t)bufferBarriers.size();
+			}
+
+			pass.execute(cmd);
+		}
+	}
+}
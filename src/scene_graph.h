@@ -0,0 +1,184 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#if defined(_M_X64) || defined(_M_AMD64) || defined(__SSE__)
+#include <xmmintrin.h>
+#define SCENE_GRAPH_SSE 1
+#else
+#define SCENE_GRAPH_SSE 0
+#endif
+
+// Transform hierarchy stored as structure of arrays
+// A node's parent always comes before it, nodes are only ever appended, so a single linear walk sees every parent
+// updated before its children. Local transforms are kept as TRS and only the world matrices are stored.
+// Setting a local transform marks the node dirty, Update recomputes the dirty nodes and everything below them.
+namespace SceneGraph
+{
+	constexpr uint32_t InvalidNode = UINT32_MAX;
+
+	// out = parent * translate * rotate * scale, out may not alias parent
+	// The local matrix is never built: its columns are the scaled rotation axes and the translation,
+	// so every result column is parent's columns weighted by three of them, plus parent's translation for the last
+	inline void ComposeWorld(const glm::mat4& parent, const glm::vec3& translation, const glm::quat& rotation, const glm::vec3& scale, glm::mat4& out)
+	{
+		const glm::mat3 axes = glm::mat3_cast(rotation);
+#if SCENE_GRAPH_SSE
+		const __m128 p0 = _mm_loadu_ps(&parent[0][0]);
+		const __m128 p1 = _mm_loadu_ps(&parent[1][0]);
+		const __m128 p2 = _mm_loadu_ps(&parent[2][0]);
+		const __m128 p3 = _mm_loadu_ps(&parent[3][0]);
+		for (int j = 0; j < 3; j++)
+		{
+			const float s = scale[j];
+			__m128 column = _mm_mul_ps(p0, _mm_set1_ps(axes[j][0] * s));
+			column = _mm_add_ps(column, _mm_mul_ps(p1, _mm_set1_ps(axes[j][1] * s)));
+			column = _mm_add_ps(column, _mm_mul_ps(p2, _mm_set1_ps(axes[j][2] * s)));
+			_mm_storeu_ps(&out[j][0], column);
+		}
+		__m128 position = _mm_mul_ps(p0, _mm_set1_ps(translation.x));
+		position = _mm_add_ps(position, _mm_mul_ps(p1, _mm_set1_ps(translation.y)));
+		position = _mm_add_ps(position, _mm_mul_ps(p2, _mm_set1_ps(translation.z)));
+		_mm_storeu_ps(&out[3][0], _mm_add_ps(position, p3));
+#else
+		for (int j = 0; j < 3; j++)
+			out[j] = parent[0] * (axes[j][0] * scale[j]) + parent[1] * (axes[j][1] * scale[j]) + parent[2] * (axes[j][2] * scale[j]);
+		out[3] = parent[0] * translation.x + parent[1] * translation.y + parent[2] * translation.z + parent[3];
+#endif
+	}
+
+	// translate * rotate * scale, for roots
+	inline glm::mat4 ComposeLocal(const glm::vec3& translation, const glm::quat& rotation, const glm::vec3& scale)
+	{
+		const glm::mat3 axes = glm::mat3_cast(rotation);
+		glm::mat4 result;
+		result[0] = glm::vec4(axes[0] * scale.x, 0.0f);
+		result[1] = glm::vec4(axes[1] * scale.y, 0.0f);
+		result[2] = glm::vec4(axes[2] * scale.z, 0.0f);
+		result[3] = glm::vec4(translation, 1.0f);
+		return result;
+	}
+
+	class Graph
+	{
+	public:
+		// parent has to exist already, which is what keeps the arrays in topological order
+		uint32_t AddNode(uint32_t parent = InvalidNode, const glm::vec3& translation = glm::vec3(0.0f),
+						 const glm::quat& rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f), const glm::vec3& scale = glm::vec3(1.0f));
+		void Clear();
+		void Reserve(uint32_t count);
+
+		void SetTranslation(uint32_t node, const glm::vec3& translation) { translations[node] = translation; MarkDirty(node); }
+		void SetRotation(uint32_t node, const glm::quat& rotation) { rotations[node] = rotation; MarkDirty(node); }
+		void SetScale(uint32_t node, const glm::vec3& scale) { scales[node] = scale; MarkDirty(node); }
+
+		const glm::vec3& Translation(uint32_t node) const { return translations[node]; }
+		const glm::quat& Rotation(uint32_t node) const { return rotations[node]; }
+		const glm::vec3& Scale(uint32_t node) const { return scales[node]; }
+		uint32_t Parent(uint32_t node) const { return parents[node]; }
+		uint32_t NodeCount() const { return (uint32_t)parents.size(); }
+
+		// Valid after Update
+		const glm::mat4& World(uint32_t node) const { return worlds[node]; }
+		// True when the last Update recomputed the node's world matrix
+		bool Changed(uint32_t node) const { return changed[node] != 0; }
+		uint32_t UpdatedCount() const { return updatedCount; }
+
+		// Recomputes the world matrices of the dirty nodes and their descendants in one pass over the arrays
+		void Update();
+
+	private:
+		void MarkDirty(uint32_t node)
+		{
+			dirtyCount += dirty[node] ? 0 : 1;
+			dirty[node] = 1;
+		}
+
+		std::vector<glm::vec3> translations;
+		std::vector<glm::quat> rotations;
+		std::vector<glm::vec3> scales;
+		std::vector<uint32_t> parents;
+		std::vector<glm::mat4> worlds;
+		std::vector<uint8_t> dirty;   // local transform set since the last Update
+		std::vector<uint8_t> changed; // world matrix recomputed by the last Update
+		uint32_t dirtyCount = 0;
+		uint32_t updatedCount = 0;    // by the last Update
+	};
+
+	inline uint32_t Graph::AddNode(uint32_t parent, const glm::vec3& translation, const glm::quat& rotation, const glm::vec3& scale)
+	{
+		assert(parent == InvalidNode || parent < NodeCount());
+		translations.push_back(translation);
+		rotations.push_back(rotation);
+		scales.push_back(scale);
+		parents.push_back(parent);
+		worlds.push_back(glm::mat4(1.0f));
+		dirty.push_back(1);
+		changed.push_back(0);
+		dirtyCount++;
+		return NodeCount() - 1;
+	}
+
+	inline void Graph::Clear()
+	{
+		translations.clear();
+		rotations.clear();
+		scales.clear();
+		parents.clear();
+		worlds.clear();
+		dirty.clear();
+		changed.clear();
+		dirtyCount = 0;
+		updatedCount = 0;
+	}
+
+	inline void Graph::Reserve(uint32_t count)
+	{
+		translations.reserve(count);
+		rotations.reserve(count);
+		scales.reserve(count);
+		parents.reserve(count);
+		worlds.reserve(count);
+		dirty.reserve(count);
+		changed.reserve(count);
+	}
+
+	inline void Graph::Update()
+	{
+		// Nothing was touched, only the changed flags of the last update have to go
+		if (dirtyCount == 0)
+		{
+			if (updatedCount > 0)
+				std::fill(changed.begin(), changed.end(), uint8_t(0));
+			updatedCount = 0;
+			return;
+		}
+
+		const uint32_t count = NodeCount();
+		uint32_t updated = 0;
+		for (uint32_t i = 0; i < count; i++)
+		{
+			const uint32_t parent = parents[i];
+			// The parent was visited first, its changed flag is already this update's
+			const bool update = dirty[i] || (parent != InvalidNode && changed[parent]);
+			changed[i] = update ? 1 : 0;
+			if (!update)
+				continue;
+
+			dirty[i] = 0;
+			updated++;
+			if (parent == InvalidNode)
+				worlds[i] = ComposeLocal(translations[i], rotations[i], scales[i]);
+			else
+				ComposeWorld(worlds[parent], translations[i], rotations[i], scales[i], worlds[i]);
+		}
+		dirtyCount = 0;
+		updatedCount = updated;
+	}
+}
@@ -0,0 +1,135 @@
+#version 460
+#extension GL_GOOGLE_include_directive : require
+
+#include "gpu_types.h"
+#include "lighting.glsl"
+
+// Tiled lighting of the deferred path, one workgroup per screen tile. The workgroup finds the depth range of its tile,
+// lists the lights whose range reaches the view space box of that range, and every pixel only shades those lights.
+// Shading happens in view space, the listed lights are moved there once per workgroup.
+layout(local_size_x = DEFERRED_TILE_SIZE, local_size_y = DEFERRED_TILE_SIZE) in;
+
+layout(set = 0, binding = 0) uniform ClusterBuffer {
+	GPUClusterData clusterData;
+};
+
+layout(std430, set = 0, binding = 1) readonly buffer PointLightBuffer {
+	GPUPointLight pointLights[];
+};
+
+layout(set = 0, binding = 2) uniform SceneBuffer {
+	GPUSceneData sceneData;
+};
+
+layout(set = 0, binding = 3) uniform sampler2D depthBuffer;
+layout(set = 0, binding = 4) uniform sampler2D albedoBuffer;
+layout(set = 0, binding = 5) uniform sampler2D normalBuffer;
+layout(set = 0, binding = 6) uniform sampler2D specularBuffer;
+layout(set = 0, binding = 7, rgba16f) uniform writeonly image2D destination;
+
+layout (push_constant) uniform constants
+{
+	vec4 clearColor; // where there is no geometry, like the forward pass's clear
+	uint flags;      // DEFERRED_LIGHTING_*
+} PushConstants;
+
+shared uint tileMinDepth; // float bits, depth is positive so they order like the values
+shared uint tileMaxDepth;
+shared uint tileLightCount;
+shared uint tileLights[MAX_LIGHTS_PER_TILE];
+shared vec3 tileLightPositions[MAX_LIGHTS_PER_TILE]; // view space
+
+void main()
+{
+	ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+	bool inside = all(lessThan(pixel, ivec2(clusterData.screenSize.xy)));
+
+	if (gl_LocalInvocationIndex == 0)
+	{
+		tileMinDepth = floatBitsToUint(1.0);
+		tileMaxDepth = 0u;
+		tileLightCount = 0u;
+	}
+	barrier();
+
+	// Pixels left at the clear depth have no geometry and do not widen the range
+	float depth = inside ? texelFetch(depthBuffer, pixel, 0).r : 1.0;
+	bool covered = depth < 1.0;
+	if (covered)
+	{
+		atomicMin(tileMinDepth, floatBitsToUint(depth));
+		atomicMax(tileMaxDepth, floatBitsToUint(depth));
+	}
+	barrier();
+
+	if (tileMaxDepth > 0u)
+	{
+		// View space box of the tile's frustum between the nearest and farthest depth in it
+		vec2 tileMin = vec2(gl_WorkGroupID.xy * uint(DEFERRED_TILE_SIZE)) / clusterData.screenSize.xy * 2.0 - 1.0;
+		vec2 tileMax = vec2((gl_WorkGroupID.xy + 1u) * uint(DEFERRED_TILE_SIZE)) / clusterData.screenSize.xy * 2.0 - 1.0;
+		vec3 boxMin = vec3(1e30);
+		vec3 boxMax = vec3(-1e30);
+		for (int i = 0; i < 8; i++)
+		{
+			vec4 corner = vec4((i & 1) != 0 ? tileMax.x : tileMin.x, (i & 2) != 0 ? tileMax.y : tileMin.y,
+							   uintBitsToFloat((i & 4) != 0 ? tileMaxDepth : tileMinDepth), 1.0);
+			corner = clusterData.inverseProjection * corner;
+			boxMin = min(boxMin, corner.xyz / corner.w);
+			boxMax = max(boxMax, corner.xyz / corner.w);
+		}
+
+		for (uint i = gl_LocalInvocationIndex; i < clusterData.lightCount; i += gl_WorkGroupSize.x * gl_WorkGroupSize.y)
+		{
+			vec4 positionRange = pointLights[i].positionRange;
+			vec3 center = (clusterData.view * vec4(positionRange.xyz, 1.0)).xyz;
+			vec3 offset = clamp(center, boxMin, boxMax) - center;
+			if (dot(offset, offset) <= positionRange.w * positionRange.w)
+			{
+				uint slot = atomicAdd(tileLightCount, 1u);
+				if (slot < MAX_LIGHTS_PER_TILE)
+				{
+					tileLights[slot] = i;
+					tileLightPositions[slot] = center;
+				}
+			}
+		}
+	}
+	barrier();
+
+	if (!inside)
+		return;
+	if (!covered)
+	{
+		imageStore(destination, pixel, PushConstants.clearColor);
+		return;
+	}
+
+	vec2 ndc = (vec2(pixel) + 0.5) / clusterData.screenSize.xy * 2.0 - 1.0;
+	vec4 viewPosition = clusterData.inverseProjection * vec4(ndc, depth, 1.0);
+	vec3 position = viewPosition.xyz / viewPosition.w;
+	vec3 normal = normalize(mat3(clusterData.view) * OctDecode(texelFetch(normalBuffer, pixel, 0).xy));
+	vec3 viewDir = normalize(-position);
+	vec3 albedo = texelFetch(albedoBuffer, pixel, 0).rgb;
+	vec4 specular = texelFetch(specularBuffer, pixel, 0);
+	float shininess = DecodeShininess(specular.a);
+	bool attenuate = (PushConstants.flags & DEFERRED_LIGHTING_ATTENUATION) != 0u;
+
+	vec3 color = vec3(0.0);
+	uint lightCount = min(tileLightCount, uint(MAX_LIGHTS_PER_TILE));
+	for (uint i = 0; i < lightCount; i++)
+	{
+		GPUPointLight light = pointLights[tileLights[i]];
+		light.positionRange.xyz = tileLightPositions[i];
+		color += ShadePointLight(light, attenuate, position, normal, viewDir, albedo, specular.rgb, shininess);
+	}
+
+	// Fog, the camera is at the view space origin
+	if ((PushConstants.flags & DEFERRED_LIGHTING_FOG) != 0u)
+	{
+		float viewDistance = length(position);
+		float fogAmount = clamp((viewDistance - sceneData.fogDistances.x) / max(sceneData.fogDistances.y - sceneData.fogDistances.x, 0.0001f), 0.0f, 1.0f);
+		color = mix(color, sceneData.fogColor.rgb, pow(fogAmount, max(sceneData.fogColor.w, 0.0001f)));
+	}
+
+	imageStore(destination, pixel, vec4(color, 1.0));
+}
@@ -0,0 +1,45 @@
+#version 460
+#extension GL_GOOGLE_include_directive : require
+
+#include "gpu_types.h"
+
+// Depth only passes bind the position stream alone, see PackedVertex::GetPositionDescription
+layout (location = 0) in vec4 vPosition; // unorm16 inside the mesh's bounding box
+
+// The scene pass tests EQUAL against this depth, both vertex shaders must produce bit identical positions
+invariant gl_Position;
+
+layout(set = 0, binding = 0) uniform CameraBuffer {
+	GPUCameraData cameraData;
+};
+
+layout(std430, set = 1, binding = 0) readonly buffer ObjectBuffer{
+	GPUObjectData objects[];
+} objectBuffer;
+
+// Same draw index sources as triangle.vert.glsl
+layout(constant_id = 10) const int DRAW_INDEX_SOURCE = 0;
+
+layout(set = 1, binding = 1) uniform DrawIndexBuffer {
+	uint objectIndex;
+} drawIndex;
+
+layout (push_constant) uniform constants 
+{
+	uint objectIndex;
+	uint materialIndex;
+	uint flags;
+} PushConstants;
+
+void main() {
+	uint objectIndex = gl_BaseInstance;
+	if (DRAW_INDEX_SOURCE == 0)
+		objectIndex = PushConstants.objectIndex;
+	else if (DRAW_INDEX_SOURCE == 1)
+		objectIndex = drawIndex.objectIndex;
+
+	GPUObjectData object = objectBuffer.objects[objectIndex];
+	vec3 position = object.positionOffset.xyz + vPosition.xyz * object.positionScale.xyz;
+	mat4 transformationMatrix = (cameraData.viewproj * object.modelMatrix);
+	gl_Position = transformationMatrix * vec4(position, 1.0f);
+}
@@ -0,0 +1,35 @@
+#version 460
+
+// Builds one level of the depth pyramid. Every texel keeps the farthest depth under its footprint in the source,
+// so whatever lies behind a texel's depth is hidden everywhere that texel covers. Level 0 reads the depth buffer,
+// which is up to twice the pyramid's power of two size, every other level halves the previous one.
+layout(local_size_x = 8, local_size_y = 8) in;
+
+layout(set = 0, binding = 0) uniform sampler2D source;
+layout(set = 0, binding = 1, r32f) uniform writeonly image2D destination;
+
+layout (push_constant) uniform constants
+{
+	uvec2 sourceSize;
+	uvec2 destinationSize;
+} PushConstants;
+
+void main()
+{
+	uvec2 texel = gl_GlobalInvocationID.xy;
+	if (any(greaterThanEqual(texel, PushConstants.destinationSize)))
+		return;
+
+	// Source texels this texel overlaps, up to 3 per axis when the sizes are not a power of two apart
+	uvec2 first = texel * PushConstants.sourceSize / PushConstants.destinationSize;
+	uvec2 last = min(((texel + 1u) * PushConstants.sourceSize + PushConstants.destinationSize - 1u) / PushConstants.destinationSize,
+					 PushConstants.sourceSize);
+
+	float depth = 0.0;
+	for (uint y = first.y; y < last.y; y++)
+	{
+		for (uint x = first.x; x < last.x; x++)
+			depth = max(depth, texelFetch(source, ivec2(x, y), 0).r);
+	}
+	imageStore(destination, ivec2(texel), vec4(depth));
+}
@@ -0,0 +1,51 @@
+#version 460
+#extension GL_GOOGLE_include_directive : require
+#ifdef BINDLESS
+#extension GL_EXT_nonuniform_qualifier : require
+#endif
+
+#include "gpu_types.h"
+#include "lighting.glsl"
+
+// G-buffer pass of the deferred path, same inputs as triangle.frag.glsl. deferred_lighting.comp.glsl shades from these.
+layout (location = 1) in vec2 inTexCoord;
+layout (location = 2) in vec3 inNormal;
+layout (location = 3) in vec3 inFragPos;
+layout (location = 4) in vec3 inViewPos;
+layout (location = 5) flat in uint inMaterialIndex;
+
+layout (location = 0) out vec4 outAlbedo;   // rgb = albedo, a = 1 where there is geometry
+layout (location = 1) out vec2 outNormal;   // octahedral world space normal
+layout (location = 2) out vec4 outSpecular; // rgb = specular color, a = EncodeShininess
+
+// Only the specular map matters here, emission and fog are not carried by the G-buffer
+layout (constant_id = 0) const bool USE_SPECULAR_MAP = true;
+
+#ifdef BINDLESS
+layout(set = 2, binding = 0) uniform sampler2D textures[];
+
+layout(std430, set = 2, binding = 1) readonly buffer MaterialTable {
+	GPUMaterialData materials[];
+} materialTable;
+
+#define DIFFUSE_MAP  textures[nonuniformEXT(materialTable.materials[inMaterialIndex].diffuseIndex)]
+#define SPECULAR_MAP textures[nonuniformEXT(materialTable.materials[inMaterialIndex].specularIndex)]
+#else
+layout(set = 2, binding = 0) uniform sampler2D diffuseMap;
+layout(set = 2, binding = 1) uniform sampler2D specularMap;
+
+#define DIFFUSE_MAP  diffuseMap
+#define SPECULAR_MAP specularMap
+#endif
+
+layout(set = 3, binding = 0) uniform MaterialBuffer {
+	Material material;
+};
+
+void main()
+{
+	outAlbedo = vec4(texture(DIFFUSE_MAP, inTexCoord).rgb, 1.0f);
+	outNormal = OctEncode(normalize(inNormal));
+	vec3 specularColor = USE_SPECULAR_MAP ? vec3(texture(SPECULAR_MAP, inTexCoord)) : material.specular.rgb;
+	outSpecular = vec4(specularColor, EncodeShininess(material.shininess.x));
+}
@@ -0,0 +1,177 @@
+// GPU data layouts shared between C++ and GLSL.
+// This file is included by vulkan_guide.cpp and by the shaders (through the shaderc includer in CompileShader),
+// so every struct here is declared once. Only use vec4/mat4/uint members and vec4 arrays: vec3 and other arrays
+// follow different rules in std140 and C++ and would need hand padding again.
+#ifndef GPU_TYPES_H
+#define GPU_TYPES_H
+
+#ifdef __cplusplus
+#include <cstdint>
+#include <cstddef>
+#include <glm/glm.hpp>
+
+#define GPU_STRUCT(name) struct alignas(16) name
+#define GPU_CHECK_SIZE(type, size) static_assert(sizeof(type) == size, #type " size does not match its std140/std430 layout");
+#define GPU_CHECK_OFFSET(type, member, offset) static_assert(offsetof(type, member) == offset, #type "::" #member " offset does not match its std140/std430 layout");
+
+namespace gpu
+{
+using vec4 = glm::vec4;
+using mat4 = glm::mat4;
+using uint = uint32_t;
+#else
+#define GPU_STRUCT(name) struct name
+#define GPU_CHECK_SIZE(type, size)
+#define GPU_CHECK_OFFSET(type, member, offset)
+#endif
+
+// set 0, binding 0
+GPU_STRUCT(GPUCameraData)
+{
+	mat4 view;
+	mat4 projection;
+	mat4 viewproj;
+	vec4 position;
+};
+GPU_CHECK_SIZE(GPUCameraData, 208)
+GPU_CHECK_OFFSET(GPUCameraData, position, 192)
+
+// set 0, binding 1
+GPU_STRUCT(GPUSceneData)
+{
+	vec4 fogColor; // w is for exponent
+	vec4 fogDistances; //x for min, y for max, zw unused.
+	vec4 ambientColor;
+	vec4 sunlightDirection; //w for sun power
+	vec4 sunlightColor;
+};
+GPU_CHECK_SIZE(GPUSceneData, 80)
+
+// set 1, binding 0, one per draw
+GPU_STRUCT(GPUObjectData)
+{
+	mat4 modelMatrix;
+	uint materialIndex; // index into the bindless material table
+	uint firstMeshlet;  // meshlets of the LOD drawn this frame, in the geometry pool's meshlet buffer
+	uint meshletCount;
+	uint padding0;
+	vec4 positionOffset; // xyz = mesh bounding box min, packed positions decode as offset + position * scale
+	vec4 positionScale;  // xyz = mesh bounding box size
+};
+GPU_CHECK_SIZE(GPUObjectData, 112)
+GPU_CHECK_OFFSET(GPUObjectData, materialIndex, 64)
+GPU_CHECK_OFFSET(GPUObjectData, positionOffset, 80)
+
+// Geometry pool meshlet buffer, one per cluster of up to 64 vertices and 124 triangles, see meshlet_builder.h
+GPU_STRUCT(GPUMeshlet)
+{
+	vec4 sphere;   // object space, xyz = center, w = radius
+	vec4 coneApex; // xyz, w unused
+	vec4 coneAxis; // xyz = axis, w = cutoff, above 1 the cone never culls
+	uint firstIndex; // in the geometry pool, ready to be copied into a draw
+	uint indexCount;
+	uint vertexOffset;
+	uint padding;
+};
+GPU_CHECK_SIZE(GPUMeshlet, 64)
+
+// Flags of GPUCullData
+#define MESHLET_CULL_FRUSTUM   1u
+#define MESHLET_CULL_BACKFACE  2u
+#define MESHLET_CULL_OCCLUSION 4u
+
+// meshlet_cull.comp.glsl, binding 0
+GPU_STRUCT(GPUCullData)
+{
+	mat4 pyramidViewProj;  // view projection the depth pyramid was rendered with, last frame's
+	vec4 frustumPlanes[6]; // xyz = normal pointing inside, w = distance
+	vec4 cameraPosition;
+	vec4 pyramidSize;      // xy = mip 0 size in texels, z = mip count
+	uint objectCount;
+	uint flags;
+	uint maxDraws;
+	uint padding;
+};
+GPU_CHECK_SIZE(GPUCullData, 208)
+GPU_CHECK_OFFSET(GPUCullData, objectCount, 192)
+
+// set 2, binding 1 (bindless), indices into the bindless texture array
+GPU_STRUCT(GPUMaterialData)
+{
+	uint diffuseIndex;
+	uint specularIndex;
+	uint emissionIndex;
+	uint padding;
+};
+GPU_CHECK_SIZE(GPUMaterialData, 16)
+
+// set 3, binding 0
+GPU_STRUCT(Material)
+{
+	vec4 ambient;
+	vec4 diffuse;
+	vec4 specular;
+	vec4 shininess; // x = shininess exponent
+};
+GPU_CHECK_SIZE(Material, 64)
+
+// Clustered lighting: the view frustum is cut into a froxel grid, screen tiles times exponential depth slices.
+// light_cull.comp.glsl lists the lights reaching every cluster, fragments only loop over their cluster's list.
+#define CLUSTER_GRID_X 16
+#define CLUSTER_GRID_Y 9
+#define CLUSTER_GRID_Z 24
+#define CLUSTER_COUNT (CLUSTER_GRID_X * CLUSTER_GRID_Y * CLUSTER_GRID_Z)
+#define MAX_POINT_LIGHTS 4096
+#define MAX_LIGHTS_PER_CLUSTER 128 // the rest of a crowded cluster's lights are dropped
+
+// Flags of GPUClusterData
+#define CLUSTER_LIGHTING_ALL_LIGHTS 1u // skip the clusters, every fragment loops over every light
+
+// set 3, binding 1
+GPU_STRUCT(GPUClusterData)
+{
+	mat4 view;
+	mat4 inverseProjection;
+	vec4 screenSize;   // xy = framebuffer size in pixels
+	vec4 depthSlicing; // x = near, y = far, z = slices / log(far / near), w = slices * log(near) / log(far / near)
+	uint lightCount;
+	uint flags;
+	uint padding0;
+	uint padding1;
+};
+GPU_CHECK_SIZE(GPUClusterData, 176)
+GPU_CHECK_OFFSET(GPUClusterData, lightCount, 160)
+
+// set 3, binding 2, one per light
+GPU_STRUCT(GPUPointLight)
+{
+	vec4 positionRange; // xyz = world position, w = distance past which the light is cut off
+	vec4 diffuse;       // rgb = diffuse color, a = ambient strength relative to it
+	vec4 specular;      // rgb
+	vec4 attenuation;   // x = constant, y = linear, z = quadratic
+};
+GPU_CHECK_SIZE(GPUPointLight, 64)
+
+// Deferred path: deferred_lighting.comp.glsl shades the G-buffer in screen tiles, each lists the lights reaching its depth range
+#define DEFERRED_TILE_SIZE 16
+#define MAX_LIGHTS_PER_TILE 512 // the rest of a crowded tile's lights are dropped
+
+// Flags of the deferred lighting push constants, the material features the forward pass specializes on
+#define DEFERRED_LIGHTING_ATTENUATION 1u
+#define DEFERRED_LIGHTING_FOG 2u
+
+#ifdef __cplusplus
+}
+
+using gpu::GPUCameraData;
+using gpu::GPUSceneData;
+using gpu::GPUObjectData;
+using gpu::GPUMaterialData;
+using gpu::GPUMeshlet;
+using gpu::GPUCullData;
+using gpu::Material;
+using gpu::GPUClusterData;
+using gpu::GPUPointLight;
+#endif
+
+#endif
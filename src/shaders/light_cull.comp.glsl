@@ -0,0 +1,90 @@
+#version 460
+#extension GL_GOOGLE_include_directive : require
+
+#include "gpu_types.h"
+
+// Lists the point lights reaching every cluster, one invocation per cluster. The workgroup stages the lights through
+// shared memory, already in view space, so every light is read and transformed once per workgroup.
+layout(local_size_x = 64) in;
+
+layout(set = 0, binding = 0) uniform ClusterBuffer {
+	GPUClusterData clusterData;
+};
+
+layout(std430, set = 0, binding = 1) readonly buffer PointLightBuffer {
+	GPUPointLight pointLights[];
+};
+
+layout(std430, set = 0, binding = 2) writeonly buffer ClusterLightCounts {
+	uint clusterLightCounts[];
+};
+
+// MAX_LIGHTS_PER_CLUSTER slots per cluster
+layout(std430, set = 0, binding = 3) writeonly buffer ClusterLightIndices {
+	uint clusterLightIndices[];
+};
+
+shared vec4 lightSpheres[64]; // view space, w = range
+
+// View space point at depth along the ray through an NDC position, the sign of view z does not matter
+vec3 PointAtDepth(vec2 ndc, float depth)
+{
+	vec4 point = clusterData.inverseProjection * vec4(ndc, 0.0, 1.0);
+	vec3 ray = point.xyz / point.w;
+	return ray * (depth / abs(ray.z));
+}
+
+void main()
+{
+	uint cluster = gl_GlobalInvocationID.x;
+	bool active = cluster < CLUSTER_COUNT;
+
+	// View space box of the froxel: the tile's corners at the near and far depth of its slice
+	uvec3 coord = uvec3(cluster % CLUSTER_GRID_X, (cluster / CLUSTER_GRID_X) % CLUSTER_GRID_Y, cluster / (CLUSTER_GRID_X * CLUSTER_GRID_Y));
+	vec2 gridSize = vec2(CLUSTER_GRID_X, CLUSTER_GRID_Y);
+	vec2 tileMin = vec2(coord.xy) / gridSize * 2.0 - 1.0;
+	vec2 tileMax = vec2(coord.xy + 1u) / gridSize * 2.0 - 1.0;
+	float near = clusterData.depthSlicing.x;
+	float far = clusterData.depthSlicing.y;
+	float sliceNear = near * pow(far / near, float(coord.z) / float(CLUSTER_GRID_Z));
+	float sliceFar = near * pow(far / near, float(coord.z + 1u) / float(CLUSTER_GRID_Z));
+
+	vec3 boxMin = vec3(1e30);
+	vec3 boxMax = vec3(-1e30);
+	for (int i = 0; i < 8; i++)
+	{
+		vec2 ndc = vec2((i & 1) != 0 ? tileMax.x : tileMin.x, (i & 2) != 0 ? tileMax.y : tileMin.y);
+		vec3 corner = PointAtDepth(ndc, (i & 4) != 0 ? sliceFar : sliceNear);
+		boxMin = min(boxMin, corner);
+		boxMax = max(boxMax, corner);
+	}
+
+	uint count = 0;
+	for (uint first = 0; first < clusterData.lightCount; first += gl_WorkGroupSize.x)
+	{
+		uint lightIndex = first + gl_LocalInvocationIndex;
+		if (lightIndex < clusterData.lightCount)
+		{
+			vec4 positionRange = pointLights[lightIndex].positionRange;
+			lightSpheres[gl_LocalInvocationIndex] = vec4((clusterData.view * vec4(positionRange.xyz, 1.0)).xyz, positionRange.w);
+		}
+		barrier();
+
+		uint batchSize = min(gl_WorkGroupSize.x, clusterData.lightCount - first);
+		for (uint i = 0; active && i < batchSize; i++)
+		{
+			// Sphere against box: the closest point of the box is within the range
+			vec4 sphere = lightSpheres[i];
+			vec3 offset = clamp(sphere.xyz, boxMin, boxMax) - sphere.xyz;
+			if (dot(offset, offset) <= sphere.w * sphere.w && count < MAX_LIGHTS_PER_CLUSTER)
+			{
+				clusterLightIndices[cluster * MAX_LIGHTS_PER_CLUSTER + count] = first + i;
+				count++;
+			}
+		}
+		barrier();
+	}
+
+	if (active)
+		clusterLightCounts[cluster] = count;
+}
@@ -0,0 +1,69 @@
+// Point light shading, the froxel lookup of clustered lighting and the G-buffer encoding, shared by the lit passes
+#ifndef LIGHTING_GLSL
+#define LIGHTING_GLSL
+
+#include "gpu_types.h"
+
+// Cluster of a fragment from its window position and view space depth, light_cull.comp.glsl builds the same grid
+uint ClusterIndex(GPUClusterData clusterData, vec2 fragCoord, float viewDepth)
+{
+	uvec2 tile = min(uvec2(fragCoord * vec2(CLUSTER_GRID_X, CLUSTER_GRID_Y) / clusterData.screenSize.xy),
+					 uvec2(CLUSTER_GRID_X - 1, CLUSTER_GRID_Y - 1));
+	float slice = log(max(viewDepth, clusterData.depthSlicing.x)) * clusterData.depthSlicing.z - clusterData.depthSlicing.w;
+	uint z = uint(clamp(slice, 0.0, float(CLUSTER_GRID_Z - 1)));
+	return (z * CLUSTER_GRID_Y + tile.y) * CLUSTER_GRID_X + tile.x;
+}
+
+// G-buffer encoding of the deferred path, normals are octahedral like the vertex normals
+vec2 OctEncode(vec3 normal)
+{
+	normal /= abs(normal.x) + abs(normal.y) + abs(normal.z);
+	vec2 encoded = normal.xy;
+	if (normal.z < 0.0)
+		encoded = (1.0 - abs(normal.yx)) * vec2(normal.x >= 0.0 ? 1.0 : -1.0, normal.y >= 0.0 ? 1.0 : -1.0);
+	return encoded;
+}
+
+vec3 OctDecode(vec2 encoded)
+{
+	vec3 normal = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+	float fold = max(-normal.z, 0.0);
+	normal.x += normal.x >= 0.0 ? -fold : fold;
+	normal.y += normal.y >= 0.0 ? -fold : fold;
+	return normalize(normal);
+}
+
+// Phong exponents 1 to 2048 in an unorm channel, stored as log2 so the low exponents keep their precision
+float EncodeShininess(float shininess)
+{
+	return clamp(log2(max(shininess, 1.0)) / 11.0, 0.0, 1.0);
+}
+
+float DecodeShininess(float encoded)
+{
+	return exp2(encoded * 11.0);
+}
+
+// Phong with the light's own ambient term, attenuate applies the constant/linear/quadratic falloff
+vec3 ShadePointLight(GPUPointLight light, bool attenuate, vec3 position, vec3 normal, vec3 viewDir, vec3 albedo, vec3 specularColor, float shininess)
+{
+	vec3 toLight = light.positionRange.xyz - position;
+	float distance = length(toLight);
+	if (distance >= light.positionRange.w)
+		return vec3(0.0);
+	vec3 lightDir = toLight / max(distance, 0.0001);
+
+	vec3 ambient = light.diffuse.rgb * light.diffuse.a * albedo;
+	vec3 diffuse = light.diffuse.rgb * max(dot(normal, lightDir), 0.0) * albedo;
+	vec3 reflectDir = reflect(-lightDir, normal);
+	vec3 specular = light.specular.rgb * pow(max(dot(viewDir, reflectDir), 0.0), shininess) * specularColor;
+
+	// Fades out towards the range, past it the clusters no longer list the light
+	float fade = clamp(1.0 - pow(distance / light.positionRange.w, 4.0), 0.0, 1.0);
+	float attenuation = fade * fade;
+	if (attenuate)
+		attenuation /= light.attenuation.x + light.attenuation.y * distance + light.attenuation.z * (distance * distance);
+	return (ambient + diffuse + specular) * attenuation;
+}
+
+#endif
@@ -0,0 +1,125 @@
+#version 460
+#extension GL_GOOGLE_include_directive : require
+
+#include "gpu_types.h"
+
+// Culls the meshlets of every visible object against the frustum, their normal cone and last frame's depth pyramid.
+// Survivors are appended as indexed indirect draws with the object index as firstInstance, so the scene pipelines
+// read it from gl_BaseInstance. One workgroup per object, its invocations stride over the object's meshlets.
+layout(local_size_x = 64) in;
+
+layout(set = 0, binding = 0) uniform CullBuffer {
+	GPUCullData cullData;
+};
+
+layout(std430, set = 0, binding = 1) readonly buffer ObjectBuffer {
+	GPUObjectData objects[];
+};
+
+layout(std430, set = 0, binding = 2) readonly buffer MeshletBuffer {
+	GPUMeshlet meshlets[];
+};
+
+// VkDrawIndexedIndirectCommand
+struct DrawCommand
+{
+	uint indexCount;
+	uint instanceCount;
+	uint firstIndex;
+	int vertexOffset;
+	uint firstInstance;
+};
+
+layout(std430, set = 0, binding = 3) writeonly buffer DrawBuffer {
+	DrawCommand draws[];
+};
+
+layout(std430, set = 0, binding = 4) buffer DrawCountBuffer {
+	uint drawCount;
+};
+
+// Farthest depth of every texel's footprint, see depth_pyramid.comp.glsl
+layout(set = 0, binding = 5) uniform sampler2D depthPyramid;
+
+// True when the sphere was entirely behind the depth the pyramid was built from
+bool OccludedInPyramid(vec3 center, float radius)
+{
+	// Screen rectangle and nearest depth of the sphere's box, as seen by the camera the pyramid was rendered with
+	vec2 minUV = vec2(1.0);
+	vec2 maxUV = vec2(0.0);
+	float nearestDepth = 1.0;
+	for (int i = 0; i < 8; i++)
+	{
+		vec3 corner = center + radius * vec3((i & 1) != 0 ? 1.0 : -1.0, (i & 2) != 0 ? 1.0 : -1.0, (i & 4) != 0 ? 1.0 : -1.0);
+		vec4 clip = cullData.pyramidViewProj * vec4(corner, 1.0);
+		// Reaches behind that camera, the projected rectangle would be meaningless
+		if (clip.w <= 0.0)
+			return false;
+		vec3 ndc = clip.xyz / clip.w;
+		vec2 uv = ndc.xy * 0.5 + 0.5;
+		minUV = min(minUV, uv);
+		maxUV = max(maxUV, uv);
+		nearestDepth = min(nearestDepth, ndc.z);
+	}
+	minUV = clamp(minUV, 0.0, 1.0);
+	maxUV = clamp(maxUV, 0.0, 1.0);
+
+	// The level where the rectangle is at most one texel wide, so it overlaps at most 2x2 texels
+	vec2 size = (maxUV - minUV) * cullData.pyramidSize.xy;
+	float level = min(ceil(log2(max(max(size.x, size.y), 1.0))), cullData.pyramidSize.z - 1.0);
+	ivec2 levelSize = textureSize(depthPyramid, int(level));
+	ivec2 minTexel = min(ivec2(minUV * vec2(levelSize)), levelSize - 1);
+	ivec2 maxTexel = min(ivec2(maxUV * vec2(levelSize)), levelSize - 1);
+
+	float farthestDepth = 0.0;
+	for (int y = minTexel.y; y <= maxTexel.y; y++)
+	{
+		for (int x = minTexel.x; x <= maxTexel.x; x++)
+			farthestDepth = max(farthestDepth, texelFetch(depthPyramid, ivec2(x, y), int(level)).r);
+	}
+	return nearestDepth > farthestDepth;
+}
+
+void main()
+{
+	uint objectIndex = gl_WorkGroupID.x;
+	if (objectIndex >= cullData.objectCount)
+		return;
+
+	GPUObjectData object = objects[objectIndex];
+	mat4 model = object.modelMatrix;
+	float scale = max(max(length(model[0].xyz), length(model[1].xyz)), length(model[2].xyz));
+
+	for (uint i = gl_LocalInvocationID.x; i < object.meshletCount; i += gl_WorkGroupSize.x)
+	{
+		GPUMeshlet meshlet = meshlets[object.firstMeshlet + i];
+		vec3 center = (model * vec4(meshlet.sphere.xyz, 1.0)).xyz;
+		float radius = meshlet.sphere.w * scale;
+
+		bool visible = true;
+		if ((cullData.flags & MESHLET_CULL_FRUSTUM) != 0u)
+		{
+			for (int p = 0; p < 6; p++)
+				visible = visible && dot(cullData.frustumPlanes[p].xyz, center) + cullData.frustumPlanes[p].w >= -radius;
+		}
+
+		// The cone is exact under rotation and uniform scale, objects are not expected to be mirrored
+		if (visible && (cullData.flags & MESHLET_CULL_BACKFACE) != 0u && meshlet.coneAxis.w <= 1.0)
+		{
+			vec3 apex = (model * vec4(meshlet.coneApex.xyz, 1.0)).xyz;
+			vec3 axis = normalize(mat3(model) * meshlet.coneAxis.xyz);
+			visible = dot(normalize(apex - cullData.cameraPosition.xyz), axis) < meshlet.coneAxis.w;
+		}
+
+		if (visible && (cullData.flags & MESHLET_CULL_OCCLUSION) != 0u)
+			visible = !OccludedInPyramid(center, radius);
+
+		if (visible)
+		{
+			// The count keeps growing past maxDraws so the overflow shows, the draw clamps it to the buffer
+			uint drawIndex = atomicAdd(drawCount, 1u);
+			if (drawIndex < cullData.maxDraws)
+				draws[drawIndex] = DrawCommand(meshlet.indexCount, 1u, meshlet.firstIndex, int(meshlet.vertexOffset), objectIndex);
+		}
+	}
+}
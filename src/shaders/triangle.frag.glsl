@@ -1,80 +1,110 @@
 #version 460
+#extension GL_GOOGLE_include_directive : require
+#ifdef BINDLESS
+#extension GL_EXT_nonuniform_qualifier : require
+#endif
 //! #extension GL_KHR_vulkan_glsl : enable
 
-layout (location = 0) in vec3 inColor;
+#include "gpu_types.h"
+#include "lighting.glsl"
+
 layout (location = 1) in vec2 inTexCoord;
 layout (location = 2) in vec3 inNormal;
 layout (location = 3) in vec3 inFragPos;
 layout (location = 4) in vec3 inViewPos;
+layout (location = 5) flat in uint inMaterialIndex;
 
 layout (location = 0) out vec4 outFragColor;
 
+// Material features, each pipeline variant specializes these so unused branches and fetches are compiled out
+layout (constant_id = 0) const bool USE_SPECULAR_MAP = true;
+layout (constant_id = 1) const bool USE_EMISSION_MAP = false;
+layout (constant_id = 2) const int ATTENUATION_MODEL = 1; // 0 = none, 1 = constant/linear/quadratic
+layout (constant_id = 3) const bool USE_FOG = false;
+
+#ifdef BINDLESS
+layout(set = 2, binding = 0) uniform sampler2D textures[];
+
+layout(std430, set = 2, binding = 1) readonly buffer MaterialTable {
+	GPUMaterialData materials[];
+} materialTable;
+
+#define DIFFUSE_MAP  textures[nonuniformEXT(materialTable.materials[inMaterialIndex].diffuseIndex)]
+#define SPECULAR_MAP textures[nonuniformEXT(materialTable.materials[inMaterialIndex].specularIndex)]
+#define EMISSION_MAP textures[nonuniformEXT(materialTable.materials[inMaterialIndex].emissionIndex)]
+#else
 layout(set = 2, binding = 0) uniform sampler2D diffuseMap;
 layout(set = 2, binding = 1) uniform sampler2D specularMap;
 layout(set = 2, binding = 2) uniform sampler2D emissionMap;
 
-layout(set = 0, binding = 1) uniform  SceneData{   
-    vec4 fogColor; // w is for exponent
-	vec4 fogDistances; //x for min, y for max, zw unused.
-	vec4 ambientColor;
-	vec4 sunlightDirection; //w for sun power
-	vec4 sunlightColor;
-} sceneData;
+#define DIFFUSE_MAP  diffuseMap
+#define SPECULAR_MAP specularMap
+#define EMISSION_MAP emissionMap
+#endif
+
+layout(set = 0, binding = 1) uniform SceneBuffer {
+	GPUSceneData sceneData;
+};
 
 layout(set = 3, binding = 0) uniform MaterialBuffer {
-	vec3 ambient;
-	vec3 diffuse;
-	vec3 specular;
-	vec4 shininess;
-} Material;
+	Material material;
+};
 
-layout(set = 3, binding = 1) uniform Light {
-	vec3 position;
-  
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
+layout(set = 3, binding = 1) uniform ClusterBuffer {
+	GPUClusterData clusterData;
+};
 
-	vec3 attenuation; // x = constant, y = linear, z = quadratic
+layout(std430, set = 3, binding = 2) readonly buffer PointLightBuffer {
+	GPUPointLight pointLights[];
+};
 
-} light;
+// Written by light_cull.comp.glsl, MAX_LIGHTS_PER_CLUSTER index slots per cluster
+layout(std430, set = 3, binding = 3) readonly buffer ClusterLightCounts {
+	uint clusterLightCounts[];
+};
+
+layout(std430, set = 3, binding = 4) readonly buffer ClusterLightIndices {
+	uint clusterLightIndices[];
+};
 
 void main()
 {
-	vec3 lightColor = vec3(1.0f, 1.0f, 1.0f);
 	vec3 normal = normalize(inNormal);
-	vec3 lightDir = normalize(light.position - inFragPos);
-
-	// Ambient
-	float ambientStrength = 0.1f;
-	vec3 ambientLight = light.ambient * vec3(texture(diffuseMap, inTexCoord));
-
-	// Diffuse
-	float diff = max(dot(normal, lightDir), 0.0f);
-	vec3 diffuse = light.diffuse * diff * vec3(texture(diffuseMap, inTexCoord));
-
-	// Specular
-	float specularStrength = 0.5f;
 	vec3 viewDir = normalize(inViewPos - inFragPos);
-	vec3 reflectDir = reflect(-lightDir, normal);
-	float spec = pow(max(dot(viewDir, reflectDir), 0.0f), Material.shininess.x);
-	vec3 specular = light.specular * spec * vec3(texture(specularMap, inTexCoord));
+	vec3 albedo = vec3(texture(DIFFUSE_MAP, inTexCoord));
+	vec3 specularColor = USE_SPECULAR_MAP ? vec3(texture(SPECULAR_MAP, inTexCoord)) : material.specular.rgb;
+	bool attenuate = ATTENUATION_MODEL == 1;
+
+	// Only the lights listed for the fragment's cluster, or every light to compare against
+	vec3 color = vec3(0.0f);
+	if ((clusterData.flags & CLUSTER_LIGHTING_ALL_LIGHTS) != 0u)
+	{
+		for (uint i = 0; i < clusterData.lightCount; i++)
+			color += ShadePointLight(pointLights[i], attenuate, inFragPos, normal, viewDir, albedo, specularColor, material.shininess.x);
+	}
+	else
+	{
+		float viewDepth = abs((clusterData.view * vec4(inFragPos, 1.0f)).z);
+		uint cluster = ClusterIndex(clusterData, gl_FragCoord.xy, viewDepth);
+		uint lightCount = clusterLightCounts[cluster];
+		for (uint i = 0; i < lightCount; i++)
+		{
+			GPUPointLight light = pointLights[clusterLightIndices[cluster * MAX_LIGHTS_PER_CLUSTER + i]];
+			color += ShadePointLight(light, attenuate, inFragPos, normal, viewDir, albedo, specularColor, material.shininess.x);
+		}
+	}
 
 	// Emissive
-	//vec3 emission = texture(emissionMap, inTexCoord).rgb;
-	vec3 emission = vec3(0.0f);
-
-	// Attenuation
-	float distance    = length(light.position - inFragPos);
-	float attenuation = 1.0 / 
-						(light.attenuation.x 
-						+ light.attenuation.y * distance 
-						+ light.attenuation.z * (distance * distance));    
+	if (USE_EMISSION_MAP)
+		color += texture(EMISSION_MAP, inTexCoord).rgb;
 
-	ambientLight *= attenuation;
-	diffuse *= attenuation;
-	specular *= attenuation;
+	// Fog
+	if (USE_FOG)
+	{
+		float viewDistance = length(inViewPos - inFragPos);
+		float fogAmount = clamp((viewDistance - sceneData.fogDistances.x) / max(sceneData.fogDistances.y - sceneData.fogDistances.x, 0.0001f), 0.0f, 1.0f);
+		color = mix(color, sceneData.fogColor.rgb, pow(fogAmount, max(sceneData.fogColor.w, 0.0001f)));
+	}
 
-	vec3 color = (ambientLight + diffuse + specular + emission);
 	outFragColor = vec4(color, 1.0f);
 }
\ No newline at end of file
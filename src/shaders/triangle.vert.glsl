@@ -1,37 +1,54 @@
 #version 460
+#extension GL_GOOGLE_include_directive : require
 
-layout (location = 0) in vec3 vPosition;
-layout (location = 1) in vec3 vNormal;
-layout (location = 2) in vec3 vColor;
-layout (location = 3) in vec3 vTexCoord;
+#include "gpu_types.h"
 
-layout (location = 0) out vec3 outColor;
-layout (location = 1) out vec3 outTexCoord;
+// PackedVertex, see PackedVertex::GetVertexDescription
+layout (location = 0) in vec4 vPosition; // unorm16 inside the mesh's bounding box
+layout (location = 1) in vec2 vNormal;   // octahedral, snorm16
+layout (location = 2) in vec2 vTexCoord; // half float
+
+layout (location = 1) out vec2 outTexCoord;
 layout (location = 2) out vec3 outNormal;
 layout (location = 3) out vec3 outFragPos;
 layout (location = 4) out vec3 outViewPos;
+layout (location = 5) flat out uint outMaterialIndex;
+
+// Must match depth.vert.glsl for the depth prepass
+invariant gl_Position;
 
 layout(set = 0, binding = 0) uniform CameraBuffer {
-	mat4 view;
-	mat4 projection;
-	mat4 viewproj;
-	vec4 position;
-} cameraData;
-
-struct ObjectData{
-	mat4 model;
+	GPUCameraData cameraData;
 };
 
 //all object matrices
-layout(std140,set = 1, binding = 0) readonly buffer ObjectBuffer{
-	ObjectData objects[];
+layout(std430, set = 1, binding = 0) readonly buffer ObjectBuffer{
+	GPUObjectData objects[];
 } objectBuffer;
 
-/*layout (push_constant) uniform constants 
+// Where the per-draw object index comes from, see DrawIndexSource
+// 0 = push constants, 1 = dynamic uniform offset, 2 = gl_BaseInstance
+layout(constant_id = 10) const int DRAW_INDEX_SOURCE = 0;
+
+layout(set = 1, binding = 1) uniform DrawIndexBuffer {
+	uint objectIndex;
+} drawIndex;
+
+layout (push_constant) uniform constants 
 {
-	vec4 data;
-	mat4 renderMatrix;
-} PushConstants;*/
+	uint objectIndex;
+	uint materialIndex;
+	uint flags;
+} PushConstants;
+
+vec3 OctDecode(vec2 encoded)
+{
+	vec3 normal = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+	float fold = max(-normal.z, 0.0);
+	normal.x += normal.x >= 0.0 ? -fold : fold;
+	normal.y += normal.y >= 0.0 ? -fold : fold;
+	return normalize(normal);
+}
 
 void main() {
 	/*
@@ -45,13 +62,23 @@ void main() {
 	 * This gives us a simple way to send a single integer to the shader 
 	 * without setting up push constants or descriptors.
 	*/
-	mat4 modelMatrix = objectBuffer.objects[gl_BaseInstance].model;
+	uint objectIndex = gl_BaseInstance;
+	if (DRAW_INDEX_SOURCE == 0)
+		objectIndex = PushConstants.objectIndex;
+	else if (DRAW_INDEX_SOURCE == 1)
+		objectIndex = drawIndex.objectIndex;
+
+	GPUObjectData object = objectBuffer.objects[objectIndex];
+	vec3 position = object.positionOffset.xyz + vPosition.xyz * object.positionScale.xyz;
+	vec3 normal = OctDecode(vNormal);
+
+	mat4 modelMatrix = object.modelMatrix;
 	mat4 transformationMatrix = (cameraData.viewproj * modelMatrix);
-	gl_Position = transformationMatrix * vec4(vPosition, 1.0f);
-	outColor = vColor;
+	gl_Position = transformationMatrix * vec4(position, 1.0f);
 	outTexCoord = vTexCoord;
 	// Calculate this normal matrix in CPU, on a real app 'mat3(transpose(inverse(modelMatrix)))'
-	outNormal = mat3(transpose(inverse(modelMatrix))) * vNormal;
-	outFragPos = vec3(modelMatrix * vec4(vPosition, 1.0f));
+	outNormal = mat3(transpose(inverse(modelMatrix))) * normal;
+	outFragPos = vec3(modelMatrix * vec4(position, 1.0f));
 	outViewPos = vec3(cameraData.position);
+	outMaterialIndex = DRAW_INDEX_SOURCE == 0 ? PushConstants.materialIndex : object.materialIndex;
 }
\ No newline at end of file
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <iostream>
+
+#include <vulkan/vulkan.h>
+
+#define vkCheck(x)														\
+		{ VkResult err = x;												\
+		if (err)														\
+		{																\
+			std::cout <<"Detected Vulkan error: " << err << std::endl;	\
+			__debugbreak();													\
+		}}
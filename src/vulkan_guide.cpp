@@ -14,6 +14,7 @@
 #define GLM_FORCE_RADIANS
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/packing.hpp>
 
 #include <vulkan/vulkan.h>
 #include <shaderc/shaderc.hpp>
@@ -24,9 +25,16 @@
 #include <vector>
 #include <string>
 #include <array>
+#include <cfloat>
+#include <algorithm>
 #include <chrono>
 #include <functional>
+#include <memory>
+#include <thread>
 #include <sstream>
+#include <unordered_map>
+#include <deque>
+#include <random>
 
 #include <vkBoostrap/VkBootstrap.h>
 
@@ -35,7 +43,17 @@
 #define VMA_IMPLEMENTATION
 #include "VulkanMemoryAllocator/vk_mem_alloc.h"
 
+#include "bvh.h"
+#include "ecs.h"
 #include "helper.h"
+#include "job_system.h"
+#include "mesh_optimizer.h"
+#include "mesh_simplifier.h"
+#include "meshlet_builder.h"
+#include "render_graph.h"
+#include "scene_graph.h"
+#include "shaders/gpu_types.h"
+#include "vk_check.h"
 
 #define TINYGLTF_IMPLEMENTATION
 #define STB_IMAGE_IMPLEMENTATION
@@ -52,15 +70,16 @@
 constexpr int width = 1600;
 constexpr int height = 900;
 
-constexpr uint32_t frame_overlap = 2;
+constexpr uint32_t MAX_FRAME_OVERLAP = 3; // frames in flight are configurable at runtime up to this many
 
-#define vkCheck(x)														\
-		{ VkResult err = x;												\
-		if (err)														\
-		{																\
-			std::cout <<"Detected Vulkan error: " << err << std::endl;	\
-			__debugbreak();													\
-		}}				
+constexpr uint32_t MAX_OBJECTS = 10000;
+constexpr uint32_t MAX_BINDLESS_TEXTURES = 1024;
+constexpr uint32_t MAX_MATERIALS = 256;
+constexpr uint32_t MAX_RECORD_THREADS = 8; // secondary command buffers per frame, recorded by whichever workers pick them up
+constexpr uint32_t MIN_DRAWS_PER_CHUNK = 256; // below this a chunk is not worth its own secondary command buffer
+constexpr uint32_t MAX_MESH_LODS = 6;
+constexpr uint32_t MAX_MESHLET_DRAWS = 256 * 1024; // indirect draws the cluster cull pass may emit per frame
+constexpr uint32_t MAX_PYRAMID_LEVELS = 16;
 
 struct VertexInputDescription {
 
@@ -81,84 +100,324 @@ struct AllocatedImage {
 	VmaAllocation allocation;
 };
 
+// Full precision vertex as loaded, meshes keep these on the CPU and upload them as PackedVertex
 struct Vertex
 {
 	glm::vec3 position;
 	glm::vec3 normal;
 	glm::vec3 color;
 	glm::vec2 uv;
+};
+
+// The geometry pool stores vertices as two streams, depth only passes bind the position stream alone
+struct PackedPosition
+{
+	uint16_t position[4]; // unorm16 inside the mesh's bounding box, w unused
+};
+
+struct PackedAttributes
+{
+	uint32_t normal; // octahedral encoding, snorm16 x2
+	uint32_t uv;     // half float x2
+};
+
+// 16 byte vertex, decoded in triangle.vert.glsl and depth.vert.glsl
+struct PackedVertex
+{
+	PackedPosition position;
+	PackedAttributes attributes;
+	// Binding 0 = positions, binding 1 = attributes
 	static VertexInputDescription GetVertexDescription();
+	// Binding 0 only
+	static VertexInputDescription GetPositionDescription();
+	static PackedVertex Pack(const Vertex& vertex, glm::vec3 boxMin, glm::vec3 boxScale);
+};
+static_assert(sizeof(PackedPosition) == 8 && sizeof(PackedAttributes) == 8, "PackedVertex streams should stay 8 bytes each");
+
+// A level of detail is a range of the mesh's indices, every LOD shares the mesh's vertices
+struct MeshLod
+{
+	uint32_t indexOffset; // from the mesh's first index
+	uint32_t indexCount;
+	float error;          // object space distance to the full detail surface
+	uint32_t meshletOffset; // from the mesh's first meshlet
+	uint32_t meshletCount;
 };
 
 struct Mesh
 {
 	std::vector<Vertex> vertices;
-	AllocatedBuffer vertexBuffer;
+	std::vector<uint32_t> indices; // every LOD back to back, full detail first. Sequential indices are generated on upload when left empty
+	std::vector<MeshLod> lods;     // filled by BuildLods, or with the full detail LOD alone by UploadMesh
+	std::vector<Meshlets::Meshlet> meshlets; // every LOD's, in LOD order, filled by BuildMeshlets
+	glm::vec4 bounds; // bounding sphere in object space, xyz = center, w = radius
+	// Packed positions decode as boxMin + position * boxScale
+	glm::vec3 boxMin = glm::vec3(0.0f);
+	glm::vec3 boxScale = glm::vec3(1.0f);
+
+	// Ranges in the geometry pool, set by UploadMesh
+	uint32_t vertexOffset = 0;
+	uint32_t firstIndex = 0;
+	uint32_t indexCount = 0; // all LODs
+	uint32_t firstMeshlet = 0;
 
 	bool loadFromObj(const char* file, const char* material_path);
 	bool loadFromGLTF(const char* file);
 };
 
+// Device-local vertex streams and one index buffer shared by every mesh. Ranges come from VMA virtual blocks
+// sized in vertices and indices, so an offset is directly a vertexOffset/firstIndex and draws never rebind buffers.
+// The meshlets of every mesh live next to them for the cluster cull pass.
+struct GeometryPool
+{
+	static constexpr VkDeviceSize vertexCapacity = 4 * 1024 * 1024; // vertices
+	static constexpr VkDeviceSize indexCapacity = 16 * 1024 * 1024; // indices
+	static constexpr VkDeviceSize meshletCapacity = 256 * 1024;     // meshlets
+
+	AllocatedBuffer positionBuffer;  // PackedPosition stream
+	AllocatedBuffer attributeBuffer; // PackedAttributes stream
+	AllocatedBuffer indexBuffer;
+	AllocatedBuffer meshletBuffer;   // GPUMeshlet
+	VmaVirtualBlock vertexBlock = VK_NULL_HANDLE;
+	VmaVirtualBlock indexBlock = VK_NULL_HANDLE;
+	VmaVirtualBlock meshletBlock = VK_NULL_HANDLE;
+
+	void Init();
+	void Destroy();
+	// Reserves the mesh's ranges, false when the pool is full
+	bool Allocate(Mesh& mesh);
+	void Free(const Mesh& mesh);
+	void Bind(VkCommandBuffer cmd) const;
+	void BindPositions(VkCommandBuffer cmd) const;
+};
+
+// Per-draw indices, pushed before every draw so no descriptor or dynamic offset has to be rebound
 struct MeshPushConstants
 {
-	glm::vec4 data;
-	glm::mat4 renderMatrix;
+	uint32_t objectIndex;
+	uint32_t materialIndex;
+	uint32_t flags;
+	uint32_t padding;
+};
+
+// Where the vertex shader reads the object index from, see triangle.vert.glsl
+enum DrawIndexSource : uint32_t
+{
+	DRAW_INDEX_PUSH_CONSTANT = 0,
+	DRAW_INDEX_DYNAMIC_UNIFORM = 1,
+	DRAW_INDEX_BASE_INSTANCE = 2,
+	DRAW_INDEX_SOURCE_COUNT
+};
+
+// Material features that are baked into the fragment shader through specialization constants,
+// every combination in use gets its own pipeline variant
+enum MaterialFeatureBits : uint32_t
+{
+	MATERIAL_FEATURE_SPECULAR_MAP = 1 << 0,
+	MATERIAL_FEATURE_EMISSION_MAP = 1 << 1,
+	MATERIAL_FEATURE_ATTENUATION  = 1 << 2,
+	MATERIAL_FEATURE_FOG          = 1 << 3,
+};
+
+// Which pass a pipeline variant draws, part of the variant key
+enum ScenePipelinePass : uint32_t
+{
+	SCENE_PASS_COLOR,         // depth test and write, lit color
+	SCENE_PASS_DEPTH_ONLY,    // position stream only, no fragment shader
+	SCENE_PASS_COLOR_PREPASS, // lit color on top of the prepass depth, tests EQUAL without writing
+	SCENE_PASS_GBUFFER,         // deferred path, depth test and write, G-buffer targets instead of lit color
+	SCENE_PASS_GBUFFER_PREPASS, // G-buffer on top of the prepass depth
+};
+
+// Which lighting architecture shades the scene
+enum LightingPath : uint32_t
+{
+	LIGHTING_FORWARD,  // the scene pass shades every fragment, looping over its cluster's lights or all of them
+	LIGHTING_DEFERRED, // a G-buffer pass, then tiled compute lighting shades every pixel once
+	LIGHTING_PATH_COUNT
+};
+
+// G-buffer of the deferred path: albedo, octahedral normal, specular color with the Phong exponent, see gbuffer.frag.glsl
+constexpr uint32_t GBUFFER_TARGET_COUNT = 3;
+const VkFormat gbufferFormats[GBUFFER_TARGET_COUNT] = { VK_FORMAT_R8G8B8A8_SRGB, VK_FORMAT_R16G16_SFLOAT, VK_FORMAT_R8G8B8A8_UNORM };
+const VkFormat litFormat = VK_FORMAT_R16G16B16A16_SFLOAT; // deferred lighting output, blitted to the swapchain
+const VkClearColorValue sceneClearColor = { { 0.0f, 0.2f, 1.0f, 1.0f } };
+
+// Must match the constant_id layout in triangle.frag.glsl
+struct MaterialSpecialization
+{
+	VkBool32 useSpecularMap;
+	VkBool32 useEmissionMap;
+	int32_t  attenuationModel; // 0 = none, 1 = constant/linear/quadratic
+	VkBool32 useFog;
+};
+
+// Components of the entities in the ECS worlds, see ecs.h
+// A renderable has Transform, MeshRef, MaterialRef and Bounds
+struct Transform
+{
+	glm::mat4 world; // copied from the scene graph whenever node's world matrix changes
+	uint32_t node;   // SceneGraph::InvalidNode keeps the matrix it was given
+};
+
+struct MeshRef
+{
+	Mesh* mesh;
+};
+
+struct MaterialRef
+{
+	uint32_t index; // into the material table
 };
 
-struct alignas(16) Material
+struct Bounds
 {
-	glm::vec4 ambient;
-	glm::vec4 diffuse;
-	glm::vec4 specular;
-	glm::vec4 shininess;
+	glm::vec4 sphere; // world space, refreshed with the transform every frame
 };
 
-struct alignas(16) Light
+// Lights are not part of the scene graph, they carry their own position
+struct PointLight
 {
-	glm::vec4 position;
-	glm::vec4 ambient;
-	glm::vec4 diffuse;
-	glm::vec4 specular;
+	glm::vec3 position;
+	glm::vec4 color;
+	float diffuseStrength;
+	float ambientStrength;
+	float attenuationLinear;
+	float attenuationQuadratic;
+};
+
+// Moves a PointLight on a horizontal circle
+struct LightOrbit
+{
+	glm::vec3 center;
+	float radius;
+	float speed; // radians per second
+	float phase;
+};
+
+// What the culling leaves of a renderable, the object SSBO and the draws are built from these
+struct DrawItem
+{
+	const glm::mat4* transform;
+	Mesh* mesh;
+	uint32_t materialIndex;
+	uint32_t lod;
+};
 
-	glm::vec4 attenuation;
+// Material, GPUCameraData, GPUSceneData, GPUObjectData, GPUMaterialData and the clustered lighting types live in shaders/gpu_types.h
+
+// Hands out descriptor sets from a chain of pools, a new pool is created whenever the current one runs out
+struct DescriptorAllocator
+{
+	uint32_t setsPerPool = 256;
+	VkDescriptorPool currentPool{ VK_NULL_HANDLE };
+	std::vector<VkDescriptorPool> usedPools;
+	std::vector<VkDescriptorPool> freePools;
+
+	bool Allocate(VkDescriptorSetLayout layout, VkDescriptorSet* set);
+	// Resets every pool at once, all the sets allocated from it become invalid
+	void ResetPools();
+	void Cleanup();
+
+private:
+	VkDescriptorPool GrabPool();
 };
 
-struct alignas(16) GPUCameraData
+struct DescriptorWrite
 {
-	glm::mat4 view;
-	glm::mat4 projection;
-	glm::mat4 viewproj;
-	glm::vec4 position;
+	uint32_t binding;
+	VkDescriptorType type;
+	VkDescriptorBufferInfo bufferInfo;
+	VkDescriptorImageInfo imageInfo;
 };
 
-struct GPUSceneData {
-	glm::vec4 fogColor; // w is for exponent
-	glm::vec4 fogDistances; //x for min, y for max, zw unused.
-	glm::vec4 ambientColor;
-	glm::vec4 sunlightDirection; //w for sun power
-	glm::vec4 sunlightColor;
+// Reuses descriptor sets with the same layout and contents instead of allocating them again
+struct DescriptorSetCache
+{
+	struct CachedSet
+	{
+		VkDescriptorSetLayout layout;
+		std::vector<DescriptorWrite> writes;
+		VkDescriptorSet set;
+	};
+
+	DescriptorAllocator allocator;
+	std::unordered_map<size_t, std::vector<CachedSet>> sets; // keyed by the hash of layout and writes
+
+	VkDescriptorSet Get(VkDescriptorSetLayout layout, const std::vector<DescriptorWrite>& writes);
+	void Cleanup();
 };
 
-struct GPUObjectData {
-	glm::mat4 modelMatrix;
+// Destroys GPU resources once nothing on the GPU can use them anymore
+// Resources retired at runtime are tagged with the timeline value of the last submit that may reference them and
+// destroyed by Collect once the GPU got there. Resources that live until exit are destroyed by Flush, newest first.
+struct DeletionQueue
+{
+	struct RetiredEntry
+	{
+		uint64_t timelineValue;
+		std::function<void()> destroy;
+	};
+
+	std::deque<RetiredEntry> retired; // timeline values never decrease, so the front is always the next to go
+	std::vector<std::function<void()>> persistent;
+
+	// Destroyed at exit
+	void Push(std::function<void()>&& destroy);
+	// Destroyed once the GPU is past every submit made so far
+	void Retire(std::function<void()>&& destroy);
+	// Runs the retired entries whose timeline value was reached
+	void Collect(uint64_t completedValue);
+	// Runs everything, the device must be idle
+	void Flush();
 };
 
 struct FrameData {
+	// Binary semaphores for the swapchain, which can't use timeline semaphores
 	VkSemaphore presentSemaphore, renderSemaphore;
-	VkFence renderFence;
+	// Value of the timeline semaphore signaled by this frame's submit, the frame is free again once it is reached
+	uint64_t timelineValue;
+	// glfwGetTime() when the input of this frame was polled, for the latency report
+	double inputTime;
+	bool latencyPending;
 
 	VkCommandPool commandPool;
 	VkCommandBuffer mainCommandBuffer;
+	VkCommandBuffer imguiCommandBuffer; // secondary, ImGui has to be recorded separately when the pass executes secondaries
+
+	// One pool per recording thread, command pools must not be used from several threads at once
+	VkCommandPool threadCommandPools[MAX_RECORD_THREADS];
+	VkCommandBuffer threadCommandBuffers[MAX_RECORD_THREADS];
+	VkCommandBuffer threadDepthCommandBuffers[MAX_RECORD_THREADS]; // depth prepass chunks, same pools
 
 	AllocatedBuffer cameraBuffer;
 	VkDescriptorSet globalDescriptorSet;
 
 	AllocatedBuffer objectBuffer;
+	AllocatedBuffer drawIndexBuffer; // one padded object index per draw, only read with DRAW_INDEX_DYNAMIC_UNIFORM
 	VkDescriptorSet objectDescriptorSet;
+
+	// Cluster culling, the cull pass fills the draws and their count for vkCmdDrawIndexedIndirectCount
+	AllocatedBuffer cullBuffer; // GPUCullData
+	AllocatedBuffer meshletDrawBuffer;
+	AllocatedBuffer meshletDrawCountBuffer; // host visible so the count can be shown once the frame completed
+	bool meshletDrawsWritten;
+
+	// Clustered lighting, the lights are written by the CPU, the light cull pass fills the per cluster lists
+	AllocatedBuffer clusterBuffer;    // GPUClusterData
+	AllocatedBuffer pointLightBuffer; // GPUPointLight, MAX_POINT_LIGHTS
+	AllocatedBuffer clusterLightCountBuffer;
+	AllocatedBuffer clusterLightIndexBuffer;
+	VkDescriptorSet sceneDescriptorSet; // set 3, the material and this frame's lighting buffers
+
+	VkQueryPool timestampQueryPool;
+	bool timestampsWritten;
+
+	// Transient sets for this frame, reset wholesale once timelineValue is reached
+	DescriptorAllocator descriptorAllocator;
 };
 
 struct UploadContext {
-	VkFence uploadFence;
 	VkCommandPool commandPool;
 };
 
@@ -177,31 +436,46 @@ VkDevice device; // Vulkan device for commands
 VkSurfaceKHR surface; // Vulkan window surface
 VkSwapchainKHR swapchain;
 VkFormat swapchainImageFormat;
+VkExtent2D swapchainExtent;
+bool swapchainOutOfDate = false; // set on resize or when acquire/present report the swapchain no longer matches the surface
 std::vector<VkImage> swapchainImages;
 std::vector<VkImageView> swapchainImageViews;
 VkQueue graphicsQueue; //queue we will submit to
 uint32_t graphicsQueueFamily; //family of that queue
-VkRenderPass renderPass;
-std::vector<VkFramebuffer> framebuffers;
+// The scene uses dynamic rendering, this color-only LOAD pass exists because the ImGui 1.86 backend needs a render pass
+VkRenderPass overlayRenderPass;
+std::vector<VkFramebuffer> framebuffers; // overlay pass only, one per swapchain image
 uint32_t frameNumber;
 std::vector<VkPipelineShaderStageCreateInfo> shaderStages(2);
-VkViewport viewport;
-VkRect2D scissor;
 VkPipelineColorBlendAttachmentState colorBlendAttachment;
 VkPipelineLayout pipelineLayout;
-VkPipeline graphicsPipeline;
+std::unordered_map<uint32_t, VkPipeline> pipelineVariants; // keyed by MaterialFeatureBits, DrawIndexSource and ScenePipelinePass
 VkShaderModule vertexShaderModule;
 VkShaderModule fragmentShaderModule;
+VkShaderModule depthVertexShaderModule;
+VkShaderModule gbufferFragmentShaderModule;
 VmaAllocator allocator;
-Mesh triangleMesh;
+GeometryPool geometryPool;
 Mesh monkeyMesh;
-VkImageView depthImageView;
-AllocatedImage depthImage;
-VkFormat depthFormat;
-FrameData frames[frame_overlap];
+Mesh cubeMesh;
+Ecs::World world;            // renderables and lights of the scene
+Ecs::Entity lightEntity;     // the PointLight the Light Properties panel edits
+SceneGraph::Graph sceneGraph; // transforms of the renderables that have a node
+double gpuFrameTime = 0.0; // ms, measured with timestamp queries
+VkFormat depthFormat; // the depth buffer itself is a transient image of the render graph
+// Rebuilt every frame, passes declare their attachments and the graph places the barriers between them
+RenderGraph::Graph renderGraph;
+FrameData frames[MAX_FRAME_OVERLAP];
+uint32_t frameOverlap = 2; // frames the CPU may record ahead of the GPU, only changes between frames
+// Every queue submit signals the next value of this timeline semaphore, so the GPU progress of frames, uploads
+// and anything else is a single monotonically increasing counter that can be waited on by value
+VkSemaphore timelineSemaphore;
+uint64_t timelineValue = 0; // last value handed out to a submit
+DeletionQueue deletionQueue;
 VkDescriptorSetLayout globalSetLayout;
 VkDescriptorSetLayout objectSetLayout;
-VkDescriptorPool descriptorPool;
+DescriptorSetCache descriptorSetCache;
+VkDescriptorPool imguiDescriptorPool;
 GPUSceneData sceneParameters;
 AllocatedBuffer sceneParameterBuffer;
 UploadContext uploadContext;
@@ -209,23 +483,307 @@ VkDescriptorSet textureSet{ VK_NULL_HANDLE };
 VkDescriptorSetLayout singleTextureSetLayout;
 Material material;
 AllocatedBuffer materialBuffer;
-Light light;
-AllocatedBuffer lightBuffer;
-VkDescriptorSet sceneDescriptorSet{ VK_NULL_HANDLE };
 VkDescriptorSetLayout sceneSetLayout;
 Texture lostEmpire;
 Texture diffuseTexture;
 Texture specularMap;
 Texture emissionMap;
 VkSampler blockySampler;
+uint32_t materialFeatures = MATERIAL_FEATURE_SPECULAR_MAP | MATERIAL_FEATURE_ATTENUATION;
 
-// Light properties
-glm::vec4 lightColor = {1.0f, 1.0f, 1.0f, 1.0f};
-float diffuseStrength = 0.5f;
-float ambientStrength = 0.2f;
-float attenuationLinear = 0.09f;
-float attenuationQuadratic = 0.032f;
-glm::vec3 lightPosition = { 0.0f, -10.0f, 0.0f };
+// Farthest depth mip chain of the last frame, the cluster cull pass tests meshlets against it.
+// Mip 0 is the largest power of two that fits in the swapchain, it stays in GENERAL between frames.
+struct DepthPyramid
+{
+	AllocatedImage image;
+	VkImageView view = VK_NULL_HANDLE; // every level, sampled by the cull pass
+	VkImageView levels[MAX_PYRAMID_LEVELS] = {};
+	uint32_t levelCount = 0;
+	VkExtent2D extent = {};
+	glm::mat4 viewproj = glm::mat4(1.0f); // camera the pyramid was built for
+	uint32_t builtFrame = UINT32_MAX;     // frameNumber of the frame that built it
+} depthPyramid;
+
+struct DepthPyramidPushConstants
+{
+	uint32_t sourceWidth;
+	uint32_t sourceHeight;
+	uint32_t width;
+	uint32_t height;
+};
+
+VkSampler depthPyramidSampler;
+VkDescriptorSetLayout meshletCullSetLayout;
+VkDescriptorSetLayout depthPyramidSetLayout;
+VkPipelineLayout meshletCullPipelineLayout;
+VkPipelineLayout depthPyramidPipelineLayout;
+VkPipeline meshletCullPipeline = VK_NULL_HANDLE;
+VkPipeline depthPyramidPipeline = VK_NULL_HANDLE;
+
+VkDescriptorSetLayout lightCullSetLayout;
+VkPipelineLayout lightCullPipelineLayout;
+VkPipeline lightCullPipeline = VK_NULL_HANDLE;
+bool clusteredLighting = true;    // off, every fragment loops over every light
+int scatteredLightCount = 512;    // orbiting lights the Scatter Lights button creates
+uint32_t pointLightCount = 0;     // in the light buffer this frame
+LightingPath lightingPath = LIGHTING_FORWARD;
+
+struct DeferredLightingPushConstants
+{
+	glm::vec4 clearColor;
+	uint32_t flags; // DEFERRED_LIGHTING_*
+};
+
+VkDescriptorSetLayout deferredLightingSetLayout;
+VkPipelineLayout deferredLightingPipelineLayout;
+VkPipeline deferredLightingPipeline = VK_NULL_HANDLE;
+VkSampler gbufferSampler; // the G-buffer is read with texelFetch, the sampler only has to exist
+
+// Renders the current scene with every lighting configuration at a few light counts, measuredFrames frames each.
+// The orbiting lights are replaced by ScatterLights for every count and hold still while it runs.
+struct LightingBenchmark
+{
+	static constexpr uint32_t warmupFrames = 8;
+	static constexpr uint32_t measuredFrames = 60;
+	static constexpr uint32_t configCount = 3;
+	static constexpr uint32_t lightCountCount = 4;
+	static constexpr uint32_t lightCounts[lightCountCount] = { 16, 128, 512, 2048 };
+
+	bool running = false;
+	bool hasResults = false;
+	uint32_t config = 0;
+	uint32_t lightStep = 0;
+	uint32_t frame = 0;
+	uint32_t restoreLightCount = 0; // orbiting lights before the benchmark
+	double gpuTime[lightCountCount][configCount] = {}; // ms, accumulated and then averaged
+} lightingBenchmark;
+
+// Lighting path and clustering of every LightingBenchmark configuration
+const LightingPath lightingConfigPaths[LightingBenchmark::configCount] = { LIGHTING_FORWARD, LIGHTING_FORWARD, LIGHTING_DEFERRED };
+const bool lightingConfigClustered[LightingBenchmark::configCount] = { false, true, false };
+const char* lightingConfigNames[LightingBenchmark::configCount] = { "Forward", "Forward clustered", "Deferred tiled" };
+const char* lightingPathNames[LIGHTING_PATH_COUNT] = { "Forward", "Deferred" };
+
+// Bindless textures, only used when the device supports descriptor indexing
+bool useBindless = false;
+bool clusterCullingSupported = false; // needs drawIndirectCount, multiDrawIndirect and drawIndirectFirstInstance
+bool useMemoryBudget = false; // VK_EXT_memory_budget, VMA falls back to its own estimate without it
+VkDescriptorPool bindlessDescriptorPool;
+VkDescriptorSetLayout bindlessSetLayout;
+VkDescriptorSet bindlessSet{ VK_NULL_HANDLE };
+uint32_t bindlessTextureCount = 0;
+uint32_t materialCount = 0;
+AllocatedBuffer materialTableBuffer;
+uint32_t containerMaterialIndex = 0;
+
+// Draw index microbenchmark, draws drawCount cubes for measuredFrames frames with every DrawIndexSource
+struct DrawIndexBenchmark
+{
+	static constexpr uint32_t drawCount = MAX_OBJECTS;
+	static constexpr uint32_t warmupFrames = 8;
+	static constexpr uint32_t measuredFrames = 120;
+
+	bool running = false;
+	bool hasResults = false;
+	uint32_t source = 0;
+	uint32_t frame = 0;
+	double cpuRecordTime[DRAW_INDEX_SOURCE_COUNT] = {}; // ms, accumulated and then averaged
+	double gpuTime[DRAW_INDEX_SOURCE_COUNT] = {};
+	Ecs::World world;
+} drawIndexBenchmark;
+
+const char* drawIndexSourceNames[DRAW_INDEX_SOURCE_COUNT] = { "Push constants", "Dynamic UBO offsets", "gl_BaseInstance SSBO" };
+
+// Frame task graph, runs on the job system with the main thread as worker 0
+Jobs::JobSystem jobSystem;
+Jobs::TaskGraph frameGraph;
+int workerThreadCount = 1;
+bool parallelRecording = true;
+bool frustumCulling = true;
+bool hierarchicalCulling = true; // walk the object BVH instead of testing every object against the frustum
+bool depthPrepass = false; // lay down depth with the position stream first so the lit pass shades every pixel once
+bool lodSelection = true;
+float lodErrorPixels = 1.0f; // the coarsest LOD whose error projects below this is drawn
+uint64_t lodTriangles = 0;   // drawn this frame
+uint64_t fullTriangles = 0;  // the same objects at full detail
+bool clusterCulling = true;  // meshlets are culled on the GPU and drawn indirectly, when supported
+bool meshletBackfaceCulling = true;
+bool meshletOcclusionCulling = true;
+uint32_t meshletCandidates = 0; // meshlets of the visible objects' LODs this frame
+uint32_t meshletsDrawn = 0;     // read back from the draw count of the last completed frame
+double recordTime = 0.0; // ms spent in the record draws task
+double frameGraphTime = 0.0; // ms from the start to the end of the frame graph on the main thread
+
+// Per object scratch of the frame graph, indexed like the draw list
+std::vector<Ecs::ChunkRef> drawChunks; // renderable chunks of the world drawn this frame
+std::vector<uint8_t> objectVisible;      // per renderable, by ChunkRef::firstIndex + row
+std::vector<uint8_t> objectLods;
+std::vector<DrawItem> drawItems;         // visible renderables, in chunk order
+std::vector<glm::vec4> objectBounds;     // world space bounds of the renderables, the primitives of objectBvh
+
+// Hierarchy over objectBounds, built for one world and its structure version, refit while only transforms change
+Bvh::Tree objectBvh;
+const Ecs::World* bvhWorld = nullptr;
+uint64_t bvhVersion = 0;
+constexpr float bvhRebuildRatio = 1.5f; // a refit that raises the SAH cost past this much of the built tree's rebuilds it
+
+// Written by the frame graph, the UI shows the copy in frameStats
+struct BvhReport
+{
+	uint32_t nodes = 0;
+	uint32_t objects = 0;
+	uint32_t builds = 0;
+	float cost = 0.0f;
+	float buildCost = 0.0f;
+	Bvh::Stats cull;
+} bvhReport;
+
+// What the UI shows of the last frame graph. The UI task runs alongside the other tasks of the next graph, so it reads
+// this copy, taken on the main thread once the graph finished, instead of what those tasks write.
+struct FrameStats
+{
+	uint32_t visibleObjects = 0;
+	std::vector<std::pair<const char*, double>> taskTimes; // name, ms
+	BvhReport bvh;
+	uint64_t lodTriangles = 0;
+	uint64_t fullTriangles = 0;
+	uint32_t meshletCandidates = 0;
+} frameStats;
+
+// ImGui is built inside the frame graph, anything that can't run concurrently with the other tasks
+// (pipeline rebuilds, benchmark setup) is queued here and runs on the main thread before the next graph
+std::vector<std::function<void()>> uiActions;
+
+// Present mode, frames in flight and the optional CPU frame limiter
+// MAILBOX and IMMEDIATE don't wait for vblank so they are what the throughput benchmarks should run with,
+// one frame in flight plus the limiter gives the lowest input latency for interactive use.
+struct FramePacing
+{
+	VkPresentModeKHR requestedPresentMode = VK_PRESENT_MODE_FIFO_KHR;
+	VkPresentModeKHR presentMode = VK_PRESENT_MODE_FIFO_KHR; // what the surface actually supports of the request
+	int framesInFlight = 2;
+
+	// The limiter sleeps before input is polled rather than after, so the frame is built from the freshest input
+	bool limitFrameRate = false;
+	int targetFrameRate = 60;
+	double nextFrameTime = 0.0;
+
+	double inputTime = 0.0; // when glfwPollEvents returned for the frame being built
+
+	// Latencies in ms averaged over reportInterval seconds
+	// present: input polled -> vkQueuePresentKHR returned, gpu: input polled -> frame seen complete on the timeline
+	static constexpr double reportInterval = 0.5;
+	double reportStart = 0.0;
+	double presentLatencySum = 0.0, gpuLatencySum = 0.0;
+	uint32_t presentLatencyCount = 0, gpuLatencyCount = 0;
+	double presentLatency = 0.0, gpuLatency = 0.0;
+} framePacing;
+
+const VkPresentModeKHR presentModes[] = { VK_PRESENT_MODE_FIFO_KHR, VK_PRESENT_MODE_FIFO_RELAXED_KHR, VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_IMMEDIATE_KHR };
+const char* presentModeNames[] = { "FIFO", "FIFO Relaxed", "Mailbox", "Immediate" };
+
+const char* PresentModeName(VkPresentModeKHR mode)
+{
+	for (uint32_t i = 0; i < ARRAYSIZE(presentModes); i++)
+	{
+		if (presentModes[i] == mode)
+			return presentModeNames[i];
+	}
+	return "Unknown";
+}
+
+// Runs the frame graph with 1..N workers on the benchmark grid, measuredFrames frames each
+struct JobScalingBenchmark
+{
+	static constexpr uint32_t warmupFrames = 8;
+	static constexpr uint32_t measuredFrames = 60;
+
+	bool running = false;
+	bool hasResults = false;
+	uint32_t workers = 1;
+	uint32_t frame = 0;
+	std::vector<double> graphTime; // ms, per worker count
+	Ecs::World world;
+} jobScalingBenchmark;
+
+// Post-transform cache efficiency of every OBJ in assets/ before and after OptimizeMesh
+struct MeshOptimizerReport
+{
+	struct Entry
+	{
+		std::string name;
+		MeshOptimizer::VertexCacheStats before;
+		MeshOptimizer::VertexCacheStats optimized;
+		MeshOptimizer::VertexCacheStats drawn; // LOD 0 after meshlet building reordered its triangles, what the GPU sees
+		double time; // ms spent in OptimizeMesh
+	};
+	std::vector<Entry> entries;
+} meshOptimizerReport;
+
+// Scene graph update cost on a synthetic hierarchy, 1000 roots with 9 children of 10 leaves each
+struct SceneGraphBenchmark
+{
+	static constexpr uint32_t rootCount = 1000;
+	static constexpr uint32_t childCount = 9;
+	static constexpr uint32_t leafCount = 10;
+	static constexpr uint32_t nodeCount = rootCount * (1 + childCount * (1 + leafCount));
+	static constexpr uint32_t iterations = 100;
+
+	bool hasResults = false;
+	double fullUpdateTime = 0.0;   // ms, every root moved so every node is recomputed
+	double sparseUpdateTime = 0.0; // ms, 1% of the roots moved
+	double cleanUpdateTime = 0.0;  // ms, nothing moved
+} sceneGraphBenchmark;
+
+// Fog properties
+glm::vec4 fogColor = { 0.0f, 0.2f, 1.0f, 1.0f }; // w is for exponent
+float fogStart = 10.0f;
+float fogEnd = 100.0f;
+
+// Last timeline value the GPU has reached
+uint64_t CompletedTimelineValue()
+{
+	uint64_t value;
+	vkCheck(vkGetSemaphoreCounterValue(device, timelineSemaphore, &value));
+	return value;
+}
+
+void WaitTimelineValue(uint64_t value)
+{
+	VkSemaphoreWaitInfo waitInfo = {};
+	waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+	waitInfo.semaphoreCount = 1;
+	waitInfo.pSemaphores = &timelineSemaphore;
+	waitInfo.pValues = &value;
+	vkCheck(vkWaitSemaphores(device, &waitInfo, UINT64_MAX));
+}
+
+void DeletionQueue::Push(std::function<void()>&& destroy)
+{
+	persistent.push_back(std::move(destroy));
+}
+
+void DeletionQueue::Retire(std::function<void()>&& destroy)
+{
+	retired.push_back({ timelineValue, std::move(destroy) });
+}
+
+void DeletionQueue::Collect(uint64_t completedValue)
+{
+	while (!retired.empty() && retired.front().timelineValue <= completedValue)
+	{
+		retired.front().destroy();
+		retired.pop_front();
+	}
+}
+
+void DeletionQueue::Flush()
+{
+	Collect(UINT64_MAX);
+	for (auto it = persistent.rbegin(); it != persistent.rend(); it++)
+		(*it)();
+	persistent.clear();
+}
 
 void immediate_submit(std::function<void(VkCommandBuffer cmd)>&& function)
 {
@@ -248,15 +806,23 @@ void immediate_submit(std::function<void(VkCommandBuffer cmd)>&& function)
 
 	vkCheck(vkEndCommandBuffer(cmdBuffer));
 
+	const uint64_t uploadValue = ++timelineValue;
+	VkTimelineSemaphoreSubmitInfo timelineInfo = {};
+	timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+	timelineInfo.signalSemaphoreValueCount = 1;
+	timelineInfo.pSignalSemaphoreValues = &uploadValue;
+
 	VkSubmitInfo submitInfo = {};
 	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.pNext = &timelineInfo;
 	submitInfo.commandBufferCount = 1;
 	submitInfo.pCommandBuffers = &cmdBuffer;
+	submitInfo.signalSemaphoreCount = 1;
+	submitInfo.pSignalSemaphores = &timelineSemaphore;
 
-	vkCheck(vkQueueSubmit(graphicsQueue, 1, &submitInfo, uploadContext.uploadFence));
+	vkCheck(vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE));
 
-	vkWaitForFences(device, 1, &uploadContext.uploadFence, true, 9999999999);
-	vkResetFences(device, 1, &uploadContext.uploadFence);
+	WaitTimelineValue(uploadValue);
 
 	vkFreeCommandBuffers(device, uploadContext.commandPool, 1, &cmdBuffer);
 
@@ -273,7 +839,7 @@ constexpr FrameData& GetCurrentFrame()
 	 * While the GPU is busy executing the rendering commands from frame 0,
 	 * the CPU will be writing the buffers of frame 1, and reverse.
 	*/
-	return frames[frameNumber % frame_overlap];
+	return frames[frameNumber % frameOverlap];
 }
 
 static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
@@ -301,7 +867,54 @@ static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
 	return VK_FALSE;
 }
 
-VkShaderModule CompileShader(const char* file, shaderc_shader_kind shaderType, const char* entryPoint, const char* shaderName)
+// Resolves #include "file" relative to the including shader, and #include <file> relative to src/shaders
+class ShaderIncluder : public shaderc::CompileOptions::IncluderInterface
+{
+public:
+	shaderc_include_result* GetInclude(const char* requestedSource, shaderc_include_type type, const char* requestingSource, size_t includeDepth) override
+	{
+		std::filesystem::path path = std::filesystem::path("src/shaders") / requestedSource;
+		if (type == shaderc_include_type_relative)
+			path = std::filesystem::path(requestingSource).parent_path() / requestedSource;
+
+		IncludeData* data = new IncludeData();
+		data->name = path.generic_string();
+
+		std::ifstream in(path, std::ios::in | std::ios::binary);
+		if (in)
+		{
+			data->content.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+		}
+		else
+		{
+			// An empty source name tells shaderc the include failed, the content is the error message
+			data->content = "Cannot open include file " + data->name;
+			data->name.clear();
+		}
+
+		data->result.source_name = data->name.c_str();
+		data->result.source_name_length = data->name.size();
+		data->result.content = data->content.c_str();
+		data->result.content_length = data->content.size();
+		data->result.user_data = data;
+		return &data->result;
+	}
+
+	void ReleaseInclude(shaderc_include_result* result) override
+	{
+		delete (IncludeData*)result->user_data;
+	}
+
+private:
+	struct IncludeData
+	{
+		std::string name;
+		std::string content;
+		shaderc_include_result result;
+	};
+};
+
+VkShaderModule CompileShader(const char* file, shaderc_shader_kind shaderType, const char* entryPoint, const char* shaderName, const std::vector<std::string>& defines = {})
 {
 	std::string shaderSource;
 	std::ifstream in(file, std::ios::in | std::ios::binary);
@@ -320,18 +933,22 @@ VkShaderModule CompileShader(const char* file, shaderc_shader_kind shaderType, c
 
 	shaderc::Compiler compiler;
 	shaderc::CompileOptions options;
-	options.SetTargetEnvironment(shaderc_target_env_vulkan, shaderc_env_version_vulkan_1_1);
+	options.SetTargetEnvironment(shaderc_target_env_vulkan, shaderc_env_version_vulkan_1_2);
 	options.SetWarningsAsErrors();
 	options.SetGenerateDebugInfo();
 	options.SetSourceLanguage(shaderc_source_language_glsl);
+	options.SetIncluder(std::make_unique<ShaderIncluder>());
+	for (const std::string& define : defines)
+		options.AddMacroDefinition(define);
+	// The file path is the source name so relative includes and error messages point at the right file
 	shaderc::SpvCompilationResult module = compiler.CompileGlslToSpv(shaderSource,
 																	 shaderType,
-																	 shaderName,
+																	 file,
 																	 entryPoint,
 																	 options);
 	if (module.GetCompilationStatus() != shaderc_compilation_status_success)
 	{
-		std::cout << module.GetErrorMessage() << std::endl;
+		std::cout << shaderName << ": " << module.GetErrorMessage() << std::endl;
 		__debugbreak();
 	}
 
@@ -346,49 +963,82 @@ VkShaderModule CompileShader(const char* file, shaderc_shader_kind shaderType, c
 	return shaderModule;
 }
 
-VertexInputDescription Vertex::GetVertexDescription()
+VertexInputDescription PackedVertex::GetPositionDescription()
 {
 	VertexInputDescription description;
 
-	VkVertexInputBindingDescription mainBinding = {};
-	mainBinding.binding = 0;
-	mainBinding.stride = sizeof(Vertex);
-	mainBinding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+	VkVertexInputBindingDescription positionBinding = {};
+	positionBinding.binding = 0;
+	positionBinding.stride = sizeof(PackedPosition);
+	positionBinding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
 
-	description.bindings.push_back(mainBinding);
+	description.bindings.push_back(positionBinding);
 
 	VkVertexInputAttributeDescription positionAttribute = {};
 	positionAttribute.binding = 0;
 	positionAttribute.location = 0;
-	positionAttribute.format = VK_FORMAT_R32G32B32_SFLOAT;
-	positionAttribute.offset = offsetof(Vertex, position);
+	positionAttribute.format = VK_FORMAT_R16G16B16A16_UNORM;
+	positionAttribute.offset = offsetof(PackedPosition, position);
+
+	description.attributes.push_back(positionAttribute);
+
+	return description;
+}
+
+VertexInputDescription PackedVertex::GetVertexDescription()
+{
+	VertexInputDescription description = GetPositionDescription();
+
+	VkVertexInputBindingDescription attributeBinding = {};
+	attributeBinding.binding = 1;
+	attributeBinding.stride = sizeof(PackedAttributes);
+	attributeBinding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+	description.bindings.push_back(attributeBinding);
 
 	VkVertexInputAttributeDescription normalAttribute = {};
-	normalAttribute.binding = 0;
+	normalAttribute.binding = 1;
 	normalAttribute.location = 1;
-	normalAttribute.format = VK_FORMAT_R32G32B32_SFLOAT;
-	normalAttribute.offset = offsetof(Vertex, normal);
-
-	VkVertexInputAttributeDescription colorAttribute = {};
-	colorAttribute.binding = 0;
-	colorAttribute.location = 2;
-	colorAttribute.format = VK_FORMAT_R32G32B32_SFLOAT;
-	colorAttribute.offset = offsetof(Vertex, color);
+	normalAttribute.format = VK_FORMAT_R16G16_SNORM;
+	normalAttribute.offset = offsetof(PackedAttributes, normal);
 
 	VkVertexInputAttributeDescription uvAttribute = {};
-	uvAttribute.binding = 0;
-	uvAttribute.location = 3;
-	uvAttribute.format = VK_FORMAT_R32G32_SFLOAT;
-	uvAttribute.offset = offsetof(Vertex, uv);
+	uvAttribute.binding = 1;
+	uvAttribute.location = 2;
+	uvAttribute.format = VK_FORMAT_R16G16_SFLOAT;
+	uvAttribute.offset = offsetof(PackedAttributes, uv);
 
-	description.attributes.push_back(positionAttribute);
 	description.attributes.push_back(normalAttribute);
-	description.attributes.push_back(colorAttribute);
 	description.attributes.push_back(uvAttribute);
 
 	return description;
 }
 
+// Maps the unit sphere onto the [-1, 1] square: the upper half is the inner diamond, the lower half is folded to the corners
+glm::vec2 OctEncode(glm::vec3 normal)
+{
+	normal /= fabsf(normal.x) + fabsf(normal.y) + fabsf(normal.z);
+	glm::vec2 encoded = glm::vec2(normal.x, normal.y);
+	if (normal.z < 0.0f)
+	{
+		encoded.x = (1.0f - fabsf(normal.y)) * (normal.x >= 0.0f ? 1.0f : -1.0f);
+		encoded.y = (1.0f - fabsf(normal.x)) * (normal.y >= 0.0f ? 1.0f : -1.0f);
+	}
+	return encoded;
+}
+
+PackedVertex PackedVertex::Pack(const Vertex& vertex, glm::vec3 boxMin, glm::vec3 boxScale)
+{
+	PackedVertex packed;
+	glm::vec3 position = glm::clamp((vertex.position - boxMin) / boxScale, 0.0f, 1.0f);
+	for (int i = 0; i < 3; i++)
+		packed.position.position[i] = (uint16_t)roundf(position[i] * 65535.0f);
+	packed.position.position[3] = 0;
+	packed.attributes.normal = glm::packSnorm2x16(glm::length(vertex.normal) > 0.0f ? OctEncode(glm::normalize(vertex.normal)) : glm::vec2(0.0f));
+	packed.attributes.uv = glm::packHalf2x16(vertex.uv);
+	return packed;
+}
+
 bool Mesh::loadFromGLTF(const char* file)
 {
 	tinygltf::Model model;
@@ -441,6 +1091,27 @@ bool Mesh::loadFromObj(const char* file, const char* material_path = "")
 		return false;
 	}
 
+	// A vertex is unique per position/normal/texcoord/material, faces sharing one reuse its index
+	struct ObjVertexKey
+	{
+		int position, normal, texcoord, material;
+		bool operator==(const ObjVertexKey& other) const
+		{
+			return position == other.position && normal == other.normal && texcoord == other.texcoord && material == other.material;
+		}
+	};
+	struct ObjVertexKeyHash
+	{
+		size_t operator()(const ObjVertexKey& key) const
+		{
+			size_t hash = std::hash<int>()(key.position);
+			hash = hash * 31 + std::hash<int>()(key.normal);
+			hash = hash * 31 + std::hash<int>()(key.texcoord);
+			return hash * 31 + std::hash<int>()(key.material);
+		}
+	};
+	std::unordered_map<ObjVertexKey, uint32_t, ObjVertexKeyHash> uniqueVertices;
+
 	// Loop over shapes
 	for (size_t s = 0; s < shapes.size(); s++)
 	{
@@ -467,6 +1138,16 @@ bool Mesh::loadFromObj(const char* file, const char* material_path = "")
 				tinyobj::real_t nz = attrib.normals[3 * idx.normal_index + 2];
 
 				if (idx.texcoord_index < 0) idx.texcoord_index = 0;
+				auto id = shapes[s].mesh.material_ids[f];
+
+				ObjVertexKey key = { idx.vertex_index, idx.normal_index, idx.texcoord_index, id };
+				auto found = uniqueVertices.find(key);
+				if (found != uniqueVertices.end())
+				{
+					indices.push_back(found->second);
+					continue;
+				}
+
 				tinyobj::real_t ux = attrib.texcoords[2 * idx.texcoord_index + 0];
 				tinyobj::real_t uy = attrib.texcoords[2 * idx.texcoord_index + 1];
 
@@ -484,12 +1165,13 @@ bool Mesh::loadFromObj(const char* file, const char* material_path = "")
 				new_vert.uv.y = 1 - uy; //do the 1-y on the uv.y because Vulkan UV coordinates work like that.
 
 				//we are setting the vertex color as the vertex normal. This is just for display purposes
-				auto id = shapes[s].mesh.material_ids[f];
 				if(id > -1)
 					new_vert.color = glm::vec3(materials[id].diffuse[0], materials[id].diffuse[1], materials[id].diffuse[2]);
 				else
 					new_vert.color = glm::vec3(1, 1, 1);
 
+				uniqueVertices.emplace(key, (uint32_t)vertices.size());
+				indices.push_back((uint32_t)vertices.size());
 				vertices.push_back(new_vert);
 
 			}
@@ -497,6 +1179,64 @@ bool Mesh::loadFromObj(const char* file, const char* material_path = "")
 		}
 
 	}
+
+	return true;
+}
+
+// Cooks an indexed mesh: cache friendly triangle order, then clusters sorted against overdraw, then vertices in fetch order
+void OptimizeMesh(Mesh& mesh)
+{
+	if (mesh.indices.empty())
+		return;
+
+	MeshOptimizer::OptimizeVertexCache(mesh.indices, (uint32_t)mesh.vertices.size());
+	MeshOptimizer::OptimizeOverdraw(mesh.indices, mesh.vertices);
+	MeshOptimizer::OptimizeVertexFetch(mesh.vertices, mesh.indices);
+}
+
+// Appends up to MAX_MESH_LODS - 1 simplified LODs to the mesh's indices, each with about half the triangles of the previous one.
+// Runs after OptimizeMesh, LODs get their own vertex cache order but share the full detail vertex order.
+void BuildLods(Mesh& mesh)
+{
+	const uint32_t fullIndexCount = (uint32_t)mesh.indices.size();
+	mesh.lods.clear();
+	mesh.lods.push_back({ 0, fullIndexCount, 0.0f });
+	if (fullIndexCount == 0)
+		return;
+
+	const std::vector<uint32_t> fullIndices = mesh.indices;
+	std::vector<uint32_t> lodIndices;
+	while (mesh.lods.size() < MAX_MESH_LODS)
+	{
+		const MeshLod& previous = mesh.lods.back();
+		const size_t targetIndexCount = (previous.indexCount / 6) * 3;
+		// Always simplify the full detail mesh so errors are measured against the real surface
+		float error = MeshSimplifier::Simplify(lodIndices, mesh.vertices, fullIndices, targetIndexCount, 0.05f);
+
+		// Stop once the simplifier is stuck on its error bound, another LOD would barely be cheaper
+		if (lodIndices.empty() || lodIndices.size() > previous.indexCount * 9 / 10)
+			break;
+
+		MeshOptimizer::OptimizeVertexCache(lodIndices, (uint32_t)mesh.vertices.size());
+		MeshLod lod;
+		lod.indexOffset = (uint32_t)mesh.indices.size();
+		lod.indexCount = (uint32_t)lodIndices.size();
+		lod.error = std::max(error, previous.error);
+		mesh.indices.insert(mesh.indices.end(), lodIndices.begin(), lodIndices.end());
+		mesh.lods.push_back(lod);
+	}
+}
+
+// Splits every LOD into meshlets, reordering the LOD's indices so each meshlet is a contiguous range of them
+void BuildMeshlets(Mesh& mesh)
+{
+	mesh.meshlets.clear();
+	for (MeshLod& lod : mesh.lods)
+	{
+		lod.meshletOffset = (uint32_t)mesh.meshlets.size();
+		Meshlets::Build(mesh.meshlets, mesh.indices, lod.indexOffset, lod.indexCount, mesh.vertices);
+		lod.meshletCount = (uint32_t)mesh.meshlets.size() - lod.meshletOffset;
+	}
 }
 
 VkImageCreateInfo ImageCreateInfo(VkFormat format, VkImageUsageFlags usageFlags, VkExtent3D extent)
@@ -532,6 +1272,39 @@ VkImageViewCreateInfo ImageViewCreateInfo(VkFormat format, VkImage image, VkImag
 	return info;
 }
 
+VkImageMemoryBarrier2 ImageBarrier2(VkImage image, VkImageAspectFlags aspectMask, VkImageLayout oldLayout, VkImageLayout newLayout,
+									 VkPipelineStageFlags2 srcStageMask, VkAccessFlags2 srcAccessMask,
+									 VkPipelineStageFlags2 dstStageMask, VkAccessFlags2 dstAccessMask)
+{
+	VkImageMemoryBarrier2 barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+	barrier.srcStageMask = srcStageMask;
+	barrier.srcAccessMask = srcAccessMask;
+	barrier.dstStageMask = dstStageMask;
+	barrier.dstAccessMask = dstAccessMask;
+	barrier.oldLayout = oldLayout;
+	barrier.newLayout = newLayout;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = image;
+	barrier.subresourceRange.aspectMask = aspectMask;
+	barrier.subresourceRange.baseMipLevel = 0;
+	barrier.subresourceRange.levelCount = 1;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount = 1;
+
+	return barrier;
+}
+
+void PipelineBarrier2(VkCommandBuffer cmd, uint32_t barrierCount, const VkImageMemoryBarrier2* barriers)
+{
+	VkDependencyInfo dependencyInfo = {};
+	dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+	dependencyInfo.imageMemoryBarrierCount = barrierCount;
+	dependencyInfo.pImageMemoryBarriers = barriers;
+	vkCmdPipelineBarrier2(cmd, &dependencyInfo);
+}
+
 bool LoadFromImage(const char* file, AllocatedImage& outImage)
 {
 	int texWidth, texHeight, texChannels;
@@ -588,29 +1361,14 @@ bool LoadFromImage(const char* file, AllocatedImage& outImage)
 	imgAllocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
 
 	vmaCreateImage(allocator, &imgInfo, &imgAllocInfo, &image.image, &image.allocation, nullptr);
+	deletionQueue.Push([=] { vmaDestroyImage(allocator, image.image, image.allocation); });
 
 	immediate_submit([&](VkCommandBuffer cmd) {
-		VkImageSubresourceRange range;
-		range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		range.levelCount = 1;
-		range.baseMipLevel = 0;
-		range.layerCount = 1;
-		range.baseArrayLayer = 0;
-
-		VkImageMemoryBarrier imageBarrierToTransfer = {};
-		imageBarrierToTransfer.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-		imageBarrierToTransfer.srcAccessMask = 0;
-		imageBarrierToTransfer.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-		imageBarrierToTransfer.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-		imageBarrierToTransfer.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-		imageBarrierToTransfer.image = image.image;
-		imageBarrierToTransfer.subresourceRange = range;
-
-		vkCmdPipelineBarrier(cmd,
-							 VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-							 VK_PIPELINE_STAGE_TRANSFER_BIT,
-							 0, 0, nullptr, 0, nullptr, 1,
-							 &imageBarrierToTransfer);
+		VkImageMemoryBarrier2 toTransfer = ImageBarrier2(image.image, VK_IMAGE_ASPECT_COLOR_BIT,
+														 VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+														 VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE,
+														 VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT);
+		PipelineBarrier2(cmd, 1, &toTransfer);
 
 		VkBufferImageCopy copyRegion = {};
 		copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
@@ -622,20 +1380,11 @@ bool LoadFromImage(const char* file, AllocatedImage& outImage)
 		//copy the buffer into the image
 		vkCmdCopyBufferToImage(cmd, stagingBuffer.buffer, image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
 
-		VkImageMemoryBarrier imageBarrierToRead = {};
-		imageBarrierToRead.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-		imageBarrierToRead.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-		imageBarrierToRead.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-		imageBarrierToRead.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-		imageBarrierToRead.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-		imageBarrierToRead.image = image.image;
-		imageBarrierToRead.subresourceRange = range;
-
-		vkCmdPipelineBarrier(cmd,
-							 VK_PIPELINE_STAGE_TRANSFER_BIT,
-							 VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-							 0, 0, nullptr, 0, nullptr, 1,
-							 &imageBarrierToRead);
+		VkImageMemoryBarrier2 toRead = ImageBarrier2(image.image, VK_IMAGE_ASPECT_COLOR_BIT,
+													 VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+													 VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+													 VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT);
+		PipelineBarrier2(cmd, 1, &toRead);
 	});
 
 	vmaDestroyBuffer(allocator, stagingBuffer.buffer, stagingBuffer.allocation);
@@ -645,6 +1394,220 @@ bool LoadFromImage(const char* file, AllocatedImage& outImage)
 	return true;
 }
 
+void GeometryPool::Init()
+{
+	VkBufferCreateInfo bufferInfo = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+	VmaAllocationCreateInfo allocInfo = {};
+	allocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+	// Storage usage so compute passes can read the geometry as well
+	bufferInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	bufferInfo.size = vertexCapacity * sizeof(PackedPosition);
+	vkCheck(vmaCreateBuffer(allocator, &bufferInfo, &allocInfo, &positionBuffer.buffer, &positionBuffer.allocation, nullptr));
+	bufferInfo.size = vertexCapacity * sizeof(PackedAttributes);
+	vkCheck(vmaCreateBuffer(allocator, &bufferInfo, &allocInfo, &attributeBuffer.buffer, &attributeBuffer.allocation, nullptr));
+
+	bufferInfo.size = indexCapacity * sizeof(uint32_t);
+	bufferInfo.usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	vkCheck(vmaCreateBuffer(allocator, &bufferInfo, &allocInfo, &indexBuffer.buffer, &indexBuffer.allocation, nullptr));
+
+	bufferInfo.size = meshletCapacity * sizeof(GPUMeshlet);
+	bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	vkCheck(vmaCreateBuffer(allocator, &bufferInfo, &allocInfo, &meshletBuffer.buffer, &meshletBuffer.allocation, nullptr));
+
+	VmaVirtualBlockCreateInfo blockInfo = {};
+	blockInfo.size = vertexCapacity;
+	vkCheck(vmaCreateVirtualBlock(&blockInfo, &vertexBlock));
+	blockInfo.size = indexCapacity;
+	vkCheck(vmaCreateVirtualBlock(&blockInfo, &indexBlock));
+	blockInfo.size = meshletCapacity;
+	vkCheck(vmaCreateVirtualBlock(&blockInfo, &meshletBlock));
+}
+
+void GeometryPool::Destroy()
+{
+	// Meshes that were never freed die with the pool
+	vmaClearVirtualBlock(vertexBlock);
+	vmaClearVirtualBlock(indexBlock);
+	vmaClearVirtualBlock(meshletBlock);
+	vmaDestroyVirtualBlock(vertexBlock);
+	vmaDestroyVirtualBlock(indexBlock);
+	vmaDestroyVirtualBlock(meshletBlock);
+	vmaDestroyBuffer(allocator, positionBuffer.buffer, positionBuffer.allocation);
+	vmaDestroyBuffer(allocator, attributeBuffer.buffer, attributeBuffer.allocation);
+	vmaDestroyBuffer(allocator, indexBuffer.buffer, indexBuffer.allocation);
+	vmaDestroyBuffer(allocator, meshletBuffer.buffer, meshletBuffer.allocation);
+}
+
+bool GeometryPool::Allocate(Mesh& mesh)
+{
+	VmaVirtualAllocationCreateInfo allocInfo = {};
+	VkDeviceSize vertexOffset = 0;
+	allocInfo.size = mesh.vertices.size();
+	if (vmaVirtualAllocate(vertexBlock, &allocInfo, &vertexOffset) != VK_SUCCESS)
+		return false;
+
+	VkDeviceSize firstIndex = 0;
+	allocInfo.size = mesh.indices.size();
+	if (vmaVirtualAllocate(indexBlock, &allocInfo, &firstIndex) != VK_SUCCESS)
+	{
+		vmaVirtualFree(vertexBlock, vertexOffset);
+		return false;
+	}
+
+	VkDeviceSize firstMeshlet = 0;
+	allocInfo.size = std::max<VkDeviceSize>(mesh.meshlets.size(), 1);
+	if (vmaVirtualAllocate(meshletBlock, &allocInfo, &firstMeshlet) != VK_SUCCESS)
+	{
+		vmaVirtualFree(vertexBlock, vertexOffset);
+		vmaVirtualFree(indexBlock, firstIndex);
+		return false;
+	}
+
+	mesh.vertexOffset = (uint32_t)vertexOffset;
+	mesh.firstIndex = (uint32_t)firstIndex;
+	mesh.firstMeshlet = (uint32_t)firstMeshlet;
+	return true;
+}
+
+// The GPU may still read the ranges, callers go through deletionQueue.Retire
+void GeometryPool::Free(const Mesh& mesh)
+{
+	vmaVirtualFree(vertexBlock, mesh.vertexOffset);
+	vmaVirtualFree(indexBlock, mesh.firstIndex);
+	vmaVirtualFree(meshletBlock, mesh.firstMeshlet);
+}
+
+void GeometryPool::Bind(VkCommandBuffer cmd) const
+{
+	VkBuffer buffers[] = { positionBuffer.buffer, attributeBuffer.buffer };
+	VkDeviceSize offsets[] = { 0, 0 };
+	vkCmdBindVertexBuffers(cmd, 0, 2, buffers, offsets);
+	vkCmdBindIndexBuffer(cmd, indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
+}
+
+void GeometryPool::BindPositions(VkCommandBuffer cmd) const
+{
+	VkDeviceSize offset = 0;
+	vkCmdBindVertexBuffers(cmd, 0, 1, &positionBuffer.buffer, &offset);
+	vkCmdBindIndexBuffer(cmd, indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
+}
+
+void UploadMesh(Mesh& mesh)
+{
+	// Bounding sphere around the center of the vertices' box, used for culling
+	glm::vec3 minPosition = glm::vec3(FLT_MAX);
+	glm::vec3 maxPosition = glm::vec3(-FLT_MAX);
+	for (const Vertex& vertex : mesh.vertices)
+	{
+		minPosition = glm::min(minPosition, vertex.position);
+		maxPosition = glm::max(maxPosition, vertex.position);
+	}
+	glm::vec3 center = (minPosition + maxPosition) * 0.5f;
+	// Flat axes keep a non-zero scale so packing never divides by zero
+	mesh.boxMin = minPosition;
+	mesh.boxScale = glm::max(maxPosition - minPosition, glm::vec3(FLT_MIN));
+	float radius = 0.0f;
+	for (const Vertex& vertex : mesh.vertices)
+		radius = std::max(radius, glm::length(vertex.position - center));
+	mesh.bounds = glm::vec4(center, radius);
+
+	if (mesh.indices.empty())
+	{
+		mesh.indices.resize(mesh.vertices.size());
+		for (uint32_t i = 0; i < (uint32_t)mesh.indices.size(); i++)
+			mesh.indices[i] = i;
+	}
+	mesh.indexCount = (uint32_t)mesh.indices.size();
+	if (mesh.lods.empty())
+		mesh.lods.push_back({ 0, mesh.indexCount, 0.0f });
+	if (mesh.meshlets.empty())
+		BuildMeshlets(mesh);
+
+	if (!geometryPool.Allocate(mesh))
+	{
+		std::cout << "Geometry pool is full" << std::endl;
+		__debugbreak();
+	}
+
+	std::vector<PackedPosition> positions(mesh.vertices.size());
+	std::vector<PackedAttributes> attributes(mesh.vertices.size());
+	for (size_t i = 0; i < mesh.vertices.size(); i++)
+	{
+		PackedVertex packed = PackedVertex::Pack(mesh.vertices[i], mesh.boxMin, mesh.boxScale);
+		positions[i] = packed.position;
+		attributes[i] = packed.attributes;
+	}
+
+	// Meshlets carry their absolute ranges in the pool, the cull pass copies them straight into draws
+	std::vector<GPUMeshlet> meshlets(mesh.meshlets.size());
+	for (size_t i = 0; i < mesh.meshlets.size(); i++)
+	{
+		const Meshlets::Meshlet& meshlet = mesh.meshlets[i];
+		meshlets[i].sphere = meshlet.sphere;
+		meshlets[i].coneApex = glm::vec4(meshlet.coneApex, 0.0f);
+		meshlets[i].coneAxis = glm::vec4(meshlet.coneAxis, meshlet.coneCutoff);
+		meshlets[i].firstIndex = mesh.firstIndex + meshlet.indexOffset;
+		meshlets[i].indexCount = meshlet.triangleCount * 3;
+		meshlets[i].vertexOffset = mesh.vertexOffset;
+	}
+
+	// Positions, attributes, indices then meshlets in one staging buffer, copied into the pool's ranges
+	const size_t positionBytes = positions.size() * sizeof(PackedPosition);
+	const size_t attributeBytes = attributes.size() * sizeof(PackedAttributes);
+	const size_t indexBytes = mesh.indices.size() * sizeof(uint32_t);
+	const size_t meshletBytes = meshlets.size() * sizeof(GPUMeshlet);
+
+	VkBufferCreateInfo stagingBufferInfo = {};
+	stagingBufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	stagingBufferInfo.size = positionBytes + attributeBytes + indexBytes + meshletBytes;
+	stagingBufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+
+	VmaAllocationCreateInfo stagingVMAAllocInfo = {};
+	stagingVMAAllocInfo.usage = VMA_MEMORY_USAGE_CPU_ONLY;
+
+	AllocatedBuffer stagingBuffer;
+
+	vkCheck(vmaCreateBuffer(allocator, &stagingBufferInfo, &stagingVMAAllocInfo,
+							&stagingBuffer.buffer, &stagingBuffer.allocation, nullptr));
+
+	char* data;
+	vmaMapMemory(allocator, stagingBuffer.allocation, (void**)&data);
+	memcpy(data, positions.data(), positionBytes);
+	memcpy(data + positionBytes, attributes.data(), attributeBytes);
+	memcpy(data + positionBytes + attributeBytes, mesh.indices.data(), indexBytes);
+	memcpy(data + positionBytes + attributeBytes + indexBytes, meshlets.data(), meshletBytes);
+	vmaUnmapMemory(allocator, stagingBuffer.allocation);
+
+	immediate_submit([&](VkCommandBuffer cmd) {
+		VkBufferCopy positionCopy;
+		positionCopy.srcOffset = 0;
+		positionCopy.dstOffset = VkDeviceSize(mesh.vertexOffset) * sizeof(PackedPosition);
+		positionCopy.size = positionBytes;
+		vkCmdCopyBuffer(cmd, stagingBuffer.buffer, geometryPool.positionBuffer.buffer, 1, &positionCopy);
+
+		VkBufferCopy attributeCopy;
+		attributeCopy.srcOffset = positionBytes;
+		attributeCopy.dstOffset = VkDeviceSize(mesh.vertexOffset) * sizeof(PackedAttributes);
+		attributeCopy.size = attributeBytes;
+		vkCmdCopyBuffer(cmd, stagingBuffer.buffer, geometryPool.attributeBuffer.buffer, 1, &attributeCopy);
+
+		VkBufferCopy indexCopy;
+		indexCopy.srcOffset = positionBytes + attributeBytes;
+		indexCopy.dstOffset = VkDeviceSize(mesh.firstIndex) * sizeof(uint32_t);
+		indexCopy.size = indexBytes;
+		vkCmdCopyBuffer(cmd, stagingBuffer.buffer, geometryPool.indexBuffer.buffer, 1, &indexCopy);
+
+		VkBufferCopy meshletCopy;
+		meshletCopy.srcOffset = positionBytes + attributeBytes + indexBytes;
+		meshletCopy.dstOffset = VkDeviceSize(mesh.firstMeshlet) * sizeof(GPUMeshlet);
+		meshletCopy.size = meshletBytes;
+		vkCmdCopyBuffer(cmd, stagingBuffer.buffer, geometryPool.meshletBuffer.buffer, 1, &meshletCopy);
+	});
+
+	vmaDestroyBuffer(allocator, stagingBuffer.buffer, stagingBuffer.allocation);
+}
+
 void LoadImages()
 {
 	/*Texture lostEmpire;
@@ -708,27 +1671,271 @@ VkWriteDescriptorSet WriteDescriptorImage(VkDescriptorType type, VkDescriptorSet
 	return write;
 }
 
-void CreatePipeline()
+// Writes the texture into the next free slot of the bindless texture array and returns its index
+uint32_t RegisterBindlessTexture(VkImageView imageView, VkSampler sampler)
 {
-	// Init pipeline
-	vertexShaderModule = CompileShader("src/shaders/triangle.vert.glsl", shaderc_vertex_shader, "main", "vertex shader");
-	fragmentShaderModule = CompileShader("src/shaders/triangle.frag.glsl", shaderc_fragment_shader, "main", "fragment shader");
+	assert(bindlessTextureCount < MAX_BINDLESS_TEXTURES);
+	uint32_t index = bindlessTextureCount++;
 
-	VkPipelineShaderStageCreateInfo vertexShaderStageInfo = {};
-	vertexShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-	vertexShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-	vertexShaderStageInfo.module = vertexShaderModule;
-	vertexShaderStageInfo.pName = "main";
-	shaderStages[0] = vertexShaderStageInfo;
+	VkDescriptorImageInfo imageInfo;
+	imageInfo.sampler = sampler;
+	imageInfo.imageView = imageView;
+	imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 
-	VkPipelineShaderStageCreateInfo fragmentShaderStageInfo = {};
-	fragmentShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-	fragmentShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-	fragmentShaderStageInfo.module = fragmentShaderModule;
-	fragmentShaderStageInfo.pName = "main";
-	shaderStages[1] = fragmentShaderStageInfo;
+	VkWriteDescriptorSet write = WriteDescriptorImage(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, bindlessSet, &imageInfo, 0);
+	write.dstArrayElement = index;
+	vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+
+	return index;
+}
+
+// Appends a material to the bindless material table and returns the index the objects should reference
+uint32_t RegisterMaterial(const GPUMaterialData& materialData)
+{
+	assert(materialCount < MAX_MATERIALS);
+	uint32_t index = materialCount++;
+
+	char* tableData;
+	vmaMapMemory(allocator, materialTableBuffer.allocation, (void**)&tableData);
+	memcpy(tableData + index * sizeof(GPUMaterialData), &materialData, sizeof(GPUMaterialData));
+	vmaUnmapMemory(allocator, materialTableBuffer.allocation);
+
+	return index;
+}
+
+VkDescriptorPool CreateDescriptorPool(uint32_t maxSets, VkDescriptorPoolCreateFlags flags = 0)
+{
+	// Descriptor counts per set, scaled by the amount of sets the pool holds
+	std::pair<VkDescriptorType, float> poolSizeRatios[] = {
+		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2.0f },
+		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 2.0f },
+		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2.0f },
+		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 1.0f },
+		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 4.0f },
+		{ VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, 1.0f },
+		{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1.0f }
+	};
+
+	std::vector<VkDescriptorPoolSize> sizes;
+	for (auto& ratio : poolSizeRatios)
+		sizes.push_back({ ratio.first, uint32_t(ratio.second * maxSets) });
+
+	VkDescriptorPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.flags = flags;
+	poolInfo.maxSets = maxSets;
+	poolInfo.poolSizeCount = sizes.size();
+	poolInfo.pPoolSizes = sizes.data();
+
+	VkDescriptorPool pool;
+	vkCheck(vkCreateDescriptorPool(device, &poolInfo, nullptr, &pool));
+
+	return pool;
+}
+
+VkDescriptorPool DescriptorAllocator::GrabPool()
+{
+	if (!freePools.empty())
+	{
+		VkDescriptorPool pool = freePools.back();
+		freePools.pop_back();
+		return pool;
+	}
+
+	return CreateDescriptorPool(setsPerPool);
+}
+
+bool DescriptorAllocator::Allocate(VkDescriptorSetLayout layout, VkDescriptorSet* set)
+{
+	if (currentPool == VK_NULL_HANDLE)
+	{
+		currentPool = GrabPool();
+		usedPools.push_back(currentPool);
+	}
+
+	VkDescriptorSetAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = currentPool;
+	allocInfo.descriptorSetCount = 1;
+	allocInfo.pSetLayouts = &layout;
+
+	VkResult result = vkAllocateDescriptorSets(device, &allocInfo, set);
+	if (result == VK_SUCCESS)
+		return true;
+
+	if (result != VK_ERROR_OUT_OF_POOL_MEMORY && result != VK_ERROR_FRAGMENTED_POOL)
+		return false;
+
+	// The current pool is full, chain a new one and try again
+	currentPool = GrabPool();
+	usedPools.push_back(currentPool);
+	allocInfo.descriptorPool = currentPool;
+
+	return vkAllocateDescriptorSets(device, &allocInfo, set) == VK_SUCCESS;
+}
+
+void DescriptorAllocator::ResetPools()
+{
+	for (VkDescriptorPool pool : usedPools)
+	{
+		vkResetDescriptorPool(device, pool, 0);
+		freePools.push_back(pool);
+	}
+
+	usedPools.clear();
+	currentPool = VK_NULL_HANDLE;
+}
+
+void DescriptorAllocator::Cleanup()
+{
+	for (VkDescriptorPool pool : freePools)
+		vkDestroyDescriptorPool(device, pool, nullptr);
+	for (VkDescriptorPool pool : usedPools)
+		vkDestroyDescriptorPool(device, pool, nullptr);
+
+	freePools.clear();
+	usedPools.clear();
+	currentPool = VK_NULL_HANDLE;
+}
+
+template <typename T>
+void HashCombine(size_t& seed, const T& value)
+{
+	seed ^= std::hash<T>()(value) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+}
+
+bool operator==(const DescriptorWrite& a, const DescriptorWrite& b)
+{
+	return a.binding == b.binding && a.type == b.type
+		&& a.bufferInfo.buffer == b.bufferInfo.buffer && a.bufferInfo.offset == b.bufferInfo.offset && a.bufferInfo.range == b.bufferInfo.range
+		&& a.imageInfo.sampler == b.imageInfo.sampler && a.imageInfo.imageView == b.imageInfo.imageView && a.imageInfo.imageLayout == b.imageInfo.imageLayout;
+}
+
+DescriptorWrite BufferWrite(uint32_t binding, VkDescriptorType type, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range)
+{
+	DescriptorWrite write = {};
+	write.binding = binding;
+	write.type = type;
+	write.bufferInfo = { buffer, offset, range };
+	return write;
+}
+
+DescriptorWrite ImageWrite(uint32_t binding, VkDescriptorType type, VkSampler sampler, VkImageView imageView, VkImageLayout imageLayout)
+{
+	DescriptorWrite write = {};
+	write.binding = binding;
+	write.type = type;
+	write.imageInfo = { sampler, imageView, imageLayout };
+	return write;
+}
+
+// Allocates a set from the allocator and fills it, used for both cached and transient sets
+VkDescriptorSet AllocateDescriptorSet(DescriptorAllocator& descriptorAllocator, VkDescriptorSetLayout layout, const std::vector<DescriptorWrite>& writes)
+{
+	VkDescriptorSet set = VK_NULL_HANDLE;
+	if (!descriptorAllocator.Allocate(layout, &set))
+	{
+		std::cout << "Failed to allocate descriptor set" << std::endl;
+		__debugbreak();
+	}
+
+	std::vector<VkWriteDescriptorSet> setWrites;
+	setWrites.reserve(writes.size());
+	for (const DescriptorWrite& write : writes)
+	{
+		bool isImage = write.type == VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER
+			|| write.type == VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE
+			|| write.type == VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+
+		if (isImage)
+			setWrites.push_back(WriteDescriptorImage(write.type, set, const_cast<VkDescriptorImageInfo*>(&write.imageInfo), write.binding));
+		else
+			setWrites.push_back(WriteDescriptorBuffer(write.type, set, const_cast<VkDescriptorBufferInfo*>(&write.bufferInfo), write.binding));
+	}
+	vkUpdateDescriptorSets(device, setWrites.size(), setWrites.data(), 0, nullptr);
+
+	return set;
+}
+
+VkDescriptorSet DescriptorSetCache::Get(VkDescriptorSetLayout layout, const std::vector<DescriptorWrite>& writes)
+{
+	size_t hash = 0;
+	HashCombine(hash, (uint64_t)layout);
+	for (const DescriptorWrite& write : writes)
+	{
+		HashCombine(hash, write.binding);
+		HashCombine(hash, (uint32_t)write.type);
+		HashCombine(hash, (uint64_t)write.bufferInfo.buffer);
+		HashCombine(hash, write.bufferInfo.offset);
+		HashCombine(hash, write.bufferInfo.range);
+		HashCombine(hash, (uint64_t)write.imageInfo.sampler);
+		HashCombine(hash, (uint64_t)write.imageInfo.imageView);
+		HashCombine(hash, (uint32_t)write.imageInfo.imageLayout);
+	}
+
+	auto& bucket = sets[hash];
+	for (const CachedSet& entry : bucket)
+	{
+		if (entry.layout == layout && entry.writes == writes)
+			return entry.set;
+	}
+
+	VkDescriptorSet set = AllocateDescriptorSet(allocator, layout, writes);
+	bucket.push_back({ layout, writes, set });
+	return set;
+}
 
-	VertexInputDescription vertexDescription = Vertex::GetVertexDescription();
+void DescriptorSetCache::Cleanup()
+{
+	sets.clear();
+	allocator.Cleanup();
+}
+
+VkPipeline BuildPipelineVariant(uint32_t features, DrawIndexSource drawIndexSource, ScenePipelinePass pass)
+{
+	MaterialSpecialization specializationData = {};
+	specializationData.useSpecularMap = (features & MATERIAL_FEATURE_SPECULAR_MAP) ? VK_TRUE : VK_FALSE;
+	specializationData.useEmissionMap = (features & MATERIAL_FEATURE_EMISSION_MAP) ? VK_TRUE : VK_FALSE;
+	specializationData.attenuationModel = (features & MATERIAL_FEATURE_ATTENUATION) ? 1 : 0;
+	specializationData.useFog = (features & MATERIAL_FEATURE_FOG) ? VK_TRUE : VK_FALSE;
+
+	VkSpecializationMapEntry specializationEntries[4] = {};
+	specializationEntries[0] = { 0, offsetof(MaterialSpecialization, useSpecularMap), sizeof(VkBool32) };
+	specializationEntries[1] = { 1, offsetof(MaterialSpecialization, useEmissionMap), sizeof(VkBool32) };
+	specializationEntries[2] = { 2, offsetof(MaterialSpecialization, attenuationModel), sizeof(int32_t) };
+	specializationEntries[3] = { 3, offsetof(MaterialSpecialization, useFog), sizeof(VkBool32) };
+
+	VkSpecializationInfo specializationInfo = {};
+	specializationInfo.mapEntryCount = ARRAYSIZE(specializationEntries);
+	specializationInfo.pMapEntries = specializationEntries;
+	specializationInfo.dataSize = sizeof(MaterialSpecialization);
+	specializationInfo.pData = &specializationData;
+
+	VkSpecializationMapEntry drawIndexEntry = { 10, 0, sizeof(uint32_t) };
+
+	VkSpecializationInfo vertexSpecializationInfo = {};
+	vertexSpecializationInfo.mapEntryCount = 1;
+	vertexSpecializationInfo.pMapEntries = &drawIndexEntry;
+	vertexSpecializationInfo.dataSize = sizeof(uint32_t);
+	vertexSpecializationInfo.pData = &drawIndexSource;
+
+	const bool depthOnly = pass == SCENE_PASS_DEPTH_ONLY;
+	const bool gbuffer = pass == SCENE_PASS_GBUFFER || pass == SCENE_PASS_GBUFFER_PREPASS;
+	const bool onPrepass = pass == SCENE_PASS_COLOR_PREPASS || pass == SCENE_PASS_GBUFFER_PREPASS;
+	std::vector<VkPipelineShaderStageCreateInfo> stages = shaderStages;
+	stages[0].pSpecializationInfo = &vertexSpecializationInfo;
+	stages[1].pSpecializationInfo = &specializationInfo;
+	if (depthOnly)
+	{
+		stages.resize(1);
+		stages[0].module = depthVertexShaderModule;
+	}
+	else if (gbuffer)
+	{
+		stages[1].module = gbufferFragmentShaderModule;
+	}
+
+	VertexInputDescription vertexDescription = depthOnly ? PackedVertex::GetPositionDescription() : PackedVertex::GetVertexDescription();
 	VkPipelineVertexInputStateCreateInfo vertexInputStateInfo = {};
 	vertexInputStateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
 	vertexInputStateInfo.vertexAttributeDescriptionCount = vertexDescription.attributes.size();
@@ -753,65 +1960,57 @@ void CreatePipeline()
 	multisamplingStateInfo.minSampleShading = 1.0f;
 	multisamplingStateInfo.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
 
-	VkPipelineColorBlendAttachmentState colorBlendAttachmentState = {};
-	colorBlendAttachmentState.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
-		VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-	colorBlendAttachmentState.blendEnable = false;
+	VkPipelineColorBlendAttachmentState colorBlendAttachmentStates[GBUFFER_TARGET_COUNT] = {};
+	for (VkPipelineColorBlendAttachmentState& colorBlendAttachmentState : colorBlendAttachmentStates)
+	{
+		colorBlendAttachmentState.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+			VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+		colorBlendAttachmentState.blendEnable = false;
+	}
+	const uint32_t colorAttachmentCount = depthOnly ? 0 : gbuffer ? GBUFFER_TARGET_COUNT : 1;
 
 	VkPipelineColorBlendStateCreateInfo colorBlendStateInfo = {};
 	colorBlendStateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
 	colorBlendStateInfo.logicOpEnable = false;
 	colorBlendStateInfo.logicOp = VK_LOGIC_OP_COPY;
-	colorBlendStateInfo.attachmentCount = 1;
-	colorBlendStateInfo.pAttachments = &colorBlendAttachmentState;
+	colorBlendStateInfo.attachmentCount = colorAttachmentCount;
+	colorBlendStateInfo.pAttachments = colorBlendAttachmentStates;
 
 	VkPipelineDepthStencilStateCreateInfo depthStencilStateInfo = {};
 	depthStencilStateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
 	depthStencilStateInfo.depthTestEnable = true;
-	depthStencilStateInfo.depthWriteEnable = true;
+	depthStencilStateInfo.depthWriteEnable = !onPrepass;
 	depthStencilStateInfo.depthBoundsTestEnable = false;
-	depthStencilStateInfo.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+	depthStencilStateInfo.depthCompareOp = onPrepass ? VK_COMPARE_OP_EQUAL : VK_COMPARE_OP_LESS_OR_EQUAL;
 	depthStencilStateInfo.minDepthBounds = 0.0f;
 	depthStencilStateInfo.maxDepthBounds = 1.0f;
 	depthStencilStateInfo.stencilTestEnable = false;
 
-	viewport.width = width;
-	viewport.height = height;
-	viewport.minDepth = 0.0f;
-	viewport.maxDepth = 1.0f;
-	viewport.x = 0.0f;
-	viewport.y = 0.0f;
-
-	scissor.extent = { width, height };
-	scissor.offset = { 0,0 };
-
+	// Viewport and scissor are dynamic so the pipelines survive a swapchain resize
 	VkPipelineViewportStateCreateInfo viewportStateInfo = {};
 	viewportStateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
 	viewportStateInfo.scissorCount = 1;
-	viewportStateInfo.pScissors = &scissor;
 	viewportStateInfo.viewportCount = 1;
-	viewportStateInfo.pViewports = &viewport;
 
-	VkPushConstantRange meshConstantRange;
-	meshConstantRange.size = sizeof(MeshPushConstants);
-	meshConstantRange.offset = 0;
-	meshConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	VkDynamicState dynamicStates[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
 
-	VkDescriptorSetLayout layouts[] = { globalSetLayout, objectSetLayout, singleTextureSetLayout, sceneSetLayout };
-	VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
-	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-	pipelineLayoutInfo.pushConstantRangeCount = 0;
-	pipelineLayoutInfo.pPushConstantRanges = nullptr;
-	pipelineLayoutInfo.setLayoutCount = ARRAYSIZE(layouts);
-	pipelineLayoutInfo.pSetLayouts = layouts;
+	VkPipelineDynamicStateCreateInfo dynamicStateInfo = {};
+	dynamicStateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+	dynamicStateInfo.dynamicStateCount = ARRAYSIZE(dynamicStates);
+	dynamicStateInfo.pDynamicStates = dynamicStates;
 
-	vkCheck(vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout));
+	// Dynamic rendering: the pipeline only knows the attachment formats, it works with any attachments of those formats
+	VkPipelineRenderingCreateInfo renderingInfo = {};
+	renderingInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO;
+	renderingInfo.colorAttachmentCount = colorAttachmentCount;
+	renderingInfo.pColorAttachmentFormats = gbuffer ? gbufferFormats : &swapchainImageFormat;
+	renderingInfo.depthAttachmentFormat = depthFormat;
 
 	VkGraphicsPipelineCreateInfo pipelineInfo = {};
 	pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-	pipelineInfo.pNext = nullptr;
-	pipelineInfo.stageCount = shaderStages.size();
-	pipelineInfo.pStages = shaderStages.data();
+	pipelineInfo.pNext = &renderingInfo;
+	pipelineInfo.stageCount = stages.size();
+	pipelineInfo.pStages = stages.data();
 	pipelineInfo.pVertexInputState = &vertexInputStateInfo;
 	pipelineInfo.pInputAssemblyState = &inputAssemblyInfo;
 	pipelineInfo.pViewportState = &viewportStateInfo;
@@ -819,11 +2018,309 @@ void CreatePipeline()
 	pipelineInfo.pMultisampleState = &multisamplingStateInfo;
 	pipelineInfo.pColorBlendState = &colorBlendStateInfo;
 	pipelineInfo.pDepthStencilState = &depthStencilStateInfo;
+	pipelineInfo.pDynamicState = &dynamicStateInfo;
 	pipelineInfo.layout = pipelineLayout;
-	pipelineInfo.renderPass = renderPass;
-	pipelineInfo.subpass = 0;
+	pipelineInfo.renderPass = VK_NULL_HANDLE;
+
+	VkPipeline pipeline = VK_NULL_HANDLE;
+	vkCheck(vkCreateGraphicsPipelines(device, nullptr, 1, &pipelineInfo, nullptr, &pipeline));
+
+	return pipeline;
+}
+
+// Returns the pipeline for a material feature combination, building it the first time it is used
+VkPipeline GetPipelineVariant(uint32_t features, DrawIndexSource drawIndexSource = DRAW_INDEX_PUSH_CONSTANT, ScenePipelinePass pass = SCENE_PASS_COLOR)
+{
+	// Material features do not matter without a fragment shader, depth only variants share one key
+	if (pass == SCENE_PASS_DEPTH_ONLY)
+		features = 0;
+	// The G-buffer shader only reads the specular map, the lighting pass handles attenuation and fog
+	if (pass == SCENE_PASS_GBUFFER || pass == SCENE_PASS_GBUFFER_PREPASS)
+		features &= MATERIAL_FEATURE_SPECULAR_MAP;
+	uint32_t key = features | (drawIndexSource << 16) | (pass << 20);
+	auto it = pipelineVariants.find(key);
+	if (it != pipelineVariants.end())
+		return it->second;
+
+	VkPipeline pipeline = BuildPipelineVariant(features, drawIndexSource, pass);
+	pipelineVariants[key] = pipeline;
+	return pipeline;
+}
+
+// Picks the requested present mode or the closest supported one, FIFO is always available
+// Uncapped modes fall back to each other before giving up on tearing-free/low-latency and using FIFO
+VkPresentModeKHR ChoosePresentMode(VkPresentModeKHR requested)
+{
+	uint32_t modeCount = 0;
+	vkGetPhysicalDeviceSurfacePresentModesKHR(chosenGPU, surface, &modeCount, nullptr);
+	std::vector<VkPresentModeKHR> supported(modeCount);
+	vkGetPhysicalDeviceSurfacePresentModesKHR(chosenGPU, surface, &modeCount, supported.data());
+
+	std::vector<VkPresentModeKHR> candidates = { requested };
+	if (requested == VK_PRESENT_MODE_MAILBOX_KHR)
+		candidates.push_back(VK_PRESENT_MODE_IMMEDIATE_KHR);
+	else if (requested == VK_PRESENT_MODE_IMMEDIATE_KHR)
+		candidates.push_back(VK_PRESENT_MODE_MAILBOX_KHR);
+
+	for (VkPresentModeKHR candidate : candidates)
+	{
+		if (std::find(supported.begin(), supported.end(), candidate) != supported.end())
+			return candidate;
+	}
+	return VK_PRESENT_MODE_FIFO_KHR;
+}
+
+// Creates the swapchain for the current framebuffer size along with its image views
+void CreateSwapchain(GLFWwindow* window, VkSwapchainKHR oldSwapchain)
+{
+	int framebufferWidth, framebufferHeight;
+	glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+
+	framePacing.presentMode = ChoosePresentMode(framePacing.requestedPresentMode);
+	if (framePacing.presentMode != framePacing.requestedPresentMode)
+		std::cout << PresentModeName(framePacing.requestedPresentMode) << " is not supported, presenting with " << PresentModeName(framePacing.presentMode) << std::endl;
+
+	vkb::SwapchainBuilder swapchainBuilder{ chosenGPU, device, surface, graphicsQueueFamily, graphicsQueueFamily };
+	vkb::Swapchain vkbSwapchain = swapchainBuilder.use_default_format_selection()
+		.set_desired_present_mode(framePacing.presentMode)
+		.set_desired_extent(framebufferWidth, framebufferHeight)
+		.add_image_usage_flags(VK_IMAGE_USAGE_TRANSFER_DST_BIT) // the deferred path blits its lit image
+		.set_old_swapchain(oldSwapchain)
+		.build()
+		.value();
+
+	swapchain = vkbSwapchain.swapchain;
+	swapchainImages = vkbSwapchain.get_images().value();
+	swapchainImageViews = vkbSwapchain.get_image_views().value();
+	swapchainImageFormat = vkbSwapchain.image_format;
+	swapchainExtent = vkbSwapchain.extent;
+}
+
+void CreateFramebuffers()
+{
+	VkFramebufferCreateInfo framebufferInfo = {};
+	framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+	framebufferInfo.width = swapchainExtent.width;
+	framebufferInfo.height = swapchainExtent.height;
+	framebufferInfo.renderPass = overlayRenderPass;
+	framebufferInfo.layers = 1;
+
+	const uint32_t swapchainImageCount = swapchainImages.size();
+	framebuffers.resize(swapchainImageCount);
+
+	for (int i = 0; i < swapchainImageCount; i++)
+	{
+		framebufferInfo.attachmentCount = 1;
+		framebufferInfo.pAttachments = &swapchainImageViews[i];
+		vkCheck(vkCreateFramebuffer(device, &framebufferInfo, nullptr, &framebuffers[i]));
+	}
+}
+
+// Takes copies of the handles so retired resources can be destroyed after the globals point to their replacements
+void DestroySwapchainResources(VkSwapchainKHR oldSwapchain, std::vector<VkImageView> imageViews, std::vector<VkFramebuffer> oldFramebuffers)
+{
+	for (VkFramebuffer framebuffer : oldFramebuffers)
+		vkDestroyFramebuffer(device, framebuffer, nullptr);
+	for (VkImageView imageView : imageViews)
+		vkDestroyImageView(device, imageView, nullptr);
+	vkDestroySwapchainKHR(device, oldSwapchain, nullptr);
+}
+
+// Sized for the current swapchain, starts out cleared to the far plane and in GENERAL like after a build
+void CreateDepthPyramid()
+{
+	auto previousPowerOfTwo = [](uint32_t value)
+	{
+		uint32_t result = 1;
+		while (result * 2 <= value)
+			result *= 2;
+		return result;
+	};
+
+	depthPyramid.extent = { previousPowerOfTwo(swapchainExtent.width), previousPowerOfTwo(swapchainExtent.height) };
+	depthPyramid.levelCount = 1;
+	while ((std::max(depthPyramid.extent.width, depthPyramid.extent.height) >> depthPyramid.levelCount) > 0 && depthPyramid.levelCount < MAX_PYRAMID_LEVELS)
+		depthPyramid.levelCount++;
+	depthPyramid.builtFrame = UINT32_MAX;
+
+	VkImageCreateInfo imageInfo = ImageCreateInfo(VK_FORMAT_R32_SFLOAT,
+												  VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+												  { depthPyramid.extent.width, depthPyramid.extent.height, 1 });
+	imageInfo.mipLevels = depthPyramid.levelCount;
+
+	VmaAllocationCreateInfo allocInfo = {};
+	allocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+	vkCheck(vmaCreateImage(allocator, &imageInfo, &allocInfo, &depthPyramid.image.image, &depthPyramid.image.allocation, nullptr));
+
+	VkImageViewCreateInfo viewInfo = ImageViewCreateInfo(VK_FORMAT_R32_SFLOAT, depthPyramid.image.image, VK_IMAGE_ASPECT_COLOR_BIT);
+	viewInfo.subresourceRange.levelCount = depthPyramid.levelCount;
+	vkCheck(vkCreateImageView(device, &viewInfo, nullptr, &depthPyramid.view));
+	viewInfo.subresourceRange.levelCount = 1;
+	for (uint32_t i = 0; i < depthPyramid.levelCount; i++)
+	{
+		viewInfo.subresourceRange.baseMipLevel = i;
+		vkCheck(vkCreateImageView(device, &viewInfo, nullptr, &depthPyramid.levels[i]));
+	}
+
+	immediate_submit([&](VkCommandBuffer cmd)
+	{
+		VkImageMemoryBarrier2 barrier = ImageBarrier2(depthPyramid.image.image, VK_IMAGE_ASPECT_COLOR_BIT,
+													  VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,
+													  VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE,
+													  VK_PIPELINE_STAGE_2_CLEAR_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT);
+		barrier.subresourceRange.levelCount = depthPyramid.levelCount;
+		PipelineBarrier2(cmd, 1, &barrier);
+
+		VkClearColorValue farPlane = { { 1.0f, 0.0f, 0.0f, 0.0f } };
+		vkCmdClearColorImage(cmd, depthPyramid.image.image, VK_IMAGE_LAYOUT_GENERAL, &farPlane, 1, &barrier.subresourceRange);
+
+		// Frames import the pyramid as last written by compute, chain the clear into that stage
+		barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+		barrier.srcStageMask = VK_PIPELINE_STAGE_2_CLEAR_BIT;
+		barrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+		barrier.dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+		barrier.dstAccessMask = VK_ACCESS_2_SHADER_READ_BIT | VK_ACCESS_2_SHADER_WRITE_BIT;
+		PipelineBarrier2(cmd, 1, &barrier);
+	});
+}
+
+// Takes a copy so a retired pyramid can be destroyed after the global points to its replacement
+void DestroyDepthPyramid(DepthPyramid pyramid)
+{
+	for (uint32_t i = 0; i < pyramid.levelCount; i++)
+		vkDestroyImageView(device, pyramid.levels[i], nullptr);
+	vkDestroyImageView(device, pyramid.view, nullptr);
+	vmaDestroyImage(allocator, pyramid.image.image, pyramid.image.allocation);
+}
+
+// Replaces the swapchain and framebuffers without waiting for the device: the old ones are retired and
+// destroyed once the timeline semaphore shows every frame that rendered to them completed.
+// Returns false while the window is minimized, the swapchain stays out of date until it has a size again.
+bool RecreateSwapchain(GLFWwindow* window)
+{
+	int framebufferWidth, framebufferHeight;
+	glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+	if (framebufferWidth == 0 || framebufferHeight == 0)
+		return false;
+
+	VkSwapchainKHR oldSwapchain = swapchain;
+	std::vector<VkImageView> oldImageViews = swapchainImageViews;
+	std::vector<VkFramebuffer> oldFramebuffers = framebuffers;
+
+	// The old swapchain is passed along so the presentation engine can hand its images over
+	CreateSwapchain(window, oldSwapchain);
+	CreateFramebuffers();
+
+	deletionQueue.Retire([=]
+	{
+		DestroySwapchainResources(oldSwapchain, oldImageViews, oldFramebuffers);
+	});
+
+	// The depth pyramid follows the swapchain size
+	DepthPyramid oldPyramid = depthPyramid;
+	deletionQueue.Retire([=] { DestroyDepthPyramid(oldPyramid); });
+	CreateDepthPyramid();
+
+	swapchainOutOfDate = false;
+	return true;
+}
+
+// Compiles a compute shader into a pipeline, the module is only needed while the pipeline is created
+VkPipeline CreateComputePipeline(const char* file, const char* shaderName, VkPipelineLayout layout)
+{
+	VkShaderModule module = CompileShader(file, shaderc_compute_shader, "main", shaderName);
+
+	VkComputePipelineCreateInfo pipelineInfo = {};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipelineInfo.stage.module = module;
+	pipelineInfo.stage.pName = "main";
+	pipelineInfo.layout = layout;
+
+	VkPipeline pipeline = VK_NULL_HANDLE;
+	vkCheck(vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline));
+	vkDestroyShaderModule(device, module, nullptr);
+	return pipeline;
+}
+
+void CreatePipeline()
+{
+	// On reload the previous pipelines may still be used by frames in flight, retire them instead of leaking them
+	if (pipelineLayout != VK_NULL_HANDLE)
+	{
+		std::vector<VkPipeline> oldPipelines;
+		for (auto& variant : pipelineVariants)
+			oldPipelines.push_back(variant.second);
+		VkPipelineLayout oldLayout = pipelineLayout;
+		VkShaderModule oldVertexShader = vertexShaderModule;
+		VkShaderModule oldFragmentShader = fragmentShaderModule;
+		VkShaderModule oldDepthVertexShader = depthVertexShaderModule;
+		VkShaderModule oldGBufferFragmentShader = gbufferFragmentShaderModule;
+		oldPipelines.push_back(meshletCullPipeline);
+		oldPipelines.push_back(depthPyramidPipeline);
+		oldPipelines.push_back(lightCullPipeline);
+		oldPipelines.push_back(deferredLightingPipeline);
+		deletionQueue.Retire([=]
+		{
+			for (VkPipeline pipeline : oldPipelines)
+				vkDestroyPipeline(device, pipeline, nullptr);
+			vkDestroyPipelineLayout(device, oldLayout, nullptr);
+			vkDestroyShaderModule(device, oldVertexShader, nullptr);
+			vkDestroyShaderModule(device, oldFragmentShader, nullptr);
+			vkDestroyShaderModule(device, oldDepthVertexShader, nullptr);
+			vkDestroyShaderModule(device, oldGBufferFragmentShader, nullptr);
+		});
+	}
+
+	// Init pipeline
+	std::vector<std::string> defines;
+	if (useBindless)
+		defines.push_back("BINDLESS");
+
+	vertexShaderModule = CompileShader("src/shaders/triangle.vert.glsl", shaderc_vertex_shader, "main", "vertex shader", defines);
+	fragmentShaderModule = CompileShader("src/shaders/triangle.frag.glsl", shaderc_fragment_shader, "main", "fragment shader", defines);
+	depthVertexShaderModule = CompileShader("src/shaders/depth.vert.glsl", shaderc_vertex_shader, "main", "depth vertex shader", defines);
+	gbufferFragmentShaderModule = CompileShader("src/shaders/gbuffer.frag.glsl", shaderc_fragment_shader, "main", "g-buffer fragment shader", defines);
+
+	VkPipelineShaderStageCreateInfo vertexShaderStageInfo = {};
+	vertexShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	vertexShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
+	vertexShaderStageInfo.module = vertexShaderModule;
+	vertexShaderStageInfo.pName = "main";
+	shaderStages[0] = vertexShaderStageInfo;
+
+	VkPipelineShaderStageCreateInfo fragmentShaderStageInfo = {};
+	fragmentShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	fragmentShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+	fragmentShaderStageInfo.module = fragmentShaderModule;
+	fragmentShaderStageInfo.pName = "main";
+	shaderStages[1] = fragmentShaderStageInfo;
+
+	VkPushConstantRange meshConstantRange;
+	meshConstantRange.size = sizeof(MeshPushConstants);
+	meshConstantRange.offset = 0;
+	meshConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+
+	VkDescriptorSetLayout textureSetLayout = useBindless ? bindlessSetLayout : singleTextureSetLayout;
+	VkDescriptorSetLayout layouts[] = { globalSetLayout, objectSetLayout, textureSetLayout, sceneSetLayout };
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &meshConstantRange;
+	pipelineLayoutInfo.setLayoutCount = ARRAYSIZE(layouts);
+	pipelineLayoutInfo.pSetLayouts = layouts;
+
+	vkCheck(vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout));
+
+	// Variants are built against the new shader modules, build the ones that are currently in use upfront
+	pipelineVariants.clear();
+	GetPipelineVariant(materialFeatures);
 
-	vkCheck(vkCreateGraphicsPipelines(device, nullptr, 1, &pipelineInfo, nullptr, &graphicsPipeline));
+	meshletCullPipeline = CreateComputePipeline("src/shaders/meshlet_cull.comp.glsl", "meshlet cull shader", meshletCullPipelineLayout);
+	depthPyramidPipeline = CreateComputePipeline("src/shaders/depth_pyramid.comp.glsl", "depth pyramid shader", depthPyramidPipelineLayout);
+	lightCullPipeline = CreateComputePipeline("src/shaders/light_cull.comp.glsl", "light cull shader", lightCullPipelineLayout);
+	deferredLightingPipeline = CreateComputePipeline("src/shaders/deferred_lighting.comp.glsl", "deferred lighting shader", deferredLightingPipelineLayout);
 }
 
 size_t pad_uniform_buffer_size(size_t originalSize)
@@ -860,14 +2357,72 @@ void Init(GLFWwindow* window)
 	glfwCreateWindowSurface(instance, window, nullptr, &surface);
 
 	vkb::PhysicalDeviceSelector selector{ vkbInstance };
-	vkb::PhysicalDevice physicalDevice = selector.set_minimum_version(1, 2).set_surface(surface).select().value();
+	vkb::PhysicalDevice physicalDevice = selector.set_minimum_version(1, 3)
+		.set_surface(surface)
+		.add_desired_extension(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME)
+		.select()
+		.value();
+
+	// Desired extensions are enabled when present, check whether this one was
+	uint32_t extensionCount = 0;
+	vkEnumerateDeviceExtensionProperties(physicalDevice.physical_device, nullptr, &extensionCount, nullptr);
+	std::vector<VkExtensionProperties> extensions(extensionCount);
+	vkEnumerateDeviceExtensionProperties(physicalDevice.physical_device, nullptr, &extensionCount, extensions.data());
+	for (const VkExtensionProperties& extension : extensions)
+		useMemoryBudget = useMemoryBudget || strcmp(extension.extensionName, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) == 0;
 
 	VkPhysicalDeviceVulkan11Features physicalDeviceVulkan11Features = {};
 	physicalDeviceVulkan11Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES;
 	physicalDeviceVulkan11Features.shaderDrawParameters = true;
 
+	// Descriptor indexing is needed for the bindless texture array
+	VkPhysicalDeviceVulkan12Features supportedVulkan12Features = {};
+	supportedVulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+	VkPhysicalDeviceFeatures2 supportedFeatures = {};
+	supportedFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+	supportedFeatures.pNext = &supportedVulkan12Features;
+	vkGetPhysicalDeviceFeatures2(physicalDevice.physical_device, &supportedFeatures);
+
+	useBindless = supportedVulkan12Features.descriptorIndexing
+		&& supportedVulkan12Features.runtimeDescriptorArray
+		&& supportedVulkan12Features.descriptorBindingPartiallyBound
+		&& supportedVulkan12Features.descriptorBindingSampledImageUpdateAfterBind
+		&& supportedVulkan12Features.shaderSampledImageArrayNonUniformIndexing;
+
+	VkPhysicalDeviceVulkan12Features physicalDeviceVulkan12Features = {};
+	physicalDeviceVulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+	physicalDeviceVulkan12Features.descriptorIndexing = useBindless;
+	physicalDeviceVulkan12Features.runtimeDescriptorArray = useBindless;
+	physicalDeviceVulkan12Features.descriptorBindingPartiallyBound = useBindless;
+	physicalDeviceVulkan12Features.descriptorBindingSampledImageUpdateAfterBind = useBindless;
+	physicalDeviceVulkan12Features.shaderSampledImageArrayNonUniformIndexing = useBindless;
+	physicalDeviceVulkan12Features.timelineSemaphore = VK_TRUE; // core in Vulkan 1.2, always supported
+
+	// Cluster culling draws every surviving meshlet from one indirect buffer with a GPU written count
+	clusterCullingSupported = supportedVulkan12Features.drawIndirectCount
+		&& supportedFeatures.features.multiDrawIndirect
+		&& supportedFeatures.features.drawIndirectFirstInstance;
+	physicalDeviceVulkan12Features.drawIndirectCount = clusterCullingSupported;
+	physicalDevice.features.multiDrawIndirect = clusterCullingSupported;
+	physicalDevice.features.drawIndirectFirstInstance = clusterCullingSupported;
+	clusterCulling = clusterCulling && clusterCullingSupported;
+
+	// Core in Vulkan 1.3, always supported
+	VkPhysicalDeviceVulkan13Features physicalDeviceVulkan13Features = {};
+	physicalDeviceVulkan13Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES;
+	physicalDeviceVulkan13Features.dynamicRendering = VK_TRUE;
+	physicalDeviceVulkan13Features.synchronization2 = VK_TRUE;
+
 	vkb::DeviceBuilder deviceBuilder{ physicalDevice };
-	vkb::Device vkbDevice = deviceBuilder.add_pNext(&physicalDeviceVulkan11Features).build().value();
+	vkb::Device vkbDevice = deviceBuilder.add_pNext(&physicalDeviceVulkan11Features)
+		.add_pNext(&physicalDeviceVulkan12Features)
+		.add_pNext(&physicalDeviceVulkan13Features)
+		.build()
+		.value();
+
+	std::cout << "Bindless textures: " << (useBindless ? "enabled" : "not supported") << std::endl;
+	std::cout << "Cluster culling: " << (clusterCullingSupported ? "enabled" : "not supported") << std::endl;
+	std::cout << "Memory budget: " << (useMemoryBudget ? "enabled" : "not supported") << std::endl;
 
 	device = vkbDevice.device;
 	chosenGPU = physicalDevice.physical_device;
@@ -879,53 +2434,37 @@ void Init(GLFWwindow* window)
 	vmaAllocatorInfo.physicalDevice = chosenGPU;
 	vmaAllocatorInfo.device = device;
 	vmaAllocatorInfo.instance = instance;
+	vmaAllocatorInfo.vulkanApiVersion = VK_API_VERSION_1_2; // the newest this VMA knows, budget queries need 1.1
+	if (useMemoryBudget)
+		vmaAllocatorInfo.flags |= VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT;
 
 	vkCheck(vmaCreateAllocator(&vmaAllocatorInfo, &allocator));
+	deletionQueue.Push([] { vmaDestroyAllocator(allocator); });
+
+	// Transient images replaced on resize may still be in use by frames in flight
+	renderGraph.Init(device, allocator, [](std::function<void()>&& destroy) { deletionQueue.Retire(std::move(destroy)); });
+	deletionQueue.Push([] { renderGraph.Destroy(); });
 
 	vkGetPhysicalDeviceProperties(chosenGPU, &gpuProperties);
 	std::cout << "The GPU has a minimum buffer alignment of " << gpuProperties.limits.minUniformBufferOffsetAlignment << std::endl;
 
 	// Init swapchain
-	vkb::SwapchainBuilder swapchainBuilder{ physicalDevice, device, surface };
-	vkb::Swapchain vkbSwapchain = swapchainBuilder.use_default_format_selection()
-		.set_desired_present_mode(VK_PRESENT_MODE_FIFO_KHR)
-		.set_desired_extent(width, height)
-		.build()
-		.value();
-
-	swapchain = vkbSwapchain.swapchain;
-	swapchainImages = vkbSwapchain.get_images().value();
-	swapchainImageViews = vkbSwapchain.get_image_views().value();
-	swapchainImageFormat = vkbSwapchain.image_format;
-
-	VkExtent3D depthImageExtent = {
-		width,
-		height,
-		1
-	};
-
 	depthFormat = VK_FORMAT_D32_SFLOAT;
-
-	VkImageCreateInfo depthImageInfo = ImageCreateInfo(depthFormat, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, depthImageExtent);
-
-	VmaAllocationCreateInfo depthImageAllocInfo = {};
-	depthImageAllocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
-	depthImageAllocInfo.requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
-
-	vmaCreateImage(allocator, &depthImageInfo, &depthImageAllocInfo, &depthImage.image, &depthImage.allocation, nullptr);
-
-	VkImageViewCreateInfo depthImageViewInfo = ImageViewCreateInfo(depthFormat, depthImage.image, VK_IMAGE_ASPECT_DEPTH_BIT);
-
-	vkCheck(vkCreateImageView(device, &depthImageViewInfo, nullptr, &depthImageView));
+	CreateSwapchain(window, VK_NULL_HANDLE);
+	deletionQueue.Push([]
+	{
+		DestroySwapchainResources(swapchain, swapchainImageViews, framebuffers);
+	});
 
 	// Init commands
 	VkCommandPoolCreateInfo commandPoolInfo = {};
 	commandPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
 	commandPoolInfo.queueFamilyIndex = graphicsQueueFamily;
 	commandPoolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-	for (int i = 0; i < frame_overlap; i++)
+	for (int i = 0; i < MAX_FRAME_OVERLAP; i++)
 	{
 		vkCheck(vkCreateCommandPool(device, &commandPoolInfo, nullptr, &frames[i].commandPool));
+		deletionQueue.Push([=] { vkDestroyCommandPool(device, frames[i].commandPool, nullptr); });
 		VkCommandBufferAllocateInfo commandBufferInfo = {};
 		commandBufferInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
 		commandBufferInfo.commandBufferCount = 1;
@@ -933,133 +2472,113 @@ void Init(GLFWwindow* window)
 		commandBufferInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
 
 		vkCheck(vkAllocateCommandBuffers(device, &commandBufferInfo, &frames[i].mainCommandBuffer));
+
+		commandBufferInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+		vkCheck(vkAllocateCommandBuffers(device, &commandBufferInfo, &frames[i].imguiCommandBuffer));
 	}
 
+	// Secondary command buffers are recorded once per frame, their pools are reset as a whole
+	VkCommandPoolCreateInfo threadCommandPoolInfo = {};
+	threadCommandPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	threadCommandPoolInfo.queueFamilyIndex = graphicsQueueFamily;
+	threadCommandPoolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+	for (int i = 0; i < MAX_FRAME_OVERLAP; i++)
+	{
+		for (uint32_t t = 0; t < MAX_RECORD_THREADS; t++)
+		{
+			vkCheck(vkCreateCommandPool(device, &threadCommandPoolInfo, nullptr, &frames[i].threadCommandPools[t]));
+			deletionQueue.Push([=] { vkDestroyCommandPool(device, frames[i].threadCommandPools[t], nullptr); });
+			VkCommandBufferAllocateInfo commandBufferInfo = {};
+			commandBufferInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			commandBufferInfo.commandBufferCount = 1;
+			commandBufferInfo.commandPool = frames[i].threadCommandPools[t];
+			commandBufferInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+
+			vkCheck(vkAllocateCommandBuffers(device, &commandBufferInfo, &frames[i].threadCommandBuffers[t]));
+			vkCheck(vkAllocateCommandBuffers(device, &commandBufferInfo, &frames[i].threadDepthCommandBuffers[t]));
+		}
+	}
+
+	jobSystem.Start(std::max(std::thread::hardware_concurrency(), 1u));
+	workerThreadCount = jobSystem.WorkerCount();
+
 	VkCommandPoolCreateInfo uploadCommandPoolInfo = {};
 	uploadCommandPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
 	uploadCommandPoolInfo.queueFamilyIndex = graphicsQueueFamily;
 	uploadCommandPoolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
 
 	vkCheck(vkCreateCommandPool(device, &uploadCommandPoolInfo, nullptr, &uploadContext.commandPool));
+	deletionQueue.Push([] { vkDestroyCommandPool(device, uploadContext.commandPool, nullptr); });
 
-	// Init framebuffer
+	// Init overlay render pass
+	// The scene is drawn with dynamic rendering and leaves the swapchain image in COLOR_ATTACHMENT_OPTIMAL,
+	// ImGui draws on top of it in this pass which then hands the image over for present
 	VkAttachmentDescription colorAttachment = {};
 	colorAttachment.format = swapchainImageFormat;
-	//1 sample, we won't be doing MSAA
 	colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-	// we Clear when this attachment is loaded
-	colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-	// we keep the attachment stored when the renderpass ends
+	colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
 	colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-	//we don't care about stencil
 	colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 	colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-	//we don't know or care about the starting layout of the attachment
-	colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	//after the renderpass ends, the image has to be on a layout ready for display
+	colorAttachment.initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 	colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 
 	VkAttachmentReference colorAttachmentRef = {};
-	//attachment number will index into the pAttachments array in the parent renderpass itself
 	colorAttachmentRef.attachment = 0;
 	colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
-	VkAttachmentDescription depthAttachment = {};
-	depthAttachment.format = depthFormat;
-	depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-	depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-	depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-	depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-	depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-	depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-
-	VkAttachmentReference depthAttachmentRef = {};
-	depthAttachmentRef.attachment = 1;
-	depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-
-
 	VkSubpassDescription subpass = {};
 	subpass.colorAttachmentCount = 1;
 	subpass.pColorAttachments = &colorAttachmentRef;
-	subpass.pDepthStencilAttachment = &depthAttachmentRef;
 	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
 
-
-	VkAttachmentDescription attachments[2] = { colorAttachment, depthAttachment };
 	VkRenderPassCreateInfo renderPassInfo = {};
 	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-	renderPassInfo.attachmentCount = 2;
-	renderPassInfo.pAttachments = attachments;
+	renderPassInfo.attachmentCount = 1;
+	renderPassInfo.pAttachments = &colorAttachment;
 	renderPassInfo.subpassCount = 1;
 	renderPassInfo.pSubpasses = &subpass;
+	// No external dependency, the render graph puts the barrier after the scene's color writes
 
-	vkCheck(vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass));
-
-	VkFramebufferCreateInfo framebufferInfo = {};
-	framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-	framebufferInfo.width = width;
-	framebufferInfo.height = height;
-	framebufferInfo.renderPass = renderPass;
-	framebufferInfo.attachmentCount = 1;
-	framebufferInfo.layers = 1;
+	vkCheck(vkCreateRenderPass(device, &renderPassInfo, nullptr, &overlayRenderPass));
+	deletionQueue.Push([] { vkDestroyRenderPass(device, overlayRenderPass, nullptr); });
 
-	const uint32_t swapchainImageCount = swapchainImages.size();
-	framebuffers.resize(swapchainImageCount);
+	CreateFramebuffers();
 
-	for (int i = 0; i < swapchainImageCount; i++)
-	{
-		VkImageView attachments[2] = { swapchainImageViews[i], depthImageView };
+	// Init sync structures
+	// The timeline starts at 0 and frames start with a timelineValue of 0, so the first wait of every frame returns right away
+	VkSemaphoreTypeCreateInfo timelineTypeInfo = {};
+	timelineTypeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+	timelineTypeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+	timelineTypeInfo.initialValue = 0;
 
-		framebufferInfo.attachmentCount = 2;
-		framebufferInfo.pAttachments = attachments;
-		vkCheck(vkCreateFramebuffer(device, &framebufferInfo, nullptr, &framebuffers[i]));
-	}
+	VkSemaphoreCreateInfo timelineInfo = {};
+	timelineInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	timelineInfo.pNext = &timelineTypeInfo;
 
-	// Init sync structures
-	VkFenceCreateInfo fenceInfo = {};
-	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-	//we want to create the fence with the Create Signaled flag, 
-	// so we can wait on it before using it on a GPU command (for the first frame)
-	fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+	vkCheck(vkCreateSemaphore(device, &timelineInfo, nullptr, &timelineSemaphore));
+	deletionQueue.Push([] { vkDestroySemaphore(device, timelineSemaphore, nullptr); });
 
 	VkSemaphoreCreateInfo semaphoreInfo = {};
 	semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
-	for (int i = 0; i < frame_overlap; i++)
+	for (int i = 0; i < MAX_FRAME_OVERLAP; i++)
 	{
-		vkCheck(vkCreateFence(device, &fenceInfo, nullptr, &frames[i].renderFence));
-
+		frames[i].timelineValue = 0;
 		vkCheck(vkCreateSemaphore(device, &semaphoreInfo, nullptr, &frames[i].renderSemaphore));
 		vkCheck(vkCreateSemaphore(device, &semaphoreInfo, nullptr, &frames[i].presentSemaphore));
+		deletionQueue.Push([=]
+		{
+			vkDestroySemaphore(device, frames[i].renderSemaphore, nullptr);
+			vkDestroySemaphore(device, frames[i].presentSemaphore, nullptr);
+		});
 	}
 
-	VkFenceCreateInfo uploadFenceCreateInfo = {};
-	uploadFenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-
-	vkCheck(vkCreateFence(device, &uploadFenceCreateInfo, nullptr, &uploadContext.uploadFence));
-
 	// Init descriptors
-	// create a descriptor pool that will hold 10 uniform buffers
-	std::vector<VkDescriptorPoolSize> sizes = {
-												{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 10},
-												{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 10},
-												{VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 10},
-												//add combined-image-sampler descriptor types to the pool
-												{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 10 }
-	};
-	/*
-	 * When creating a descriptor pool, you need to specify how many descriptors of each type you will need,
-	 * and what�s the maximum number of sets to allocate from it.
-	 */
-	 // Descriptor Pool
-	VkDescriptorPoolCreateInfo descriptorPoolInfo = {};
-	descriptorPoolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-	descriptorPoolInfo.maxSets = 10;
-	descriptorPoolInfo.poolSizeCount = sizes.size();
-	descriptorPoolInfo.pPoolSizes = sizes.data();
-
-	vkCheck(vkCreateDescriptorPool(device, &descriptorPoolInfo, nullptr, &descriptorPool));
+	// ImGui gets its own pool, it frees its sets individually
+	imguiDescriptorPool = CreateDescriptorPool(64, VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT);
+	deletionQueue.Push([] { vkDestroyDescriptorPool(device, imguiDescriptorPool, nullptr); });
+	deletionQueue.Push([] { descriptorSetCache.Cleanup(); });
 
 	// Camera set layout binding (uniform buffer)
 	VkDescriptorSetLayoutBinding cameraBufferBinding = DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
@@ -1067,7 +2586,7 @@ void Init(GLFWwindow* window)
 																				  0);
 
 	// scene buffer
-	const size_t sceneParamBufferSize = frame_overlap * pad_uniform_buffer_size(sizeof(GPUSceneData));
+	const size_t sceneParamBufferSize = MAX_FRAME_OVERLAP * pad_uniform_buffer_size(sizeof(GPUSceneData));
 	VkBufferCreateInfo sceneBufferInfo = {};
 	sceneBufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
 	sceneBufferInfo.size = sceneParamBufferSize;
@@ -1081,6 +2600,7 @@ void Init(GLFWwindow* window)
 							&sceneParameterBuffer.buffer,
 							&sceneParameterBuffer.allocation,
 							nullptr));
+	deletionQueue.Push([] { vmaDestroyBuffer(allocator, sceneParameterBuffer.buffer, sceneParameterBuffer.allocation); });
 
 	// scene set layout binding (dynamic uniform buffer)
 	VkDescriptorSetLayoutBinding sceneBufferBinding = DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
@@ -1094,18 +2614,26 @@ void Init(GLFWwindow* window)
 	descriptorSetLayoutInfo.bindingCount = ARRAYSIZE(bindings);
 	descriptorSetLayoutInfo.pBindings = bindings;
 	vkCheck(vkCreateDescriptorSetLayout(device, &descriptorSetLayoutInfo, nullptr, &globalSetLayout));
+	deletionQueue.Push([] { vkDestroyDescriptorSetLayout(device, globalSetLayout, nullptr); });
 
 	// object set layout binding (storage buffer)
 	VkDescriptorSetLayoutBinding objectBinding = DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
 																			VK_SHADER_STAGE_VERTEX_BIT,
 																			0);
 
+	// draw index binding (dynamic uniform buffer)
+	VkDescriptorSetLayoutBinding drawIndexBinding = DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+																			   VK_SHADER_STAGE_VERTEX_BIT,
+																			   1);
+
 	// Create set layout #1
+	VkDescriptorSetLayoutBinding objectBindings[] = { objectBinding, drawIndexBinding };
 	VkDescriptorSetLayoutCreateInfo objectSetLayoutInfo = {};
 	objectSetLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-	objectSetLayoutInfo.bindingCount = 1;
-	objectSetLayoutInfo.pBindings = &objectBinding;
+	objectSetLayoutInfo.bindingCount = ARRAYSIZE(objectBindings);
+	objectSetLayoutInfo.pBindings = objectBindings;
 	vkCheck(vkCreateDescriptorSetLayout(device, &objectSetLayoutInfo, nullptr, &objectSetLayout));
+	deletionQueue.Push([] { vkDestroyDescriptorSetLayout(device, objectSetLayout, nullptr); });
 
 	// Create texture set layout #2
 	VkDescriptorSetLayoutBinding diffuseMapBind = DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 
@@ -1129,6 +2657,91 @@ void Init(GLFWwindow* window)
 	textureSetInfo.pBindings = textureBindings;
 
 	vkCheck(vkCreateDescriptorSetLayout(device, &textureSetInfo, nullptr, &singleTextureSetLayout));
+	deletionQueue.Push([] { vkDestroyDescriptorSetLayout(device, singleTextureSetLayout, nullptr); });
+
+	if (useBindless)
+	{
+		// Create bindless texture set layout #2
+		// A single partially bound array of every texture, plus the material table the objects index into
+		VkDescriptorSetLayoutBinding texturesBind = DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+																			   VK_SHADER_STAGE_FRAGMENT_BIT,
+																			   0);
+		texturesBind.descriptorCount = MAX_BINDLESS_TEXTURES;
+
+		VkDescriptorSetLayoutBinding materialTableBind = DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+																					VK_SHADER_STAGE_FRAGMENT_BIT,
+																					1);
+
+		VkDescriptorBindingFlags bindlessFlags[] = {
+			VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT,
+			0
+		};
+
+		VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsInfo = {};
+		bindingFlagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+		bindingFlagsInfo.bindingCount = ARRAYSIZE(bindlessFlags);
+		bindingFlagsInfo.pBindingFlags = bindlessFlags;
+
+		VkDescriptorSetLayoutBinding bindlessBindings[] = { texturesBind, materialTableBind };
+		VkDescriptorSetLayoutCreateInfo bindlessSetInfo = {};
+		bindlessSetInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		bindlessSetInfo.pNext = &bindingFlagsInfo;
+		bindlessSetInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+		bindlessSetInfo.bindingCount = ARRAYSIZE(bindlessBindings);
+		bindlessSetInfo.pBindings = bindlessBindings;
+
+		vkCheck(vkCreateDescriptorSetLayout(device, &bindlessSetInfo, nullptr, &bindlessSetLayout));
+		deletionQueue.Push([] { vkDestroyDescriptorSetLayout(device, bindlessSetLayout, nullptr); });
+
+		// Update after bind sets need their own pool
+		VkDescriptorPoolSize bindlessSizes[] = {
+			{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, MAX_BINDLESS_TEXTURES },
+			{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 }
+		};
+
+		VkDescriptorPoolCreateInfo bindlessPoolInfo = {};
+		bindlessPoolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		bindlessPoolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+		bindlessPoolInfo.maxSets = 1;
+		bindlessPoolInfo.poolSizeCount = ARRAYSIZE(bindlessSizes);
+		bindlessPoolInfo.pPoolSizes = bindlessSizes;
+
+		vkCheck(vkCreateDescriptorPool(device, &bindlessPoolInfo, nullptr, &bindlessDescriptorPool));
+		deletionQueue.Push([] { vkDestroyDescriptorPool(device, bindlessDescriptorPool, nullptr); });
+
+		VkDescriptorSetAllocateInfo bindlessSetAllocInfo = {};
+		bindlessSetAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		bindlessSetAllocInfo.descriptorPool = bindlessDescriptorPool;
+		bindlessSetAllocInfo.descriptorSetCount = 1;
+		bindlessSetAllocInfo.pSetLayouts = &bindlessSetLayout;
+		vkCheck(vkAllocateDescriptorSets(device, &bindlessSetAllocInfo, &bindlessSet));
+
+		// Material table
+		VkBufferCreateInfo materialTableInfo = {};
+		materialTableInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		materialTableInfo.size = sizeof(GPUMaterialData) * MAX_MATERIALS;
+		materialTableInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+
+		VmaAllocationCreateInfo materialTableAllocInfo = {};
+		materialTableAllocInfo.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
+
+		vkCheck(vmaCreateBuffer(allocator, &materialTableInfo, &materialTableAllocInfo,
+								&materialTableBuffer.buffer,
+								&materialTableBuffer.allocation,
+								nullptr));
+		deletionQueue.Push([] { vmaDestroyBuffer(allocator, materialTableBuffer.buffer, materialTableBuffer.allocation); });
+
+		VkDescriptorBufferInfo materialTableBufferInfo = {};
+		materialTableBufferInfo.buffer = materialTableBuffer.buffer;
+		materialTableBufferInfo.offset = 0;
+		materialTableBufferInfo.range = VK_WHOLE_SIZE;
+
+		VkWriteDescriptorSet materialTableWrite = WriteDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+																		bindlessSet,
+																		&materialTableBufferInfo,
+																		1);
+		vkUpdateDescriptorSets(device, 1, &materialTableWrite, 0, nullptr);
+	}
 
 	// Create Material buffer
 	VkBufferCreateInfo materialBufferInfo = {};
@@ -1144,73 +2757,141 @@ void Init(GLFWwindow* window)
 							&materialBuffer.buffer,
 							&materialBuffer.allocation,
 							nullptr));
+	deletionQueue.Push([] { vmaDestroyBuffer(allocator, materialBuffer.buffer, materialBuffer.allocation); });
 
 	// Material set layout binding (dynamic uniform buffer)
 	VkDescriptorSetLayoutBinding materialBufferBinding = DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
 																					VK_SHADER_STAGE_FRAGMENT_BIT,
 																					0);
-	// Create Light buffer
-	VkBufferCreateInfo lightBufferInfo = {};
-	lightBufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-	lightBufferInfo.size = sizeof(Light);
-	lightBufferInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
-
-	vkCheck(vmaCreateBuffer(allocator, &lightBufferInfo, &vmaallocInfo,
-							&lightBuffer.buffer,
-							&lightBuffer.allocation,
-							nullptr));
-
-	// Create light descriptor set layout binding
-	VkDescriptorSetLayoutBinding lightBufferBinding = DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
-																					VK_SHADER_STAGE_FRAGMENT_BIT,
-																					1);
+	// Clustered lighting bindings: cluster data, lights, per cluster light counts and indices
+	std::vector<VkDescriptorSetLayoutBinding> sceneBindings = {
+		materialBufferBinding,
+		DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT, 1),
+		DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT, 2),
+		DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT, 3),
+		DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT, 4)
+	};
 
 	// Create scene descriptor set layout
-	std::vector<VkDescriptorSetLayoutBinding> sceneBindings = { materialBufferBinding, lightBufferBinding };
 	VkDescriptorSetLayoutCreateInfo materialSetLayoutInfo = {};
 	materialSetLayoutInfo.bindingCount = sceneBindings.size();
 	materialSetLayoutInfo.flags = 0;
 	materialSetLayoutInfo.pNext = nullptr;
 	materialSetLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
 	materialSetLayoutInfo.pBindings = sceneBindings.data();
-	vkCreateDescriptorSetLayout(device, &materialSetLayoutInfo, nullptr, &sceneSetLayout);
-
-	// Allocate scene Descriptor set
-	VkDescriptorSetAllocateInfo materialSetAllocInfo = {};
-	materialSetAllocInfo.pNext = nullptr;
-	materialSetAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-	materialSetAllocInfo.descriptorPool = descriptorPool;
-	materialSetAllocInfo.descriptorSetCount = 1;
-	materialSetAllocInfo.pSetLayouts = &sceneSetLayout;
-
-	vkAllocateDescriptorSets(device, &materialSetAllocInfo, &sceneDescriptorSet);
-
-	// Write into the material descriptor buffer
-	VkDescriptorBufferInfo materialDescriptorBufferInfo = {};
-	materialDescriptorBufferInfo.buffer = materialBuffer.buffer;
-	materialDescriptorBufferInfo.offset = 0;
-	materialDescriptorBufferInfo.range = sizeof(Material);
-
-	VkWriteDescriptorSet materialWrite = WriteDescriptorBuffer(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
-															sceneDescriptorSet,
-															&materialDescriptorBufferInfo,
-															0);
-
-	// Write into light descriptor buffer
-	VkDescriptorBufferInfo lightDescriptorBufferInfo = {};
-	lightDescriptorBufferInfo.buffer = lightBuffer.buffer;
-	lightDescriptorBufferInfo.offset = 0;
-	lightDescriptorBufferInfo.range = sizeof(Light);
-
-	VkWriteDescriptorSet lightWrite = WriteDescriptorBuffer(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
-															   sceneDescriptorSet,
-															   &lightDescriptorBufferInfo,
-															   1);
-
-	VkWriteDescriptorSet sceneWrites[] = { materialWrite, lightWrite };
-	vkUpdateDescriptorSets(device, ARRAYSIZE(sceneWrites), sceneWrites, 0, nullptr);
-
-	for (int i = 0; i < frame_overlap; i++)
+	vkCheck(vkCreateDescriptorSetLayout(device, &materialSetLayoutInfo, nullptr, &sceneSetLayout));
+	deletionQueue.Push([] { vkDestroyDescriptorSetLayout(device, sceneSetLayout, nullptr); });
+
+	// Cluster cull set layout: cull data, objects, meshlets, draws, draw count, depth pyramid
+	VkDescriptorSetLayoutBinding cullBindings[] = {
+		DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 0),
+		DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 1),
+		DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 2),
+		DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 3),
+		DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 4),
+		DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT, 5)
+	};
+	VkDescriptorSetLayoutCreateInfo cullSetLayoutInfo = {};
+	cullSetLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	cullSetLayoutInfo.bindingCount = ARRAYSIZE(cullBindings);
+	cullSetLayoutInfo.pBindings = cullBindings;
+	vkCheck(vkCreateDescriptorSetLayout(device, &cullSetLayoutInfo, nullptr, &meshletCullSetLayout));
+	deletionQueue.Push([] { vkDestroyDescriptorSetLayout(device, meshletCullSetLayout, nullptr); });
+
+	// Depth pyramid set layout: source level, destination level
+	VkDescriptorSetLayoutBinding pyramidBindings[] = {
+		DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT, 0),
+		DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT, 1)
+	};
+	VkDescriptorSetLayoutCreateInfo pyramidSetLayoutInfo = {};
+	pyramidSetLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	pyramidSetLayoutInfo.bindingCount = ARRAYSIZE(pyramidBindings);
+	pyramidSetLayoutInfo.pBindings = pyramidBindings;
+	vkCheck(vkCreateDescriptorSetLayout(device, &pyramidSetLayoutInfo, nullptr, &depthPyramidSetLayout));
+	deletionQueue.Push([] { vkDestroyDescriptorSetLayout(device, depthPyramidSetLayout, nullptr); });
+
+	VkPipelineLayoutCreateInfo cullPipelineLayoutInfo = {};
+	cullPipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	cullPipelineLayoutInfo.setLayoutCount = 1;
+	cullPipelineLayoutInfo.pSetLayouts = &meshletCullSetLayout;
+	vkCheck(vkCreatePipelineLayout(device, &cullPipelineLayoutInfo, nullptr, &meshletCullPipelineLayout));
+	deletionQueue.Push([] { vkDestroyPipelineLayout(device, meshletCullPipelineLayout, nullptr); });
+
+	VkPushConstantRange pyramidConstantRange = {};
+	pyramidConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	pyramidConstantRange.size = sizeof(DepthPyramidPushConstants);
+
+	VkPipelineLayoutCreateInfo pyramidPipelineLayoutInfo = {};
+	pyramidPipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pyramidPipelineLayoutInfo.setLayoutCount = 1;
+	pyramidPipelineLayoutInfo.pSetLayouts = &depthPyramidSetLayout;
+	pyramidPipelineLayoutInfo.pushConstantRangeCount = 1;
+	pyramidPipelineLayoutInfo.pPushConstantRanges = &pyramidConstantRange;
+	vkCheck(vkCreatePipelineLayout(device, &pyramidPipelineLayoutInfo, nullptr, &depthPyramidPipelineLayout));
+	deletionQueue.Push([] { vkDestroyPipelineLayout(device, depthPyramidPipelineLayout, nullptr); });
+
+	// Light cull set layout: cluster data, lights, per cluster light counts and indices
+	VkDescriptorSetLayoutBinding lightCullBindings[] = {
+		DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 0),
+		DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 1),
+		DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 2),
+		DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 3)
+	};
+	VkDescriptorSetLayoutCreateInfo lightCullSetLayoutInfo = {};
+	lightCullSetLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	lightCullSetLayoutInfo.bindingCount = ARRAYSIZE(lightCullBindings);
+	lightCullSetLayoutInfo.pBindings = lightCullBindings;
+	vkCheck(vkCreateDescriptorSetLayout(device, &lightCullSetLayoutInfo, nullptr, &lightCullSetLayout));
+	deletionQueue.Push([] { vkDestroyDescriptorSetLayout(device, lightCullSetLayout, nullptr); });
+
+	VkPipelineLayoutCreateInfo lightCullPipelineLayoutInfo = {};
+	lightCullPipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	lightCullPipelineLayoutInfo.setLayoutCount = 1;
+	lightCullPipelineLayoutInfo.pSetLayouts = &lightCullSetLayout;
+	vkCheck(vkCreatePipelineLayout(device, &lightCullPipelineLayoutInfo, nullptr, &lightCullPipelineLayout));
+	deletionQueue.Push([] { vkDestroyPipelineLayout(device, lightCullPipelineLayout, nullptr); });
+
+	// Deferred lighting set layout: cluster data (camera and light count), lights, scene data, depth, G-buffer, lit output
+	VkDescriptorSetLayoutBinding deferredLightingBindings[] = {
+		DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 0),
+		DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 1),
+		DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 2),
+		DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT, 3),
+		DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT, 4),
+		DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT, 5),
+		DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT, 6),
+		DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT, 7)
+	};
+	VkDescriptorSetLayoutCreateInfo deferredLightingSetLayoutInfo = {};
+	deferredLightingSetLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	deferredLightingSetLayoutInfo.bindingCount = ARRAYSIZE(deferredLightingBindings);
+	deferredLightingSetLayoutInfo.pBindings = deferredLightingBindings;
+	vkCheck(vkCreateDescriptorSetLayout(device, &deferredLightingSetLayoutInfo, nullptr, &deferredLightingSetLayout));
+	deletionQueue.Push([] { vkDestroyDescriptorSetLayout(device, deferredLightingSetLayout, nullptr); });
+
+	VkPushConstantRange deferredLightingConstantRange = {};
+	deferredLightingConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	deferredLightingConstantRange.size = sizeof(DeferredLightingPushConstants);
+
+	VkPipelineLayoutCreateInfo deferredLightingPipelineLayoutInfo = {};
+	deferredLightingPipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	deferredLightingPipelineLayoutInfo.setLayoutCount = 1;
+	deferredLightingPipelineLayoutInfo.pSetLayouts = &deferredLightingSetLayout;
+	deferredLightingPipelineLayoutInfo.pushConstantRangeCount = 1;
+	deferredLightingPipelineLayoutInfo.pPushConstantRanges = &deferredLightingConstantRange;
+	vkCheck(vkCreatePipelineLayout(device, &deferredLightingPipelineLayoutInfo, nullptr, &deferredLightingPipelineLayout));
+	deletionQueue.Push([] { vkDestroyPipelineLayout(device, deferredLightingPipelineLayout, nullptr); });
+
+	VkSamplerCreateInfo gbufferSamplerInfo = SamplerCreateInfo(VK_FILTER_NEAREST, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE);
+	vkCheck(vkCreateSampler(device, &gbufferSamplerInfo, nullptr, &gbufferSampler));
+	deletionQueue.Push([] { vkDestroySampler(device, gbufferSampler, nullptr); });
+
+	// Pyramid levels are read with texelFetch, the sampler only has to exist
+	VkSamplerCreateInfo pyramidSamplerInfo = SamplerCreateInfo(VK_FILTER_NEAREST, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE);
+	vkCheck(vkCreateSampler(device, &pyramidSamplerInfo, nullptr, &depthPyramidSampler));
+	deletionQueue.Push([] { vkDestroySampler(device, depthPyramidSampler, nullptr); });
+
+	for (int i = 0; i < MAX_FRAME_OVERLAP; i++)
 	{
 		// Uniform Buffer
 		VkBufferCreateInfo bufferInfo = {};
@@ -1233,7 +2914,6 @@ void Init(GLFWwindow* window)
 		frames[i].cameraBuffer = newBuffer;
 
 		// Storage buffer
-		const int MAX_OBJECTS = 10000;
 		bufferInfo = {};
 		bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
 		bufferInfo.size = sizeof(GPUObjectData) * MAX_OBJECTS;
@@ -1250,57 +2930,115 @@ void Init(GLFWwindow* window)
 
 		frames[i].objectBuffer = newBuffer;
 
-		// Allocate Descriptor sets
-		VkDescriptorSetAllocateInfo cameraDescriptorSetAllocInfo = {};
-		cameraDescriptorSetAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-		cameraDescriptorSetAllocInfo.descriptorPool = descriptorPool;
-		cameraDescriptorSetAllocInfo.descriptorSetCount = 1;
-		cameraDescriptorSetAllocInfo.pSetLayouts = &globalSetLayout;
-		vkCheck(vkAllocateDescriptorSets(device, &cameraDescriptorSetAllocInfo, &frames[i].globalDescriptorSet));
-
-		VkDescriptorSetAllocateInfo objectDescriptorSetAllocInfo = {};
-		objectDescriptorSetAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-		objectDescriptorSetAllocInfo.descriptorPool = descriptorPool;
-		objectDescriptorSetAllocInfo.descriptorSetCount = 1;
-		objectDescriptorSetAllocInfo.pSetLayouts = &objectSetLayout;
-		vkCheck(vkAllocateDescriptorSets(device, &objectDescriptorSetAllocInfo, &frames[i].objectDescriptorSet));
-
-		// Write into the camera descriptor buffer
-		VkDescriptorBufferInfo cameraBufferInfo = {};
-		cameraBufferInfo.buffer = frames[i].cameraBuffer.buffer;
-		cameraBufferInfo.offset = 0;
-		cameraBufferInfo.range = sizeof(GPUCameraData);
-
-		VkWriteDescriptorSet cameraWrite = WriteDescriptorBuffer(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-																 frames[i].globalDescriptorSet,
-																 &cameraBufferInfo,
-																 0);
-
-		// Write into the scene descriptor buffer
-		VkDescriptorBufferInfo sceneBufferInfo = {};
-		sceneBufferInfo.buffer = sceneParameterBuffer.buffer;
-		sceneBufferInfo.offset = 0;
-		sceneBufferInfo.range = sizeof(GPUSceneData);
-
-		VkWriteDescriptorSet sceneWrite = WriteDescriptorBuffer(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
-																frames[i].globalDescriptorSet,
-																&sceneBufferInfo,
-																1);
-
-		// Write into the object descriptor buffer
-		VkDescriptorBufferInfo objectBufferInfo = {};
-		objectBufferInfo.buffer = frames[i].objectBuffer.buffer;
-		objectBufferInfo.offset = 0;
-		objectBufferInfo.range = sizeof(GPUObjectData);
-
-		VkWriteDescriptorSet objectWrite = WriteDescriptorBuffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-																 frames[i].objectDescriptorSet,
-																 &objectBufferInfo,
-																 0);
-
-
-		VkWriteDescriptorSet setWrites[] = { cameraWrite, sceneWrite, objectWrite };
-		vkUpdateDescriptorSets(device, ARRAYSIZE(setWrites), setWrites, 0, nullptr);
+		// Draw index buffer
+		bufferInfo = {};
+		bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		bufferInfo.size = pad_uniform_buffer_size(sizeof(uint32_t)) * MAX_OBJECTS;
+		bufferInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+
+		vkCheck(vmaCreateBuffer(allocator, &bufferInfo, &vmaallocInfo,
+								&frames[i].drawIndexBuffer.buffer,
+								&frames[i].drawIndexBuffer.allocation,
+								nullptr));
+
+		// Cluster culling
+		bufferInfo.size = sizeof(GPUCullData);
+		bufferInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+		vkCheck(vmaCreateBuffer(allocator, &bufferInfo, &vmaallocInfo,
+								&frames[i].cullBuffer.buffer,
+								&frames[i].cullBuffer.allocation,
+								nullptr));
+
+		VmaAllocationCreateInfo gpuAllocInfo = {};
+		gpuAllocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+		bufferInfo.size = sizeof(VkDrawIndexedIndirectCommand) * MAX_MESHLET_DRAWS;
+		bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
+		vkCheck(vmaCreateBuffer(allocator, &bufferInfo, &gpuAllocInfo,
+								&frames[i].meshletDrawBuffer.buffer,
+								&frames[i].meshletDrawBuffer.allocation,
+								nullptr));
+
+		VmaAllocationCreateInfo readbackAllocInfo = {};
+		readbackAllocInfo.usage = VMA_MEMORY_USAGE_GPU_TO_CPU;
+		bufferInfo.size = sizeof(uint32_t);
+		bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+		vkCheck(vmaCreateBuffer(allocator, &bufferInfo, &readbackAllocInfo,
+								&frames[i].meshletDrawCountBuffer.buffer,
+								&frames[i].meshletDrawCountBuffer.allocation,
+								nullptr));
+		frames[i].meshletDrawsWritten = false;
+
+		// Clustered lighting
+		bufferInfo.size = sizeof(GPUClusterData);
+		bufferInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+		vkCheck(vmaCreateBuffer(allocator, &bufferInfo, &vmaallocInfo,
+								&frames[i].clusterBuffer.buffer,
+								&frames[i].clusterBuffer.allocation,
+								nullptr));
+
+		bufferInfo.size = sizeof(GPUPointLight) * MAX_POINT_LIGHTS;
+		bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+		vkCheck(vmaCreateBuffer(allocator, &bufferInfo, &vmaallocInfo,
+								&frames[i].pointLightBuffer.buffer,
+								&frames[i].pointLightBuffer.allocation,
+								nullptr));
+
+		bufferInfo.size = sizeof(uint32_t) * CLUSTER_COUNT;
+		vkCheck(vmaCreateBuffer(allocator, &bufferInfo, &gpuAllocInfo,
+								&frames[i].clusterLightCountBuffer.buffer,
+								&frames[i].clusterLightCountBuffer.allocation,
+								nullptr));
+
+		bufferInfo.size = sizeof(uint32_t) * CLUSTER_COUNT * MAX_LIGHTS_PER_CLUSTER;
+		vkCheck(vmaCreateBuffer(allocator, &bufferInfo, &gpuAllocInfo,
+								&frames[i].clusterLightIndexBuffer.buffer,
+								&frames[i].clusterLightIndexBuffer.allocation,
+								nullptr));
+
+		// Timestamps at the start and the end of the frame
+		VkQueryPoolCreateInfo queryPoolInfo = {};
+		queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		queryPoolInfo.queryCount = 2;
+		vkCheck(vkCreateQueryPool(device, &queryPoolInfo, nullptr, &frames[i].timestampQueryPool));
+		frames[i].timestampsWritten = false;
+
+		deletionQueue.Push([=]
+		{
+			vmaDestroyBuffer(allocator, frames[i].cameraBuffer.buffer, frames[i].cameraBuffer.allocation);
+			vmaDestroyBuffer(allocator, frames[i].objectBuffer.buffer, frames[i].objectBuffer.allocation);
+			vmaDestroyBuffer(allocator, frames[i].drawIndexBuffer.buffer, frames[i].drawIndexBuffer.allocation);
+			vmaDestroyBuffer(allocator, frames[i].cullBuffer.buffer, frames[i].cullBuffer.allocation);
+			vmaDestroyBuffer(allocator, frames[i].meshletDrawBuffer.buffer, frames[i].meshletDrawBuffer.allocation);
+			vmaDestroyBuffer(allocator, frames[i].meshletDrawCountBuffer.buffer, frames[i].meshletDrawCountBuffer.allocation);
+			vmaDestroyBuffer(allocator, frames[i].clusterBuffer.buffer, frames[i].clusterBuffer.allocation);
+			vmaDestroyBuffer(allocator, frames[i].pointLightBuffer.buffer, frames[i].pointLightBuffer.allocation);
+			vmaDestroyBuffer(allocator, frames[i].clusterLightCountBuffer.buffer, frames[i].clusterLightCountBuffer.allocation);
+			vmaDestroyBuffer(allocator, frames[i].clusterLightIndexBuffer.buffer, frames[i].clusterLightIndexBuffer.allocation);
+			vkDestroyQueryPool(device, frames[i].timestampQueryPool, nullptr);
+			frames[i].descriptorAllocator.Cleanup();
+		});
+
+		// Get Descriptor sets
+		frames[i].globalDescriptorSet = descriptorSetCache.Get(globalSetLayout, {
+			BufferWrite(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, frames[i].cameraBuffer.buffer, 0, sizeof(GPUCameraData)),
+			BufferWrite(1, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, sceneParameterBuffer.buffer, 0, sizeof(GPUSceneData))
+		});
+
+		frames[i].objectDescriptorSet = descriptorSetCache.Get(objectSetLayout, {
+			BufferWrite(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, frames[i].objectBuffer.buffer, 0, sizeof(GPUObjectData) * MAX_OBJECTS),
+			BufferWrite(1, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, frames[i].drawIndexBuffer.buffer, 0, sizeof(uint32_t))
+		});
+
+		frames[i].sceneDescriptorSet = descriptorSetCache.Get(sceneSetLayout, {
+			BufferWrite(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, materialBuffer.buffer, 0, sizeof(Material)),
+			BufferWrite(1, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, frames[i].clusterBuffer.buffer, 0, sizeof(GPUClusterData)),
+			BufferWrite(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, frames[i].pointLightBuffer.buffer, 0, VK_WHOLE_SIZE),
+			BufferWrite(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, frames[i].clusterLightCountBuffer.buffer, 0, VK_WHOLE_SIZE),
+			BufferWrite(4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, frames[i].clusterLightIndexBuffer.buffer, 0, VK_WHOLE_SIZE)
+		});
+
+		frames[i].descriptorAllocator.setsPerPool = 64;
 	}
 
 	// Init textures
@@ -1310,175 +3048,1014 @@ void Init(GLFWwindow* window)
 	vkCreateImageView(device, &diffuseMapImageInfo, nullptr, &diffuseTexture.imageView);
 	VkSamplerCreateInfo samplerInfo = SamplerCreateInfo(VK_FILTER_NEAREST);
 	vkCreateSampler(device, &samplerInfo, nullptr, &blockySampler);
-
-	VkDescriptorImageInfo diffuseMapDescriptorImageInfo;
-	diffuseMapDescriptorImageInfo.sampler = blockySampler;
-	diffuseMapDescriptorImageInfo.imageView = diffuseTexture.imageView;
-	diffuseMapDescriptorImageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	deletionQueue.Push([]
+	{
+		vkDestroySampler(device, blockySampler, nullptr);
+		vkDestroyImageView(device, diffuseTexture.imageView, nullptr);
+	});
 
 	// Load specular Map
 	LoadFromImage("assets/container2_specular.png", specularMap.image);
 	VkImageViewCreateInfo specularMapImageInfo = ImageViewCreateInfo(VK_FORMAT_R8G8B8A8_SRGB, specularMap.image.image, VK_IMAGE_ASPECT_COLOR_BIT);
 	vkCreateImageView(device, &specularMapImageInfo, nullptr, &specularMap.imageView);
+	deletionQueue.Push([] { vkDestroyImageView(device, specularMap.imageView, nullptr); });
 	//VkSamplerCreateInfo samplerInfo = SamplerCreateInfo(VK_FILTER_NEAREST);
 	//vkCreateSampler(device, &samplerInfo, nullptr, &blockySampler); NOTE: not creating the again because im using the same sampler
 
-	VkDescriptorImageInfo specularMapDescriptorImageInfo;
-	specularMapDescriptorImageInfo.sampler = blockySampler;
-	specularMapDescriptorImageInfo.imageView = specularMap.imageView;
-	specularMapDescriptorImageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-
 	// Load Emission Map
 	LoadFromImage("assets/container2_matrix.jpg", emissionMap.image);
 	VkImageViewCreateInfo emissionMapImageInfo = ImageViewCreateInfo(VK_FORMAT_R8G8B8A8_SRGB, emissionMap.image.image, VK_IMAGE_ASPECT_COLOR_BIT);
 	vkCreateImageView(device, &emissionMapImageInfo, nullptr, &emissionMap.imageView);
+	deletionQueue.Push([] { vkDestroyImageView(device, emissionMap.imageView, nullptr); });
 	//VkSamplerCreateInfo samplerInfo = SamplerCreateInfo(VK_FILTER_NEAREST);
 	//vkCreateSampler(device, &samplerInfo, nullptr, &blockySampler); NOTE: not creating the again because im using the same sampler
 
-	VkDescriptorImageInfo emissionMapDescriptorImageInfo;
-	emissionMapDescriptorImageInfo.sampler = blockySampler;
-	emissionMapDescriptorImageInfo.imageView = emissionMap.imageView;
-	emissionMapDescriptorImageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-
-	// Allocate Textures descriptor set
-	VkDescriptorSetAllocateInfo textureSetAllocInfo = {};
-	textureSetAllocInfo.pNext = nullptr;
-	textureSetAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-	textureSetAllocInfo.descriptorPool = descriptorPool;
-	textureSetAllocInfo.descriptorSetCount = 1;
-	textureSetAllocInfo.pSetLayouts = &singleTextureSetLayout;
-	vkAllocateDescriptorSets(device, &textureSetAllocInfo, &textureSet);
+	if (useBindless)
+	{
+		GPUMaterialData containerMaterial = {};
+		containerMaterial.diffuseIndex = RegisterBindlessTexture(diffuseTexture.imageView, blockySampler);
+		containerMaterial.specularIndex = RegisterBindlessTexture(specularMap.imageView, blockySampler);
+		containerMaterial.emissionIndex = RegisterBindlessTexture(emissionMap.imageView, blockySampler);
+		containerMaterialIndex = RegisterMaterial(containerMaterial);
+	}
+	else
+	{
+		// Get Textures descriptor set
+		textureSet = descriptorSetCache.Get(singleTextureSetLayout, {
+			ImageWrite(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, blockySampler, diffuseTexture.imageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL),
+			ImageWrite(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, blockySampler, specularMap.imageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL),
+			ImageWrite(2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, blockySampler, emissionMap.imageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+		});
+	}
 
-	VkWriteDescriptorSet diffuseMapDescriptorSet = WriteDescriptorImage(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, textureSet, &diffuseMapDescriptorImageInfo, 0);
-	VkWriteDescriptorSet specularMapDescriptorSet = WriteDescriptorImage(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, textureSet, &specularMapDescriptorImageInfo, 1);
-	VkWriteDescriptorSet emissionMapDescriptorSet = WriteDescriptorImage(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, textureSet, &emissionMapDescriptorImageInfo, 2);
 
-	VkWriteDescriptorSet textureDescriptorSets[] = { diffuseMapDescriptorSet, specularMapDescriptorSet, emissionMapDescriptorSet };
-	vkUpdateDescriptorSets(device, ARRAYSIZE(textureDescriptorSets), textureDescriptorSets, 0, nullptr);
+	CreateDepthPyramid();
+	deletionQueue.Push([] { DestroyDepthPyramid(depthPyramid); });
 
+	geometryPool.Init();
+	deletionQueue.Push([] { geometryPool.Destroy(); });
 
 	// Init mesh
-	triangleMesh.vertices.resize(3);
-	triangleMesh.vertices[0].position = { 0.5f,  0.5f, 0.0f };
-	triangleMesh.vertices[1].position = { -0.5f,  0.5f, 0.0f };
-	triangleMesh.vertices[2].position = { 0.0f, -0.5f, 0.0f };
-	triangleMesh.vertices[0].color = { 1.0f, 0.0f, 0.0f };
-	triangleMesh.vertices[1].color = { 0.0f, 1.0f, 0.0f };
-	triangleMesh.vertices[2].color = { 0.0f, 0.0f, 1.0f };
-
 	monkeyMesh.loadFromObj("assets/knot.obj", "assets/");
 	//monkeyMesh.loadFromGLTF("E:\\Eden\\EdenApple\\assets\\Suzanne\\Suzanne.gltf");
+	OptimizeMesh(monkeyMesh);
+	BuildLods(monkeyMesh);
+	BuildMeshlets(monkeyMesh);
+	UploadMesh(monkeyMesh);
+
+	cubeMesh.loadFromObj("assets/cube.obj", "assets/");
+	OptimizeMesh(cubeMesh);
+	BuildLods(cubeMesh);
+	BuildMeshlets(cubeMesh);
+	UploadMesh(cubeMesh);
+
+	// The transform and bounds are set by the first frame's update
+	uint32_t knotNode = sceneGraph.AddNode(SceneGraph::InvalidNode, glm::vec3{ 5, -12, -5 }, glm::quat(1.0f, 0.0f, 0.0f, 0.0f), glm::vec3(0.1f));
+	world.Create(Transform{ glm::mat4(1.0f), knotNode }, MeshRef{ &monkeyMesh }, MaterialRef{ containerMaterialIndex }, Bounds{});
+
+	PointLight pointLight = {};
+	pointLight.position = { 0.0f, -10.0f, 0.0f };
+	pointLight.color = { 1.0f, 1.0f, 1.0f, 1.0f };
+	pointLight.diffuseStrength = 0.5f;
+	pointLight.ambientStrength = 0.2f;
+	pointLight.attenuationLinear = 0.09f;
+	pointLight.attenuationQuadratic = 0.032f;
+	lightEntity = world.Create(pointLight);
 
-	// Upload mesh
-	VkBufferCreateInfo stagingBufferInfo = {};
-	stagingBufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-	stagingBufferInfo.size = monkeyMesh.vertices.size() * sizeof(Vertex);
-	stagingBufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	CreatePipeline();
+	// Whatever pipelines are current at exit, older ones were retired by CreatePipeline
+	deletionQueue.Push([]
+	{
+		for (auto& variant : pipelineVariants)
+			vkDestroyPipeline(device, variant.second, nullptr);
+		vkDestroyPipeline(device, meshletCullPipeline, nullptr);
+		vkDestroyPipeline(device, depthPyramidPipeline, nullptr);
+		vkDestroyPipeline(device, lightCullPipeline, nullptr);
+		vkDestroyPipeline(device, deferredLightingPipeline, nullptr);
+		vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+		vkDestroyShaderModule(device, vertexShaderModule, nullptr);
+		vkDestroyShaderModule(device, fragmentShaderModule, nullptr);
+		vkDestroyShaderModule(device, depthVertexShaderModule, nullptr);
+		vkDestroyShaderModule(device, gbufferFragmentShaderModule, nullptr);
+	});
+}
 
-	VmaAllocationCreateInfo stagingVMAAllocInfo = {};
-	stagingVMAAllocInfo.usage = VMA_MEMORY_USAGE_CPU_ONLY;
+// Camera stuff
+glm::vec3 cameraPos = { 0, -10, 0 };
+glm::vec3 cameraFront = { 0, 0, 1 };
+glm::vec3 cameraTarget = { 0, 0, 0 };
+glm::vec3 cameraUp = { 0, 1, 0 };
+float deltaTime = 1.0f;
+float lastFrame = 0.0f;
+float lastX = width / 2;
+float lastY = height / 2;
+float yaw = 0.0f;
+float pitch = 0.0f;
+float sensitivity = 0.2f;
+float timer = 0;
+double x = 0, y = 0;
+bool firstTimeMouse = true;
 
-	AllocatedBuffer stagingBuffer;
+// Left clicks the UI does not take queue a pick, the next frame resolves it
+bool pickRequested = false;
+glm::vec2 pickPosition;   // in [0, 1] over the window
+Ecs::Entity pickedEntity;
+float pickedDistance = 0.0f;
 
-	vkCheck(vmaCreateBuffer(allocator, &stagingBufferInfo, &stagingVMAAllocInfo,
-							&stagingBuffer.buffer, &stagingBuffer.allocation, nullptr));
+void mouse_callback(GLFWwindow* window, double xpos, double ypos)
+{
+	if (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_2))
+	{
+		glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_HIDDEN);
 
-	void* data;
-	vmaMapMemory(allocator, stagingBuffer.allocation, &data);
-	memcpy(data, monkeyMesh.vertices.data(), monkeyMesh.vertices.size() * sizeof(Vertex));
-	vmaUnmapMemory(allocator, stagingBuffer.allocation);
+		if (firstTimeMouse)
+		{
+			lastX = xpos;
+			lastY = ypos;
+			firstTimeMouse = false;
+		}
+
+		glfwGetCursorPos(window, &x, &y);
+		float xoffset = static_cast<float>(x) - lastX;
+		float yoffset = lastY - static_cast<float>(y);
+		lastX = static_cast<float>(x);
+		lastY = static_cast<float>(y);
+		xoffset *= sensitivity;
+		yoffset *= sensitivity;
+
+		yaw += xoffset;
+		pitch += yoffset;
+
+		if (pitch > 89.f)
+			pitch = 89.f;
+		if (pitch < -89.f)
+			pitch = -89.f;
+
+		glm::vec3 front;
+		front.x = -(sin(glm::radians(yaw)) * cos(glm::radians(pitch)));
+		front.y = -(sin(glm::radians(pitch)));
+		front.z = cos(glm::radians(yaw)) * cos(glm::radians(pitch));
+		cameraFront = glm::normalize(front);
+	}
+	else
+	{
+		glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_NORMAL);
+		firstTimeMouse = true;
+	}
+}
+
+// Installed before ImGui's callback, which calls it, so clicks on the UI can be told apart
+void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
+{
+	if (button != GLFW_MOUSE_BUTTON_1 || action != GLFW_PRESS || ImGui::GetIO().WantCaptureMouse)
+		return;
+
+	int windowWidth, windowHeight;
+	glfwGetWindowSize(window, &windowWidth, &windowHeight);
+	if (windowWidth == 0 || windowHeight == 0)
+		return;
+	glfwGetCursorPos(window, &x, &y);
+	pickPosition = { float(x) / float(windowWidth), float(y) / float(windowHeight) };
+	pickRequested = true;
+}
+
+// Binds the pipeline, viewport, descriptor sets and geometry every scene draw uses, secondaries start with nothing bound
+void BindSceneState(VkCommandBuffer cmd, FrameData& frame, VkPipeline pipeline, uint32_t sceneOffset, bool positionsOnly)
+{
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+
+	VkViewport viewport = { 0.0f, 0.0f, (float)swapchainExtent.width, (float)swapchainExtent.height, 0.0f, 1.0f };
+	VkRect2D scissor = { { 0, 0 }, swapchainExtent };
+	vkCmdSetViewport(cmd, 0, 1, &viewport);
+	vkCmdSetScissor(cmd, 0, 1, &scissor);
+
+	// Bind global descriptor set (descriptor set #0)
+	vkCmdBindDescriptorSets(cmd,
+							VK_PIPELINE_BIND_POINT_GRAPHICS,
+							pipelineLayout,
+							0, 1,
+							&frame.globalDescriptorSet,
+							1, &sceneOffset);
+
+	// Bind object descriptor set (descriptor set #1)
+	uint32_t drawIndexOffset = 0;
+	vkCmdBindDescriptorSets(cmd,
+							VK_PIPELINE_BIND_POINT_GRAPHICS,
+							pipelineLayout,
+							1, 1,
+							&frame.objectDescriptorSet,
+							1, &drawIndexOffset);
+
+	// Bind texture descriptor set (descriptor set #2)
+	// With bindless this is the only texture bind of the frame, materials are picked through GPUObjectData
+	vkCmdBindDescriptorSets(cmd,
+							VK_PIPELINE_BIND_POINT_GRAPHICS,
+							pipelineLayout,
+							2, 1,
+							useBindless ? &bindlessSet : &textureSet,
+							0, nullptr);
+
+	// Bind Scene Descriptor Set
+	uint32_t materialOffset = 0;
+	vkCmdBindDescriptorSets(cmd,
+							VK_PIPELINE_BIND_POINT_GRAPHICS,
+							pipelineLayout,
+							3, 1,
+							&frame.sceneDescriptorSet,
+							1, &materialOffset);
+
+	// Every mesh lives in the geometry pool, a draw only picks its ranges
+	if (positionsOnly)
+		geometryPool.BindPositions(cmd);
+	else
+		geometryPool.Bind(cmd);
+}
+
+// Records the draw items [first, last) into cmd, binds everything it needs so it can be a secondary command buffer
+// The object index of a draw is its position in the draw items, which is the order of the object SSBO
+void RecordDraws(VkCommandBuffer cmd, FrameData& frame, VkPipeline pipeline, DrawIndexSource drawIndexSource, uint32_t sceneOffset,
+				 const std::vector<DrawItem>& items, uint32_t first, uint32_t last, bool positionsOnly = false)
+{
+	BindSceneState(cmd, frame, pipeline, sceneOffset, positionsOnly);
+
+	const size_t drawIndexStride = pad_uniform_buffer_size(sizeof(uint32_t));
+	uint32_t drawIndexOffset = 0;
+	for (uint32_t i = first; i < last; i++)
+	{
+		const DrawItem& item = items[i];
+		const Mesh& mesh = *item.mesh;
+		const MeshLod& lod = mesh.lods[item.lod];
+		const uint32_t firstIndex = mesh.firstIndex + lod.indexOffset;
+		switch (drawIndexSource)
+		{
+		case DRAW_INDEX_PUSH_CONSTANT:
+		{
+			MeshPushConstants constants = {};
+			constants.objectIndex = i;
+			constants.materialIndex = item.materialIndex;
+			constants.flags = 0;
+			vkCmdPushConstants(cmd, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(MeshPushConstants), &constants);
+			vkCmdDrawIndexed(cmd, lod.indexCount, 1, firstIndex, mesh.vertexOffset, 0);
+			break;
+		}
+		case DRAW_INDEX_DYNAMIC_UNIFORM:
+		{
+			drawIndexOffset = uint32_t(i * drawIndexStride);
+			vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 1, 1, &frame.objectDescriptorSet, 1, &drawIndexOffset);
+			vkCmdDrawIndexed(cmd, lod.indexCount, 1, firstIndex, mesh.vertexOffset, 0);
+			break;
+		}
+		case DRAW_INDEX_BASE_INSTANCE:
+			vkCmdDrawIndexed(cmd, lod.indexCount, 1, firstIndex, mesh.vertexOffset, i);
+			break;
+		}
+	}
+}
+
+// Records the meshlet draws the cluster cull pass wrote, pipeline has to read the object index from gl_BaseInstance
+// The GPU knows the draw count, maxDrawCount only bounds it to the buffer
+void RecordClusterDraws(VkCommandBuffer cmd, FrameData& frame, VkPipeline pipeline, uint32_t sceneOffset, bool positionsOnly = false)
+{
+	BindSceneState(cmd, frame, pipeline, sceneOffset, positionsOnly);
+	vkCmdDrawIndexedIndirectCount(cmd, frame.meshletDrawBuffer.buffer, 0, frame.meshletDrawCountBuffer.buffer, 0,
+								  MAX_MESHLET_DRAWS, sizeof(VkDrawIndexedIndirectCommand));
+}
+
+// Square grid of cubes in front of the starting camera
+void BuildBenchmarkGrid(Ecs::World& grid, uint32_t count)
+{
+	grid.Clear();
+	const uint32_t gridSize = (uint32_t)ceil(sqrt((double)count));
+	for (uint32_t i = 0; i < count; i++)
+	{
+		glm::vec3 position = { float(i % gridSize) * 3.0f - gridSize * 1.5f, -10.0f, 20.0f + float(i / gridSize) * 3.0f };
+		grid.Create(Transform{ glm::translate(glm::mat4{ 1.0f }, position), SceneGraph::InvalidNode },
+					MeshRef{ &cubeMesh }, MaterialRef{ containerMaterialIndex }, Bounds{});
+	}
+}
+
+// Heap budgets are cheap and read every frame, the detailed statistics walk every block and are refreshed twice a second
+struct MemoryStats
+{
+	static constexpr double refreshInterval = 0.5;
+	double lastRefresh = -1.0;
+	VmaBudget budgets[VK_MAX_MEMORY_HEAPS];
+	VmaStats stats;
+} memoryStats;
+
+// Writes VMA's JSON statistics, with the block map, to <name>_vma_stats.json in the working directory, where assets/ is loaded from
+void DumpMemoryStats(const char* name)
+{
+	char* statsString = nullptr;
+	vmaBuildStatsString(allocator, &statsString, VK_TRUE);
+
+	std::string fileName = std::string(name) + "_vma_stats.json";
+	std::ofstream file(fileName);
+	file << statsString;
+	vmaFreeStatsString(allocator, statsString);
+
+	std::cout << "Memory statistics written to " << fileName << std::endl;
+}
+
+void BuildMemoryPanel()
+{
+	vmaGetHeapBudgets(allocator, memoryStats.budgets);
+	const double now = glfwGetTime();
+	if (now - memoryStats.lastRefresh >= MemoryStats::refreshInterval)
+	{
+		vmaCalculateStats(allocator, &memoryStats.stats);
+		memoryStats.lastRefresh = now;
+	}
+
+	const VkPhysicalDeviceMemoryProperties* memoryProperties;
+	vmaGetMemoryProperties(allocator, &memoryProperties);
+
+	const double MB = 1024.0 * 1024.0;
+	ImGui::Text("Budget source: %s", useMemoryBudget ? "VK_EXT_memory_budget" : "VMA estimate");
+	for (uint32_t heap = 0; heap < memoryProperties->memoryHeapCount; heap++)
+	{
+		const VmaBudget& budget = memoryStats.budgets[heap];
+		const VmaStatInfo& info = memoryStats.stats.memoryHeap[heap];
+		const bool deviceLocal = memoryProperties->memoryHeaps[heap].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT;
+
+		ImGui::Text("Heap %u (%s, %.0f MB)", heap, deviceLocal ? "device local" : "host", memoryProperties->memoryHeaps[heap].size / MB);
+		char overlay[64];
+		snprintf(overlay, sizeof(overlay), "%.1f / %.1f MB", budget.usage / MB, budget.budget / MB);
+		ImGui::ProgressBar(budget.budget > 0 ? float(double(budget.usage) / double(budget.budget)) : 0.0f, ImVec2(-1.0f, 0.0f), overlay);
+		ImGui::Text("  Blocks: %u (%.1f MB), Allocations: %u (%.1f MB)", info.blockCount, budget.blockBytes / MB, info.allocationCount, budget.allocationBytes / MB);
+
+		// How scattered the free space is: 0 when it is one range, close to 1 when it is many small ones
+		const float fragmentation = info.unusedBytes > 0 ? 1.0f - float(double(info.unusedRangeSizeMax) / double(info.unusedBytes)) : 0.0f;
+		ImGui::Text("  Free: %.1f MB in %u ranges, fragmentation %.0f%%", info.unusedBytes / MB, info.unusedRangeCount, fragmentation * 100.0f);
+	}
+
+	VmaStatInfo vertexPool, indexPool;
+	vmaCalculateVirtualBlockStats(geometryPool.vertexBlock, &vertexPool);
+	vmaCalculateVirtualBlockStats(geometryPool.indexBlock, &indexPool);
+	ImGui::Text("Geometry pool: %llu / %llu vertices, %llu / %llu indices, %u meshes",
+				(unsigned long long)vertexPool.usedBytes, (unsigned long long)GeometryPool::vertexCapacity,
+				(unsigned long long)indexPool.usedBytes, (unsigned long long)GeometryPool::indexCapacity, vertexPool.allocationCount);
+
+	if (ImGui::Button("Dump JSON"))
+		DumpMemoryStats("playground");
+}
+
+void StartDrawIndexBenchmark()
+{
+	BuildBenchmarkGrid(drawIndexBenchmark.world, DrawIndexBenchmark::drawCount);
+
+	for (uint32_t i = 0; i < DRAW_INDEX_SOURCE_COUNT; i++)
+	{
+		drawIndexBenchmark.cpuRecordTime[i] = 0.0;
+		drawIndexBenchmark.gpuTime[i] = 0.0;
+	}
+
+	drawIndexBenchmark.source = 0;
+	drawIndexBenchmark.frame = 0;
+	drawIndexBenchmark.hasResults = false;
+	drawIndexBenchmark.running = true;
+}
+
+// Called after every benchmark frame, the GPU time is the one of the frame that last used this frame's slot
+// so the warmup frames also make sure no timings from the previous source are counted
+void UpdateDrawIndexBenchmark(double recordTime)
+{
+	DrawIndexBenchmark& bench = drawIndexBenchmark;
+	if (bench.frame >= DrawIndexBenchmark::warmupFrames)
+	{
+		bench.cpuRecordTime[bench.source] += recordTime;
+		bench.gpuTime[bench.source] += gpuFrameTime;
+	}
+
+	if (++bench.frame < DrawIndexBenchmark::warmupFrames + DrawIndexBenchmark::measuredFrames)
+		return;
+
+	bench.cpuRecordTime[bench.source] /= DrawIndexBenchmark::measuredFrames;
+	bench.gpuTime[bench.source] /= DrawIndexBenchmark::measuredFrames;
+	bench.frame = 0;
+
+	if (++bench.source < DRAW_INDEX_SOURCE_COUNT)
+		return;
+
+	bench.running = false;
+	bench.hasResults = true;
+	bench.world.Clear();
+
+	std::cout << "Draw index benchmark (" << DrawIndexBenchmark::drawCount << " draws on " << gpuProperties.deviceName << ")" << std::endl;
+	for (uint32_t i = 0; i < DRAW_INDEX_SOURCE_COUNT; i++)
+	{
+		std::cout << "  " << drawIndexSourceNames[i] << ": record " << bench.cpuRecordTime[i] << " ms, gpu " << bench.gpuTime[i] << " ms" << std::endl;
+	}
+	DumpMemoryStats("draw_index_benchmark");
+}
+
+void RunMeshOptimizerReport()
+{
+	meshOptimizerReport.entries.clear();
+	std::cout << "Mesh optimizer, FIFO16 ACMR / ATVR before -> optimized -> drawn:" << std::endl;
+	for (const std::filesystem::directory_entry& file : std::filesystem::directory_iterator("assets"))
+	{
+		if (file.path().extension() != ".obj")
+			continue;
+
+		Mesh mesh;
+		if (!mesh.loadFromObj(file.path().string().c_str(), "assets/"))
+			continue;
+
+		MeshOptimizerReport::Entry entry;
+		entry.name = file.path().filename().string();
+		entry.before = MeshOptimizer::AnalyzeVertexCache(mesh.indices, (uint32_t)mesh.vertices.size());
+		auto start = std::chrono::high_resolution_clock::now();
+		OptimizeMesh(mesh);
+		entry.time = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		entry.optimized = MeshOptimizer::AnalyzeVertexCache(mesh.indices, (uint32_t)mesh.vertices.size());
+
+		// Cook it like Init does, meshlet building reorders triangles inside each meshlet so the drawn order differs
+		BuildLods(mesh);
+		BuildMeshlets(mesh);
+		std::vector<uint32_t> lod0(mesh.indices.begin() + mesh.lods[0].indexOffset,
+								   mesh.indices.begin() + mesh.lods[0].indexOffset + mesh.lods[0].indexCount);
+		entry.drawn = MeshOptimizer::AnalyzeVertexCache(lod0, (uint32_t)mesh.vertices.size());
+		meshOptimizerReport.entries.push_back(entry);
+
+		std::cout << "  " << entry.name << " (" << entry.before.triangles << " triangles): "
+				  << entry.before.acmr << " / " << entry.before.atvr << " -> " << entry.optimized.acmr << " / " << entry.optimized.atvr
+				  << " -> " << entry.drawn.acmr << " / " << entry.drawn.atvr << " in " << entry.time << " ms" << std::endl;
+	}
+}
+
+void RunSceneGraphBenchmark()
+{
+	SceneGraphBenchmark& bench = sceneGraphBenchmark;
+	SceneGraph::Graph graph;
+	graph.Reserve(SceneGraphBenchmark::nodeCount);
+	std::vector<uint32_t> roots;
+	for (uint32_t r = 0; r < SceneGraphBenchmark::rootCount; r++)
+	{
+		uint32_t root = graph.AddNode(SceneGraph::InvalidNode, glm::vec3(float(r % 32) * 4.0f, 0.0f, float(r / 32) * 4.0f));
+		roots.push_back(root);
+		for (uint32_t c = 0; c < SceneGraphBenchmark::childCount; c++)
+		{
+			uint32_t child = graph.AddNode(root, glm::vec3(1.0f, float(c), 0.0f), glm::angleAxis(float(c), glm::vec3(0.0f, 1.0f, 0.0f)));
+			for (uint32_t l = 0; l < SceneGraphBenchmark::leafCount; l++)
+				graph.AddNode(child, glm::vec3(0.0f, 0.0f, float(l) * 0.1f), glm::quat(1.0f, 0.0f, 0.0f, 0.0f), glm::vec3(0.5f));
+		}
+	}
+	graph.Update();
+
+	// Only Update is timed, moving the roots is the caller's cost
+	auto measure = [&](uint32_t rootStride)
+	{
+		double total = 0.0;
+		for (uint32_t i = 0; i < SceneGraphBenchmark::iterations; i++)
+		{
+			if (rootStride > 0)
+			{
+				const glm::quat rotation = glm::angleAxis(float(i) * 0.01f, glm::vec3(0.0f, 1.0f, 0.0f));
+				for (uint32_t r = 0; r < roots.size(); r += rootStride)
+					graph.SetRotation(roots[r], rotation);
+			}
+			auto start = std::chrono::high_resolution_clock::now();
+			graph.Update();
+			total += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		}
+		return total / SceneGraphBenchmark::iterations;
+	};
+	bench.fullUpdateTime = measure(1);
+	bench.sparseUpdateTime = measure(100);
+	bench.cleanUpdateTime = measure(0);
+	bench.hasResults = true;
+
+	std::cout << "Scene graph update, " << SceneGraphBenchmark::nodeCount << " nodes: all dirty " << bench.fullUpdateTime
+			  << " ms, 1% of roots dirty " << bench.sparseUpdateTime << " ms, clean " << bench.cleanUpdateTime << " ms" << std::endl;
+}
+
+void StartJobScalingBenchmark()
+{
+	BuildBenchmarkGrid(jobScalingBenchmark.world, MAX_OBJECTS);
+	jobScalingBenchmark.graphTime.assign(jobSystem.WorkerCount(), 0.0);
+	jobScalingBenchmark.workers = 1;
+	jobScalingBenchmark.frame = 0;
+	jobScalingBenchmark.hasResults = false;
+	jobScalingBenchmark.running = true;
+	jobSystem.SetActiveWorkers(1);
+}
+
+void UpdateJobScalingBenchmark()
+{
+	JobScalingBenchmark& bench = jobScalingBenchmark;
+	if (bench.frame >= JobScalingBenchmark::warmupFrames)
+		bench.graphTime[bench.workers - 1] += frameGraphTime;
+
+	if (++bench.frame < JobScalingBenchmark::warmupFrames + JobScalingBenchmark::measuredFrames)
+		return;
+
+	bench.graphTime[bench.workers - 1] /= JobScalingBenchmark::measuredFrames;
+	bench.frame = 0;
+
+	if (++bench.workers <= jobSystem.WorkerCount())
+	{
+		jobSystem.SetActiveWorkers(bench.workers);
+		return;
+	}
+
+	bench.running = false;
+	bench.hasResults = true;
+	bench.world.Clear();
+	jobSystem.SetActiveWorkers(workerThreadCount);
+
+	std::cout << "Job system scaling benchmark (" << MAX_OBJECTS << " objects, frame graph time)" << std::endl;
+	for (uint32_t i = 0; i < bench.graphTime.size(); i++)
+	{
+		std::cout << "  " << i + 1 << " workers: " << bench.graphTime[i] << " ms, speedup " << bench.graphTime[0] / bench.graphTime[i] << "x" << std::endl;
+	}
+	DumpMemoryStats("job_scaling_benchmark");
+}
+
+// Transforms an object space bounding sphere, the radius is scaled by the largest axis scale
+glm::vec4 TransformBounds(const glm::vec4& bounds, const glm::mat4& transform)
+{
+	glm::vec3 center = transform * glm::vec4(glm::vec3(bounds), 1.0f);
+	float scale = std::max({ glm::length(glm::vec3(transform[0])), glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2])) });
+	return glm::vec4(center, bounds.w * scale);
+}
+
+// Frustum planes (xyz = normal pointing inside, w = distance) from a view projection matrix
+void ExtractFrustumPlanes(const glm::mat4& viewproj, glm::vec4 planes[6])
+{
+	glm::mat4 m = glm::transpose(viewproj);
+	planes[0] = m[3] + m[0]; // left
+	planes[1] = m[3] - m[0]; // right
+	planes[2] = m[3] + m[1]; // bottom
+	planes[3] = m[3] - m[1]; // top
+	planes[4] = m[3] + m[2]; // near
+	planes[5] = m[3] - m[2]; // far
+	for (int i = 0; i < 6; i++)
+		planes[i] /= glm::length(glm::vec3(planes[i]));
+}
+
+bool SphereInFrustum(const glm::vec4& sphere, const glm::vec4 planes[6])
+{
+	for (int i = 0; i < 6; i++)
+	{
+		if (glm::dot(glm::vec3(planes[i]), glm::vec3(sphere)) + planes[i].w < -sphere.w)
+			return false;
+	}
+	return true;
+}
+
+// Range is where the light falls to 1/256 of its peak, past that it is cut off so the clusters can skip it
+GPUPointLight PackPointLight(const PointLight& light, float maxRange)
+{
+	const glm::vec3 diffuse = glm::vec3(light.color) * light.diffuseStrength;
+	const glm::vec3 specular = glm::vec3(light.color);
+	const float peak = std::max({ diffuse.r * (1.0f + light.ambientStrength), diffuse.g * (1.0f + light.ambientStrength),
+								  diffuse.b * (1.0f + light.ambientStrength), specular.r, specular.g, specular.b });
+	// Solves linear * d + quadratic * d^2 = peak * 256 - constant
+	const float target = peak * 256.0f - 1.0f;
+	float range = maxRange;
+	if (target <= 0.0f)
+		range = 0.0f;
+	else if (light.attenuationQuadratic > 0.0f)
+		range = (-light.attenuationLinear + sqrt(light.attenuationLinear * light.attenuationLinear + 4.0f * light.attenuationQuadratic * target)) / (2.0f * light.attenuationQuadratic);
+	else if (light.attenuationLinear > 0.0f)
+		range = target / light.attenuationLinear;
+
+	GPUPointLight packed;
+	packed.positionRange = glm::vec4(light.position, std::min(range, maxRange));
+	packed.diffuse = glm::vec4(diffuse, light.ambientStrength);
+	packed.specular = glm::vec4(specular, 0.0f);
+	packed.attenuation = glm::vec4(1.0f, light.attenuationLinear, light.attenuationQuadratic, 0.0f);
+	return packed;
+}
+
+// Replaces the orbiting lights with count new ones of random colors around the knot and the benchmark grid
+void ScatterLights(uint32_t count)
+{
+	std::vector<Ecs::Entity> orbiting;
+	world.ForEach<LightOrbit>([&](Ecs::Entity entity, LightOrbit&) { orbiting.push_back(entity); });
+	for (Ecs::Entity entity : orbiting)
+		world.Destroy(entity);
+
+	std::mt19937 random(count);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	for (uint32_t i = 0; i < count; i++)
+	{
+		PointLight light = {};
+		glm::vec3 color = { unit(random), unit(random), unit(random) };
+		light.color = glm::vec4(color / std::max({ color.r, color.g, color.b, 0.01f }), 1.0f);
+		light.diffuseStrength = 1.0f;
+		light.ambientStrength = 0.0f;
+		light.attenuationLinear = 0.7f;
+		light.attenuationQuadratic = 1.8f;
+
+		LightOrbit orbit;
+		orbit.center = { -60.0f + 120.0f * unit(random), -14.0f + 6.0f * unit(random), -20.0f + 120.0f * unit(random) };
+		orbit.radius = 1.0f + 3.0f * unit(random);
+		orbit.speed = 0.5f + 1.5f * unit(random);
+		orbit.phase = 6.2831853f * unit(random);
+		light.position = orbit.center;
+		world.Create(light, orbit);
+	}
+}
+
+void StartLightingBenchmark()
+{
+	LightingBenchmark& bench = lightingBenchmark;
+	bench.restoreLightCount = 0;
+	world.ForEach<LightOrbit>([&](Ecs::Entity, LightOrbit&) { bench.restoreLightCount++; });
+	for (uint32_t i = 0; i < LightingBenchmark::lightCountCount; i++)
+	{
+		for (uint32_t c = 0; c < LightingBenchmark::configCount; c++)
+			bench.gpuTime[i][c] = 0.0;
+	}
+
+	bench.config = 0;
+	bench.lightStep = 0;
+	bench.frame = 0;
+	bench.hasResults = false;
+	bench.running = true;
+	ScatterLights(LightingBenchmark::lightCounts[0]);
+}
+
+// Called after every benchmark frame, like UpdateDrawIndexBenchmark the warmup frames keep the previous configuration's
+// GPU times out
+void UpdateLightingBenchmark()
+{
+	LightingBenchmark& bench = lightingBenchmark;
+	if (bench.frame >= LightingBenchmark::warmupFrames)
+		bench.gpuTime[bench.lightStep][bench.config] += gpuFrameTime;
+
+	if (++bench.frame < LightingBenchmark::warmupFrames + LightingBenchmark::measuredFrames)
+		return;
+
+	bench.gpuTime[bench.lightStep][bench.config] /= LightingBenchmark::measuredFrames;
+	bench.frame = 0;
+
+	if (++bench.config < LightingBenchmark::configCount)
+		return;
+
+	bench.config = 0;
+	if (++bench.lightStep < LightingBenchmark::lightCountCount)
+	{
+		ScatterLights(LightingBenchmark::lightCounts[bench.lightStep]);
+		return;
+	}
+
+	bench.running = false;
+	bench.hasResults = true;
+	ScatterLights(bench.restoreLightCount);
+
+	std::cout << "Lighting benchmark (" << swapchainExtent.width << "x" << swapchainExtent.height << " on " << gpuProperties.deviceName << ", GPU frame time)" << std::endl;
+	for (uint32_t i = 0; i < LightingBenchmark::lightCountCount; i++)
+	{
+		std::cout << "  " << LightingBenchmark::lightCounts[i] << " orbiting lights:";
+		for (uint32_t c = 0; c < LightingBenchmark::configCount; c++)
+			std::cout << " " << lightingConfigNames[c] << " " << bench.gpuTime[i][c] << " ms" << (c + 1 < LightingBenchmark::configCount ? "," : "");
+		std::cout << std::endl;
+	}
+	DumpMemoryStats("lighting_benchmark");
+}
+
+// Builds the Playground window, runs as a task of the frame graph so it must not touch what the other tasks use,
+// actions that do are queued in uiActions
+void BuildImGui()
+{
+	ImGuiWindowFlags window_flags = ImGuiWindowFlags_NoFocusOnAppearing | ImGuiWindowFlags_NoNav;
+	if (ImGui::Begin("Playground", NULL, window_flags))
+	{
+		ImGui::Text("Render Time: %.1f ms", deltaTime * 1000.0f);
+		ImGui::Text("GPU Time: %.2f ms", gpuFrameTime);
+		ImGui::Text("Frame Graph: %.3f ms (record %.3f ms)", frameGraphTime, recordTime);
+		ImGui::Text("Visible Objects: %u", frameStats.visibleObjects);
+		ImGui::Separator();
+		if (ImGui::Button("Reload Shaders"))
+		{
+			uiActions.push_back(CreatePipeline);
+		}
+		ImGui::Separator();
+		// Only the light gather before the frame graph reads the lights, editing them here does not race
+		PointLight* pointLight = world.Get<PointLight>(lightEntity);
+		if (pointLight && ImGui::CollapsingHeader("Light Properties", ImGuiTreeNodeFlags_DefaultOpen))
+		{
+			ImGui::Text("Light Color:");
+			ImGui::SameLine();
+			ImGui::ColorEdit4("##picker", (float*)&pointLight->color, ImGuiColorEditFlags_DisplayHex | ImGuiColorEditFlags_NoInputs | ImGuiColorEditFlags_NoLabel);
+			ImGui::Text("Light Position:       ");
+			ImGui::SameLine();
+			ImGui::DragFloat3("##lightPosition", (float*)&pointLight->position, 1.0f, 0.0f, 0.0f, "%.2f", 0);
+			ImGui::Text("Diffuse Strength:     ");
+			ImGui::SameLine();
+			ImGui::DragFloat("##diffuseStrength", &pointLight->diffuseStrength, 0.1f, 0.0f, 1.0f, "%.3f", ImGuiSliderFlags_AlwaysClamp);
+			ImGui::Text("Ambient Strength:     ");
+			ImGui::SameLine();
+			ImGui::DragFloat("##ambientStrength", &pointLight->ambientStrength, 0.1f, 0.0f, 1.0f, "%.3f", ImGuiSliderFlags_AlwaysClamp);
+			ImGui::Text("Attenuation Linear:   ");
+			ImGui::SameLine();
+			ImGui::DragFloat("##attenuationLinear", &pointLight->attenuationLinear, 0.01f, 0.0f, 1.0f, "%.3f", ImGuiSliderFlags_AlwaysClamp);
+			ImGui::Text("Attenuation Quadratic:");
+			ImGui::SameLine();
+			ImGui::DragFloat("##attenuationQuadratic", &pointLight->attenuationQuadratic, 0.01f, 0.0f, 1.0f, "%.3f", ImGuiSliderFlags_AlwaysClamp);
+		}
+		if (ImGui::CollapsingHeader("Lighting"))
+		{
+			int path = (int)lightingPath;
+			if (ImGui::Combo("Path", &path, lightingPathNames, LIGHTING_PATH_COUNT))
+				lightingPath = (LightingPath)path;
+			if (lightingPath == LIGHTING_FORWARD)
+			{
+				ImGui::Checkbox("Clustered", &clusteredLighting);
+				ImGui::Text("%ux%ux%u clusters, up to %u lights each", CLUSTER_GRID_X, CLUSTER_GRID_Y, CLUSTER_GRID_Z, MAX_LIGHTS_PER_CLUSTER);
+			}
+			else
+			{
+				ImGui::Text("%ux%u pixel tiles, up to %u lights each", DEFERRED_TILE_SIZE, DEFERRED_TILE_SIZE, MAX_LIGHTS_PER_TILE);
+			}
+			ImGui::Text("Point Lights: %u", pointLightCount);
+			ImGui::SliderInt("Orbiting Lights", &scatteredLightCount, 0, MAX_POINT_LIGHTS - 1);
+			// The lighting benchmark scatters its own lights
+			if (ImGui::Button("Scatter Lights") && !lightingBenchmark.running)
+			{
+				const uint32_t count = (uint32_t)scatteredLightCount;
+				uiActions.push_back([count] { ScatterLights(count); });
+			}
+		}
+		if (ImGui::CollapsingHeader("Material Features"))
+		{
+			ImGui::CheckboxFlags("Specular Map", &materialFeatures, MATERIAL_FEATURE_SPECULAR_MAP);
+			ImGui::CheckboxFlags("Emission Map", &materialFeatures, MATERIAL_FEATURE_EMISSION_MAP);
+			ImGui::CheckboxFlags("Attenuation", &materialFeatures, MATERIAL_FEATURE_ATTENUATION);
+			ImGui::CheckboxFlags("Fog", &materialFeatures, MATERIAL_FEATURE_FOG);
+			if (materialFeatures & MATERIAL_FEATURE_FOG)
+			{
+				ImGui::Text("Fog Color:");
+				ImGui::SameLine();
+				ImGui::ColorEdit3("##fogColor", (float*)&fogColor, ImGuiColorEditFlags_DisplayHex | ImGuiColorEditFlags_NoInputs | ImGuiColorEditFlags_NoLabel);
+				ImGui::Text("Fog Distances:        ");
+				ImGui::SameLine();
+				ImGui::DragFloatRange2("##fogDistances", &fogStart, &fogEnd, 1.0f, 0.0f, 1000.0f, "%.1f");
+			}
+			ImGui::Text("Pipeline Variants: %d", (int)pipelineVariants.size());
+		}
+		if (ImGui::CollapsingHeader("Frame Pacing"))
+		{
+			int presentModeIndex = 0;
+			for (int i = 0; i < ARRAYSIZE(presentModes); i++)
+			{
+				if (presentModes[i] == framePacing.requestedPresentMode)
+					presentModeIndex = i;
+			}
+			if (ImGui::Combo("Present Mode", &presentModeIndex, presentModeNames, ARRAYSIZE(presentModeNames)))
+			{
+				framePacing.requestedPresentMode = presentModes[presentModeIndex];
+				uiActions.push_back([] { swapchainOutOfDate = true; });
+			}
+			ImGui::Text("Presenting with %s", PresentModeName(framePacing.presentMode));
+			ImGui::SliderInt("Frames In Flight", &framePacing.framesInFlight, 1, MAX_FRAME_OVERLAP);
+			ImGui::Checkbox("Limit Frame Rate", &framePacing.limitFrameRate);
+			if (framePacing.limitFrameRate)
+				ImGui::SliderInt("Target FPS", &framePacing.targetFrameRate, 10, 500);
+			ImGui::Text("Input to present: %.2f ms", framePacing.presentLatency);
+			ImGui::Text("Input to GPU done: %.2f ms", framePacing.gpuLatency);
+		}
+		if (ImGui::CollapsingHeader("Job System"))
+		{
+			if (ImGui::SliderInt("Worker Threads", &workerThreadCount, 1, (int)jobSystem.WorkerCount()))
+				uiActions.push_back([] { jobSystem.SetActiveWorkers(workerThreadCount); });
+			ImGui::Checkbox("Parallel Recording", &parallelRecording);
+			ImGui::Checkbox("Frustum Culling", &frustumCulling);
+			ImGui::Checkbox("Depth Prepass", &depthPrepass);
+			for (const std::pair<const char*, double>& task : frameStats.taskTimes)
+				ImGui::Text("  %-18s %.3f ms", task.first, task.second);
+		}
+		if (ImGui::CollapsingHeader("Bounding Volume Hierarchy"))
+		{
+			ImGui::Checkbox("Hierarchical Culling", &hierarchicalCulling);
+			const BvhReport& bvh = frameStats.bvh;
+			ImGui::Text("Nodes: %u over %u objects, built %u times", bvh.nodes, bvh.objects, bvh.builds);
+			ImGui::Text("SAH Cost: %.2f (%.2f when built)", bvh.cost, bvh.buildCost);
+			ImGui::Text("Culling: %u nodes visited, %u spheres tested", bvh.cull.nodesVisited, bvh.cull.spheresTested);
+			if (world.Alive(pickedEntity))
+				ImGui::Text("Picked: entity %u at %.2f", pickedEntity.index, pickedDistance);
+			else
+				ImGui::Text("Left click an object to pick it");
+		}
+		if (ImGui::CollapsingHeader("Level of Detail"))
+		{
+			ImGui::Checkbox("LOD Selection", &lodSelection);
+			ImGui::SliderFloat("Max Error (px)", &lodErrorPixels, 0.25f, 16.0f, "%.2f");
+			ImGui::Text("Triangles: %llu of %llu (%.0f%%)", (unsigned long long)frameStats.lodTriangles, (unsigned long long)frameStats.fullTriangles,
+						frameStats.fullTriangles > 0 ? 100.0 * double(frameStats.lodTriangles) / double(frameStats.fullTriangles) : 100.0);
+			for (const Mesh* mesh : { &monkeyMesh, &cubeMesh })
+			{
+				for (uint32_t i = 0; i < mesh->lods.size(); i++)
+					ImGui::Text("  %s LOD %u: %u triangles, error %.4f", mesh == &monkeyMesh ? "Knot" : "Cube", i, mesh->lods[i].indexCount / 3, mesh->lods[i].error);
+			}
+		}
+		if (ImGui::CollapsingHeader("Cluster Culling"))
+		{
+			if (!clusterCullingSupported)
+			{
+				ImGui::Text("Not supported, needs drawIndirectCount and multiDrawIndirect");
+			}
+			else
+			{
+				ImGui::Checkbox("Cluster Culling", &clusterCulling);
+				ImGui::Checkbox("Backface Cones", &meshletBackfaceCulling);
+				ImGui::Checkbox("Occlusion (last frame's depth)", &meshletOcclusionCulling);
+				ImGui::Text("Meshlets: drawn %u of %u", meshletsDrawn, frameStats.meshletCandidates);
+			}
+			for (const Mesh* mesh : { &monkeyMesh, &cubeMesh })
+			{
+				for (uint32_t i = 0; i < mesh->lods.size(); i++)
+					ImGui::Text("  %s LOD %u: %u meshlets", mesh == &monkeyMesh ? "Knot" : "Cube", i, mesh->lods[i].meshletCount);
+			}
+		}
+		if (ImGui::CollapsingHeader("Memory"))
+		{
+			BuildMemoryPanel();
+		}
+		if (ImGui::CollapsingHeader("Render Graph"))
+		{
+			const RenderGraph::GraphStats& stats = renderGraph.Stats();
+			for (RenderGraph::PassId i = 0; i < renderGraph.PassCount(); i++)
+				ImGui::Text("  %-18s %s", renderGraph.PassName(i), renderGraph.PassCulled(i) ? "culled" : "");
+			ImGui::Text("Barriers: %u batches, %u image, %u buffer", stats.barrierBatchCount, stats.imageBarrierCount, stats.bufferBarrierCount);
+			ImGui::Text("Transient Images: %u in %u blocks", stats.transientImageCount, stats.transientMemoryBlocks);
+			ImGui::Text("Transient Memory: %.1f MB (%.1f MB unaliased)", stats.transientBytes / (1024.0 * 1024.0), stats.transientBytesUnaliased / (1024.0 * 1024.0));
+		}
+		if (ImGui::CollapsingHeader("Benchmarks"))
+		{
+			if (drawIndexBenchmark.running)
+			{
+				ImGui::Text("Running %s...", drawIndexSourceNames[drawIndexBenchmark.source]);
+			}
+			else if (jobScalingBenchmark.running)
+			{
+				ImGui::Text("Running with %u workers...", jobScalingBenchmark.workers);
+			}
+			else if (lightingBenchmark.running)
+			{
+				ImGui::Text("Running %s with %u lights...", lightingConfigNames[lightingBenchmark.config], LightingBenchmark::lightCounts[lightingBenchmark.lightStep]);
+			}
+			else
+			{
+				if (ImGui::Button("Draw Index Benchmark"))
+					uiActions.push_back(StartDrawIndexBenchmark);
+				if (ImGui::Button("Job System Scaling Benchmark"))
+					uiActions.push_back(StartJobScalingBenchmark);
+				if (ImGui::Button("Lighting Benchmark"))
+					uiActions.push_back(StartLightingBenchmark);
+				if (ImGui::Button("Mesh Optimizer Report"))
+					uiActions.push_back(RunMeshOptimizerReport);
+				if (ImGui::Button("Scene Graph Benchmark"))
+					uiActions.push_back(RunSceneGraphBenchmark);
+			}
 
-	VkBufferCreateInfo meshBufferInfo = {};
-	meshBufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-	meshBufferInfo.size = monkeyMesh.vertices.size() * sizeof(Vertex);
-	meshBufferInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+			if (drawIndexBenchmark.hasResults)
+			{
+				ImGui::Text("%u draws, CPU record / GPU time:", DrawIndexBenchmark::drawCount);
+				for (uint32_t i = 0; i < DRAW_INDEX_SOURCE_COUNT; i++)
+					ImGui::Text("  %-22s %.3f ms / %.3f ms", drawIndexSourceNames[i], drawIndexBenchmark.cpuRecordTime[i], drawIndexBenchmark.gpuTime[i]);
+			}
+
+			if (jobScalingBenchmark.hasResults)
+			{
+				ImGui::Text("%u objects, frame graph time:", MAX_OBJECTS);
+				for (uint32_t i = 0; i < jobScalingBenchmark.graphTime.size(); i++)
+					ImGui::Text("  %2u workers %.3f ms (%.2fx)", i + 1, jobScalingBenchmark.graphTime[i], jobScalingBenchmark.graphTime[0] / jobScalingBenchmark.graphTime[i]);
+			}
 
-	VmaAllocationCreateInfo meshVMAAllocInfo = {};
-	meshVMAAllocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+			if (lightingBenchmark.hasResults)
+			{
+				ImGui::Text("Orbiting lights, GPU time %s / %s / %s:", lightingConfigNames[0], lightingConfigNames[1], lightingConfigNames[2]);
+				for (uint32_t i = 0; i < LightingBenchmark::lightCountCount; i++)
+					ImGui::Text("  %5u  %.3f ms / %.3f ms / %.3f ms", LightingBenchmark::lightCounts[i],
+								lightingBenchmark.gpuTime[i][0], lightingBenchmark.gpuTime[i][1], lightingBenchmark.gpuTime[i][2]);
+			}
 
-	vkCheck(vmaCreateBuffer(allocator, &meshBufferInfo, &meshVMAAllocInfo,
-							&monkeyMesh.vertexBuffer.buffer, &monkeyMesh.vertexBuffer.allocation, nullptr));
+			if (!meshOptimizerReport.entries.empty())
+			{
+				ImGui::Text("FIFO16 ACMR / ATVR before -> optimized -> drawn (meshlet order):");
+				for (const MeshOptimizerReport::Entry& entry : meshOptimizerReport.entries)
+					ImGui::Text("  %-18s %6u tris %.3f / %.3f -> %.3f / %.3f -> %.3f / %.3f", entry.name.c_str(), entry.before.triangles,
+								entry.before.acmr, entry.before.atvr, entry.optimized.acmr, entry.optimized.atvr, entry.drawn.acmr, entry.drawn.atvr);
+			}
 
-	immediate_submit([=](VkCommandBuffer cmd) {
-		VkBufferCopy copy;
-		copy.dstOffset = 0;
-		copy.srcOffset = 0;
-		copy.size = monkeyMesh.vertices.size() * sizeof(Vertex);
-		vkCmdCopyBuffer(cmd, stagingBuffer.buffer, monkeyMesh.vertexBuffer.buffer, 1, &copy);
-	});
+			if (sceneGraphBenchmark.hasResults)
+			{
+				ImGui::Text("%u scene graph nodes, update time:", SceneGraphBenchmark::nodeCount);
+				ImGui::Text("  all dirty        %.3f ms", sceneGraphBenchmark.fullUpdateTime);
+				ImGui::Text("  1%% roots dirty   %.3f ms", sceneGraphBenchmark.sparseUpdateTime);
+				ImGui::Text("  clean            %.3f ms", sceneGraphBenchmark.cleanUpdateTime);
+			}
+		}
+	}
+	ImGui::End();
+}
 
-	vmaDestroyBuffer(allocator, stagingBuffer.buffer, stagingBuffer.allocation);
+// Sleeps until the next frame is due, the last millisecond is spun since sleep is too coarse for it
+void WaitForNextFrame()
+{
+	const double interval = 1.0 / std::max(framePacing.targetFrameRate, 1);
+	double now = glfwGetTime();
+	// Don't try to catch up after a slow frame, that would only produce a burst of frames
+	if (framePacing.nextFrameTime < now - interval)
+		framePacing.nextFrameTime = now;
 
-	CreatePipeline();
+	while (now < framePacing.nextFrameTime)
+	{
+		const double remaining = framePacing.nextFrameTime - now;
+		if (remaining > 0.001)
+			std::this_thread::sleep_for(std::chrono::duration<double>(remaining - 0.001));
+		else
+			std::this_thread::yield();
+		now = glfwGetTime();
+	}
+	framePacing.nextFrameTime += interval;
 }
 
-// Camera stuff
-glm::vec3 cameraPos = { 0, -10, 0 };
-glm::vec3 cameraFront = { 0, 0, 1 };
-glm::vec3 cameraTarget = { 0, 0, 0 };
-glm::vec3 cameraUp = { 0, 1, 0 };
-float deltaTime = 1.0f;
-float lastFrame = 0.0f;
-float lastX = width / 2;
-float lastY = height / 2;
-float yaw = 0.0f;
-float pitch = 0.0f;
-float sensitivity = 0.2f;
-float timer = 0;
-double x = 0, y = 0;
-bool firstTimeMouse = true;
-
-void mouse_callback(GLFWwindow* window, double xpos, double ypos)
+// Collects the GPU side latency of every frame the timeline shows complete and publishes the averages
+void UpdateLatencyReport()
 {
-	if (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_2))
+	const uint64_t completed = CompletedTimelineValue();
+	const double now = glfwGetTime();
+	for (uint32_t i = 0; i < MAX_FRAME_OVERLAP; i++)
 	{
-		glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_HIDDEN);
-
-		if (firstTimeMouse)
+		if (frames[i].latencyPending && frames[i].timelineValue <= completed)
 		{
-			lastX = xpos;
-			lastY = ypos;
-			firstTimeMouse = false;
+			// Only checked once per frame, so this is an upper bound by up to a frame
+			framePacing.gpuLatencySum += (now - frames[i].inputTime) * 1000.0;
+			framePacing.gpuLatencyCount++;
+			frames[i].latencyPending = false;
 		}
-
-		glfwGetCursorPos(window, &x, &y);
-		float xoffset = static_cast<float>(x) - lastX;
-		float yoffset = lastY - static_cast<float>(y);
-		lastX = static_cast<float>(x);
-		lastY = static_cast<float>(y);
-		xoffset *= sensitivity;
-		yoffset *= sensitivity;
-
-		yaw += xoffset;
-		pitch += yoffset;
-
-		if (pitch > 89.f)
-			pitch = 89.f;
-		if (pitch < -89.f)
-			pitch = -89.f;
-
-		glm::vec3 front;
-		front.x = -(sin(glm::radians(yaw)) * cos(glm::radians(pitch)));
-		front.y = -(sin(glm::radians(pitch)));
-		front.z = cos(glm::radians(yaw)) * cos(glm::radians(pitch));
-		cameraFront = glm::normalize(front);
 	}
-	else
+
+	if (now - framePacing.reportStart >= FramePacing::reportInterval)
 	{
-		glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_NORMAL);
-		firstTimeMouse = true;
+		if (framePacing.presentLatencyCount > 0)
+			framePacing.presentLatency = framePacing.presentLatencySum / framePacing.presentLatencyCount;
+		if (framePacing.gpuLatencyCount > 0)
+			framePacing.gpuLatency = framePacing.gpuLatencySum / framePacing.gpuLatencyCount;
+		framePacing.presentLatencySum = framePacing.gpuLatencySum = 0.0;
+		framePacing.presentLatencyCount = framePacing.gpuLatencyCount = 0;
+		framePacing.reportStart = now;
 	}
 }
 
 void Render(GLFWwindow* window)
 {
-	vkCheck(vkWaitForFences(device, 1, &GetCurrentFrame().renderFence, true, 1000000000));
-	vkCheck(vkResetFences(device, 1, &GetCurrentFrame().renderFence));
+	// Frames in flight only change here, between frames, every frame slot keeps waiting on its own timeline value
+	frameOverlap = (uint32_t)framePacing.framesInFlight;
 
-	vkCheck(vkResetCommandBuffer(GetCurrentFrame().mainCommandBuffer, NULL));
+	WaitTimelineValue(GetCurrentFrame().timelineValue);
+	UpdateLatencyReport();
+	// Lets VMA refresh its budget numbers once per frame
+	vmaSetCurrentFrameIndex(allocator, frameNumber);
+	deletionQueue.Collect(CompletedTimelineValue());
+
+	// The GPU is done with this frame, its transient descriptor sets and secondary command buffers can be recycled
+	GetCurrentFrame().descriptorAllocator.ResetPools();
+	for (uint32_t i = 0; i < MAX_RECORD_THREADS; i++)
+		vkCheck(vkResetCommandPool(device, GetCurrentFrame().threadCommandPools[i], 0));
+
+	if (GetCurrentFrame().timestampsWritten)
+	{
+		uint64_t timestamps[2];
+		VkResult result = vkGetQueryPoolResults(device, GetCurrentFrame().timestampQueryPool, 0, 2, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+		if (result == VK_SUCCESS)
+			gpuFrameTime = double(timestamps[1] - timestamps[0]) * gpuProperties.limits.timestampPeriod / 1000000.0;
+	}
+
+	if (GetCurrentFrame().meshletDrawsWritten)
+	{
+		void* countData;
+		vmaMapMemory(allocator, GetCurrentFrame().meshletDrawCountBuffer.allocation, &countData);
+		vmaInvalidateAllocation(allocator, GetCurrentFrame().meshletDrawCountBuffer.allocation, 0, sizeof(uint32_t));
+		// The cull shader counts past the buffer, only what fit was drawn
+		meshletsDrawn = std::min(*(uint32_t*)countData, MAX_MESHLET_DRAWS);
+		vmaUnmapMemory(allocator, GetCurrentFrame().meshletDrawCountBuffer.allocation);
+		GetCurrentFrame().meshletDrawsWritten = false;
+	}
+
+	if (swapchainOutOfDate && !RecreateSwapchain(window))
+		return;
 
 	uint32_t frameIndex;
-	vkCheck(vkAcquireNextImageKHR(device, swapchain, 1000000000, GetCurrentFrame().presentSemaphore, nullptr, &frameIndex));
+	VkResult acquireResult = vkAcquireNextImageKHR(device, swapchain, 1000000000, GetCurrentFrame().presentSemaphore, nullptr, &frameIndex);
+	if (acquireResult == VK_ERROR_OUT_OF_DATE_KHR)
+	{
+		// Nothing was signaled, skip the frame and acquire from the new swapchain next time
+		swapchainOutOfDate = true;
+		return;
+	}
+	// A suboptimal image is still acquired and its semaphore signaled, so render it and recreate after present
+	if (acquireResult == VK_SUBOPTIMAL_KHR)
+		swapchainOutOfDate = true;
+	else
+		vkCheck(acquireResult);
+
+	vkCheck(vkResetCommandBuffer(GetCurrentFrame().mainCommandBuffer, NULL));
 
 	VkCommandBufferBeginInfo cmdBeginInfo = {};
 	cmdBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
@@ -1486,22 +4063,8 @@ void Render(GLFWwindow* window)
 
 	vkCheck(vkBeginCommandBuffer(GetCurrentFrame().mainCommandBuffer, &cmdBeginInfo));
 
-	VkClearValue clearValue;
-	clearValue.color = { { 0.0f, 0.2f, 1.0f, 1.0f } };
-
-	VkClearValue depthClear;
-	depthClear.depthStencil.depth = 1.0f;
-
-	VkClearValue clearValues[2] = { clearValue, depthClear };
-
-	VkRenderPassBeginInfo renderPassBeginInfo = {};
-	renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-	renderPassBeginInfo.framebuffer = framebuffers[frameIndex];
-	renderPassBeginInfo.clearValueCount = 2;
-	renderPassBeginInfo.pClearValues = clearValues;
-	renderPassBeginInfo.renderPass = renderPass;
-	renderPassBeginInfo.renderArea.extent = { width, height };
-	renderPassBeginInfo.renderArea.offset = { 0, 0 };
+	vkCmdResetQueryPool(GetCurrentFrame().mainCommandBuffer, GetCurrentFrame().timestampQueryPool, 0, 2);
+	vkCmdWriteTimestamp(GetCurrentFrame().mainCommandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, GetCurrentFrame().timestampQueryPool, 0);
 
 	// Camera
 	float cameraSpeed = 10.0f * deltaTime;
@@ -1526,19 +4089,13 @@ void Render(GLFWwindow* window)
 
 	glfwSetCursorPosCallback(window, mouse_callback);
 
-	//make a model view matrix for rendering the object
-	//camera position
-	glm::vec3 camPos = { 0.f,0.f,-2.f };
-
-	//glm::mat4 view = glm::translate(glm::mat4(1.f), camPos);
+	//make a view matrix for rendering the scene
 	glm::mat4 view = glm::lookAtLH(cameraPos, cameraPos + cameraFront, cameraUp);
 	//camera projection
-	glm::mat4 projection = glm::perspective(glm::radians(70.f), (float)width / (float)height, 0.1f, 1000.0f);
+	const float nearPlane = 0.1f;
+	const float farPlane = 1000.0f;
+	glm::mat4 projection = glm::perspective(glm::radians(70.f), (float)swapchainExtent.width / (float)swapchainExtent.height, nearPlane, farPlane);
 	projection[1][1] *= -1;
-	glm::mat4 model = glm::translate(glm::mat4{ 1.0f }, glm::vec3{ 5, -12, -5 }) * glm::scale(glm::mat4(1.0f), glm::vec3(0.1f, 0.1f, 0.1f));
-
-	//calculate final mesh matrix
-	glm::mat4 meshMatrix = projection * view * model;
 
 	// Uniform buffers
 	GPUCameraData cameraData;
@@ -1552,54 +4109,42 @@ void Render(GLFWwindow* window)
 	memcpy(camData, &cameraData, sizeof(GPUCameraData));
 	vmaUnmapMemory(allocator, GetCurrentFrame().cameraBuffer.allocation);
 
+	// Picks against the BVH and draw chunks of the last frame, which drew what was clicked on
+	if (pickRequested)
+	{
+		pickRequested = false;
+		pickedEntity = {};
+		if (bvhWorld == &world && world.StructureVersion() == bvhVersion)
+		{
+			const glm::vec2 ndc = pickPosition * 2.0f - 1.0f;
+			const glm::vec4 farPoint = glm::inverse(cameraData.viewproj) * glm::vec4(ndc, 1.0f, 1.0f);
+			const glm::vec3 direction = glm::normalize(glm::vec3(farPoint) / farPoint.w - cameraPos);
+			uint32_t object;
+			if (objectBvh.Raycast(objectBounds.data(), cameraPos, direction, object, pickedDistance))
+			{
+				// The last chunk starting at or before the object holds it
+				auto chunkRef = std::upper_bound(drawChunks.begin(), drawChunks.end(), object,
+												 [](uint32_t index, const Ecs::ChunkRef& ref) { return index < ref.firstIndex; }) - 1;
+				pickedEntity = chunkRef->chunk->Entities()[object - chunkRef->firstIndex];
+			}
+		}
+	}
+
 	float framed = (frameNumber / 5500.f);
 	sceneParameters.ambientColor = { sin(framed),0,cos(framed),1 };
+	sceneParameters.fogColor = fogColor;
+	sceneParameters.fogDistances = { fogStart, fogEnd, 0.0f, 0.0f };
 	char* sceneData;
 	vmaMapMemory(allocator, sceneParameterBuffer.allocation, (void**)&sceneData);
-	int frameI = frameNumber % frame_overlap;
+	int frameI = frameNumber % frameOverlap;
 	sceneData += pad_uniform_buffer_size(sizeof(GPUSceneData)) * frameI;
 	memcpy(sceneData, &sceneParameters, sizeof(GPUSceneData));
 	vmaUnmapMemory(allocator, sceneParameterBuffer.allocation);
 
-	// Begin Render pass
-	vkCmdBeginRenderPass(GetCurrentFrame().mainCommandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
-	vkCmdBindPipeline(GetCurrentFrame().mainCommandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
-
-	VkDeviceSize offset = { 0 };
-	vkCmdBindVertexBuffers(GetCurrentFrame().mainCommandBuffer, 0, 1, &monkeyMesh.vertexBuffer.buffer, &offset);
-
-	//offset for our scene buffer
-	uint32_t uniform_offset = pad_uniform_buffer_size(sizeof(GPUSceneData)) * frameI;
-	// Bind global descriptor set (descriptor set #0)
-	vkCmdBindDescriptorSets(GetCurrentFrame().mainCommandBuffer,
-							VK_PIPELINE_BIND_POINT_GRAPHICS,
-							pipelineLayout,
-							0, 1,
-							&GetCurrentFrame().globalDescriptorSet,
-							1, &uniform_offset);
-
-	// Storage buffer
-	void* objectData;
-	vmaMapMemory(allocator, GetCurrentFrame().objectBuffer.allocation, &objectData);
-	GPUObjectData* objectSSBO = (GPUObjectData*)objectData;
-	objectSSBO->modelMatrix = model;
-	vmaUnmapMemory(allocator, GetCurrentFrame().objectBuffer.allocation);
-
-	// Bind object descriptor set (descriptor set #1)
-	vkCmdBindDescriptorSets(GetCurrentFrame().mainCommandBuffer,
-							VK_PIPELINE_BIND_POINT_GRAPHICS,
-							pipelineLayout,
-							1, 1,
-							&GetCurrentFrame().objectDescriptorSet,
-							0, nullptr);
-
-	// Bind texture descriptor set (descriptor set #2)
-	vkCmdBindDescriptorSets(GetCurrentFrame().mainCommandBuffer,
-							VK_PIPELINE_BIND_POINT_GRAPHICS,
-							pipelineLayout,
-							2, 1,
-							&textureSet,
-							0, nullptr);
+	// UI actions queued by the last frame's ImGui task
+	for (auto& action : uiActions)
+		action();
+	uiActions.clear();
 
 	// Material
 	Material materialConstants;
@@ -1612,52 +4157,734 @@ void Render(GLFWwindow* window)
 	memcpy(materialData, &materialConstants, sizeof(Material));
 	vmaUnmapMemory(allocator, materialBuffer.allocation);
 
-	// Light
-	light.diffuse = glm::vec4(glm::vec3(lightColor) * glm::vec3(diffuseStrength), 1.0f);
-	light.ambient = glm::vec4(glm::vec3(light.diffuse) * glm::vec3(ambientStrength), 1.0f);
-	light.specular = { 1.0f, 1.0f, 1.0f, 1.0f };
-	light.attenuation = { 1.0f, attenuationLinear, attenuationQuadratic, 1.0f };
-	light.position = glm::vec4(lightPosition, 1.0f);
-	void* lightData;
-	vmaMapMemory(allocator, lightBuffer.allocation, &lightData);
-	memcpy(lightData, &light, sizeof(Light));
-	vmaUnmapMemory(allocator, lightBuffer.allocation);
+	// Lights, the orbiting ones move first. Gathered before the frame graph so the UI can edit them while it runs.
+	// They hold still during the lighting benchmark so every configuration sees the same scene.
+	const float lightTime = lightingBenchmark.running ? 0.0f : static_cast<float>(glfwGetTime());
+	world.ForEach<PointLight, LightOrbit>([&](Ecs::Entity, PointLight& light, LightOrbit& orbit)
+	{
+		const float angle = orbit.phase + orbit.speed * lightTime;
+		light.position = orbit.center + glm::vec3(cos(angle), 0.0f, sin(angle)) * orbit.radius;
+	});
 
-	// Bind Scene Descriptor Set
-	uint32_t materialOffset[] = { 0, 0 };
-	vkCmdBindDescriptorSets(GetCurrentFrame().mainCommandBuffer,
-							VK_PIPELINE_BIND_POINT_GRAPHICS,
-							pipelineLayout,
-							3, 1,
-							&sceneDescriptorSet,
-							2, materialOffset);
+	GPUPointLight* pointLights;
+	vmaMapMemory(allocator, GetCurrentFrame().pointLightBuffer.allocation, (void**)&pointLights);
+	pointLightCount = 0;
+	world.ForEach<PointLight>([&](Ecs::Entity, const PointLight& light)
+	{
+		if (pointLightCount < MAX_POINT_LIGHTS)
+			pointLights[pointLightCount++] = PackPointLight(light, farPlane);
+	});
+	vmaUnmapMemory(allocator, GetCurrentFrame().pointLightBuffer.allocation);
+
+	// Read once, the UI may change them while the frame graph runs. The lighting benchmark picks its own configuration.
+	LightingPath path = lightingPath;
+	bool clusteredShading = clusteredLighting;
+	if (lightingBenchmark.running)
+	{
+		path = lightingConfigPaths[lightingBenchmark.config];
+		clusteredShading = lightingConfigClustered[lightingBenchmark.config];
+	}
+	const bool deferred = path == LIGHTING_DEFERRED;
+	// The tiled lighting pass lists its own lights
+	clusteredShading = clusteredShading && !deferred;
+	GPUClusterData clusterData = {};
+	clusterData.view = view;
+	clusterData.inverseProjection = glm::inverse(projection);
+	clusterData.screenSize = glm::vec4(swapchainExtent.width, swapchainExtent.height, 0.0f, 0.0f);
+	const float sliceScale = float(CLUSTER_GRID_Z) / log(farPlane / nearPlane);
+	clusterData.depthSlicing = glm::vec4(nearPlane, farPlane, sliceScale, sliceScale * log(nearPlane));
+	clusterData.lightCount = pointLightCount;
+	clusterData.flags = clusteredShading ? 0 : CLUSTER_LIGHTING_ALL_LIGHTS;
+	void* clusterBufferData;
+	vmaMapMemory(allocator, GetCurrentFrame().clusterBuffer.allocation, &clusterBufferData);
+	memcpy(clusterBufferData, &clusterData, sizeof(GPUClusterData));
+	vmaUnmapMemory(allocator, GetCurrentFrame().clusterBuffer.allocation);
+
+	// Snapshot of everything the frame graph reads, the ImGui task changes the live settings while it runs
+	// While a benchmark runs it replaces the scene
+	DrawIndexSource drawIndexSource = DRAW_INDEX_PUSH_CONSTANT;
+	Ecs::World* drawWorld = &world;
+	if (drawIndexBenchmark.running)
+	{
+		drawIndexSource = (DrawIndexSource)drawIndexBenchmark.source;
+		drawWorld = &drawIndexBenchmark.world;
+	}
+	else if (jobScalingBenchmark.running)
+	{
+		drawWorld = &jobScalingBenchmark.world;
+	}
+	// Nothing creates or destroys entities while the frame graph runs, the chunks stay where they are
+	const uint32_t objectCount = drawWorld->Query<Transform, MeshRef, MaterialRef, Bounds>(drawChunks);
+	// The draw index benchmark measures submission, every draw has to go through
+	const bool cullObjects = frustumCulling && !drawIndexBenchmark.running;
+	const bool hierarchical = cullObjects && hierarchicalCulling;
+	const uint32_t maxChunks = parallelRecording ? MAX_RECORD_THREADS : 1;
+	// Meshlets are culled on the GPU and drawn with one indirect count draw, which reads the object index from gl_BaseInstance
+	const bool clusters = clusterCulling && clusterCullingSupported && !drawIndexBenchmark.running;
+	if (clusters)
+		drawIndexSource = DRAW_INDEX_BASE_INSTANCE;
+	// Last frame's pyramid is only valid if last frame built one
+	const bool occlusion = clusters && meshletOcclusionCulling && depthPyramid.builtFrame != UINT32_MAX && depthPyramid.builtFrame == frameNumber - 1;
+	// Read once, the UI's checkbox may change it while the frame graph runs
+	const bool backfaceCones = meshletBackfaceCulling;
+
+	FrameData& frame = GetCurrentFrame();
+	VkCommandBuffer cmd = frame.mainCommandBuffer;
+	// Read once, the UI may toggle it while the frame graph runs
+	const bool prepass = depthPrepass;
+	// The deferred path draws the G-buffer instead of lit color, the lighting pass applies attenuation and fog
+	const ScenePipelinePass colorPass = deferred ? (prepass ? SCENE_PASS_GBUFFER_PREPASS : SCENE_PASS_GBUFFER)
+												 : (prepass ? SCENE_PASS_COLOR_PREPASS : SCENE_PASS_COLOR);
+	VkPipeline scenePipeline = GetPipelineVariant(materialFeatures, drawIndexSource, colorPass);
+	uint32_t deferredLightingFlags = 0;
+	if (materialFeatures & MATERIAL_FEATURE_ATTENUATION)
+		deferredLightingFlags |= DEFERRED_LIGHTING_ATTENUATION;
+	if (materialFeatures & MATERIAL_FEATURE_FOG)
+		deferredLightingFlags |= DEFERRED_LIGHTING_FOG;
+	VkPipeline depthPipeline = prepass ? GetPipelineVariant(materialFeatures, drawIndexSource, SCENE_PASS_DEPTH_ONLY) : VK_NULL_HANDLE;
+	//offset for our scene buffer
+	uint32_t sceneOffset = pad_uniform_buffer_size(sizeof(GPUSceneData)) * frameI;
+
+	glm::vec4 frustumPlanes[6];
+	ExtractFrustumPlanes(cameraData.viewproj, frustumPlanes);
+
+	objectVisible.resize(objectCount);
+	objectLods.resize(objectCount);
+	objectBounds.resize(objectCount);
+
+	// Pixels per object space unit at distance 1, to project LOD errors on screen
+	const float lodProjectionScale = fabsf(cameraData.projection[1][1]) * 0.5f * (float)swapchainExtent.height;
+	const glm::vec3 lodCameraPosition = glm::vec3(cameraData.position);
+	const bool selectLods = lodSelection && !drawIndexBenchmark.running;
+	// Read once, the UI's slider may change it while the frame graph runs
+	const float maxLodError = lodErrorPixels;
+
+	// Scene secondaries continue the dynamic rendering pass, they inherit its attachment formats instead of a render pass
+	VkCommandBufferInheritanceRenderingInfo inheritanceRenderingInfo = {};
+	inheritanceRenderingInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO;
+	inheritanceRenderingInfo.colorAttachmentCount = deferred ? GBUFFER_TARGET_COUNT : 1;
+	inheritanceRenderingInfo.pColorAttachmentFormats = deferred ? gbufferFormats : &swapchainImageFormat;
+	inheritanceRenderingInfo.depthAttachmentFormat = depthFormat;
+	inheritanceRenderingInfo.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+	VkCommandBufferInheritanceInfo inheritanceInfo = {};
+	inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+	inheritanceInfo.pNext = &inheritanceRenderingInfo;
+
+	VkCommandBufferBeginInfo secondaryBeginInfo = {};
+	secondaryBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	secondaryBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+	secondaryBeginInfo.pInheritanceInfo = &inheritanceInfo;
+
+	// The depth prepass has no color attachment
+	VkCommandBufferInheritanceRenderingInfo depthInheritanceRenderingInfo = inheritanceRenderingInfo;
+	depthInheritanceRenderingInfo.colorAttachmentCount = 0;
+	depthInheritanceRenderingInfo.pColorAttachmentFormats = nullptr;
+
+	VkCommandBufferInheritanceInfo depthInheritanceInfo = inheritanceInfo;
+	depthInheritanceInfo.pNext = &depthInheritanceRenderingInfo;
+
+	VkCommandBufferBeginInfo depthSecondaryBeginInfo = secondaryBeginInfo;
+	depthSecondaryBeginInfo.pInheritanceInfo = &depthInheritanceInfo;
+
+	VkCommandBufferInheritanceInfo overlayInheritanceInfo = {};
+	overlayInheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+	overlayInheritanceInfo.renderPass = overlayRenderPass;
+	overlayInheritanceInfo.subpass = 0;
+	overlayInheritanceInfo.framebuffer = framebuffers[frameIndex];
+
+	VkCommandBufferBeginInfo overlaySecondaryBeginInfo = {};
+	overlaySecondaryBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	overlaySecondaryBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+	overlaySecondaryBeginInfo.pInheritanceInfo = &overlayInheritanceInfo;
+
+	uint32_t chunkCount = 1;
+
+	// Frame graph
+	// Update Transforms -> Cull -> Write Objects
+	//                           -> Record Draws
+	// Build ImGui
+	frameGraph.Clear();
+
+	// Systems run over whole chunks, a job takes a few of them so it has a few hundred entities to work on
+	const uint32_t chunksPerJob = 4;
+
+	Jobs::TaskGraph::TaskId updateTransforms = frameGraph.Add("Update Transforms", [&]
+	{
+		// Only what changed below a dirty node is recomputed and copied. The graph drives the main world's transforms, while a
+		// benchmark world is drawn its dirty nodes wait, updating now would clear the changed flags before the main world saw them.
+		const bool mainWorld = drawWorld == &world;
+		if (mainWorld)
+			sceneGraph.Update();
+		const bool graphChanged = mainWorld && sceneGraph.UpdatedCount() > 0;
+
+		jobSystem.ParallelFor((uint32_t)drawChunks.size(), chunksPerJob, [&](uint32_t begin, uint32_t end)
+		{
+			for (uint32_t c = begin; c < end; c++)
+			{
+				Ecs::Chunk& chunk = *drawChunks[c].chunk;
+				Transform* transforms = chunk.Get<Transform>();
+				const MeshRef* meshes = chunk.Get<MeshRef>();
+				Bounds* bounds = chunk.Get<Bounds>();
+				for (uint32_t row = 0; row < chunk.Count(); row++)
+				{
+					const uint32_t node = transforms[row].node;
+					if (graphChanged && node != SceneGraph::InvalidNode && sceneGraph.Changed(node))
+						transforms[row].world = sceneGraph.World(node);
+					bounds[row].sphere = TransformBounds(meshes[row].mesh->bounds, transforms[row].world);
+					objectBounds[drawChunks[c].firstIndex + row] = bounds[row].sphere;
+				}
+			}
+		});
+
+		// Objects only move through the scene graph, anything else that changes their bounds changes the structure too.
+		// Refitting keeps the topology, once that has drifted too far from what SAH would pick the tree is rebuilt.
+		const bool restructured = drawWorld != bvhWorld || drawWorld->StructureVersion() != bvhVersion;
+		if (restructured || (graphChanged && objectBvh.Refit(objectBounds.data()) > objectBvh.BuildCost() * bvhRebuildRatio))
+		{
+			objectBvh.Build(objectBounds.data(), objectCount);
+			bvhWorld = drawWorld;
+			bvhVersion = drawWorld->StructureVersion();
+			bvhReport.builds++;
+		}
+		bvhReport.nodes = objectBvh.NodeCount();
+		bvhReport.objects = objectBvh.PrimitiveCount();
+		bvhReport.cost = objectBvh.Cost();
+		bvhReport.buildCost = objectBvh.BuildCost();
+	});
+
+	Jobs::TaskGraph::TaskId cull = frameGraph.Add("Cull", [&]
+	{
+		// The BVH rejects whole subtrees outside the frustum, the loop below only selects LODs for what it found
+		bvhReport.cull = {};
+		if (hierarchical)
+		{
+			std::fill(objectVisible.begin(), objectVisible.end(), uint8_t(0));
+			bvhReport.cull = objectBvh.CullFrustum(objectBounds.data(), frustumPlanes, [&](uint32_t i) { objectVisible[i] = 1; });
+		}
+
+		jobSystem.ParallelFor((uint32_t)drawChunks.size(), chunksPerJob, [&](uint32_t begin, uint32_t end)
+		{
+			for (uint32_t c = begin; c < end; c++)
+			{
+				const Ecs::Chunk& chunk = *drawChunks[c].chunk;
+				const Transform* transforms = chunk.Get<Transform>();
+				const MeshRef* meshes = chunk.Get<MeshRef>();
+				const Bounds* bounds = chunk.Get<Bounds>();
+				for (uint32_t row = 0; row < chunk.Count(); row++)
+				{
+					const uint32_t i = drawChunks[c].firstIndex + row;
+					const glm::vec4& sphere = bounds[row].sphere;
+					if (!hierarchical)
+						objectVisible[i] = !cullObjects || SphereInFrustum(sphere, frustumPlanes);
+
+					// Coarsest LOD whose error, scaled like the object and seen from the closest point of its bounds, stays below the threshold
+					const std::vector<MeshLod>& lods = meshes[row].mesh->lods;
+					uint8_t lod = 0;
+					if (selectLods && objectVisible[i])
+					{
+						const glm::mat4& transform = transforms[row].world;
+						const float scale = std::max(glm::length(glm::vec3(transform[0])), std::max(glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2]))));
+						const float distance = std::max(glm::length(glm::vec3(sphere) - lodCameraPosition) - sphere.w, 0.1f);
+						const float pixelsPerUnit = scale * lodProjectionScale / distance;
+						while (lod + 1u < lods.size() && lods[lod + 1].error * pixelsPerUnit <= maxLodError)
+							lod++;
+					}
+					objectLods[i] = lod;
+				}
+			}
+		});
+
+		// Compact in chunk order, entities created together stay together and so do their draws of the same mesh.
+		// The object SSBO holds MAX_OBJECTS, whatever is visible beyond that is dropped.
+		drawItems.clear();
+		lodTriangles = 0;
+		fullTriangles = 0;
+		meshletCandidates = 0;
+		for (const Ecs::ChunkRef& chunkRef : drawChunks)
+		{
+			const Ecs::Chunk& chunk = *chunkRef.chunk;
+			const Transform* transforms = chunk.Get<Transform>();
+			const MeshRef* meshes = chunk.Get<MeshRef>();
+			const MaterialRef* materials = chunk.Get<MaterialRef>();
+			for (uint32_t row = 0; row < chunk.Count() && drawItems.size() < MAX_OBJECTS; row++)
+			{
+				const uint32_t i = chunkRef.firstIndex + row;
+				if (!objectVisible[i])
+					continue;
+				drawItems.push_back({ &transforms[row].world, meshes[row].mesh, materials[row].index, objectLods[i] });
+				const std::vector<MeshLod>& lods = meshes[row].mesh->lods;
+				lodTriangles += lods[objectLods[i]].indexCount / 3;
+				fullTriangles += lods[0].indexCount / 3;
+				meshletCandidates += lods[objectLods[i]].meshletCount;
+			}
+		}
+	});
+
+	Jobs::TaskGraph::TaskId writeObjects = frameGraph.Add("Write Objects", [&]
+	{
+		// Storage buffer
+		void* objectData;
+		vmaMapMemory(allocator, frame.objectBuffer.allocation, &objectData);
+		GPUObjectData* objectSSBO = (GPUObjectData*)objectData;
+		jobSystem.ParallelFor((uint32_t)drawItems.size(), 1024, [&](uint32_t begin, uint32_t end)
+		{
+			for (uint32_t i = begin; i < end; i++)
+			{
+				const DrawItem& item = drawItems[i];
+				const MeshLod& lod = item.mesh->lods[item.lod];
+				objectSSBO[i].modelMatrix = *item.transform;
+				objectSSBO[i].materialIndex = item.materialIndex;
+				objectSSBO[i].firstMeshlet = item.mesh->firstMeshlet + lod.meshletOffset;
+				objectSSBO[i].meshletCount = lod.meshletCount;
+				objectSSBO[i].positionOffset = glm::vec4(item.mesh->boxMin, 0.0f);
+				objectSSBO[i].positionScale = glm::vec4(item.mesh->boxScale, 0.0f);
+			}
+		});
+		vmaUnmapMemory(allocator, frame.objectBuffer.allocation);
+
+		if (clusters)
+		{
+			GPUCullData cullData = {};
+			cullData.pyramidViewProj = depthPyramid.viewproj;
+			for (uint32_t i = 0; i < 6; i++)
+				cullData.frustumPlanes[i] = frustumPlanes[i];
+			cullData.cameraPosition = cameraData.position;
+			cullData.pyramidSize = glm::vec4(float(depthPyramid.extent.width), float(depthPyramid.extent.height), float(depthPyramid.levelCount), 0.0f);
+			cullData.objectCount = (uint32_t)drawItems.size();
+			cullData.flags = MESHLET_CULL_FRUSTUM;
+			if (backfaceCones)
+				cullData.flags |= MESHLET_CULL_BACKFACE;
+			if (occlusion)
+				cullData.flags |= MESHLET_CULL_OCCLUSION;
+			cullData.maxDraws = MAX_MESHLET_DRAWS;
+
+			void* cullBufferData;
+			vmaMapMemory(allocator, frame.cullBuffer.allocation, &cullBufferData);
+			memcpy(cullBufferData, &cullData, sizeof(GPUCullData));
+			vmaUnmapMemory(allocator, frame.cullBuffer.allocation);
+		}
+
+		if (drawIndexSource == DRAW_INDEX_DYNAMIC_UNIFORM)
+		{
+			const size_t drawIndexStride = pad_uniform_buffer_size(sizeof(uint32_t));
+			char* drawIndexData;
+			vmaMapMemory(allocator, frame.drawIndexBuffer.allocation, (void**)&drawIndexData);
+			for (uint32_t i = 0; i < drawItems.size(); i++)
+				*(uint32_t*)(drawIndexData + i * drawIndexStride) = i;
+			vmaUnmapMemory(allocator, frame.drawIndexBuffer.allocation);
+		}
+	});
+
+	Jobs::TaskGraph::TaskId recordDraws = frameGraph.Add("Record Draws", [&]
+	{
+		// A single indirect draw covers every meshlet, there is nothing to split
+		if (clusters)
+		{
+			chunkCount = 1;
+			if (prepass)
+			{
+				vkCheck(vkBeginCommandBuffer(frame.threadDepthCommandBuffers[0], &depthSecondaryBeginInfo));
+				RecordClusterDraws(frame.threadDepthCommandBuffers[0], frame, depthPipeline, sceneOffset, true);
+				vkCheck(vkEndCommandBuffer(frame.threadDepthCommandBuffers[0]));
+			}
+			vkCheck(vkBeginCommandBuffer(frame.threadCommandBuffers[0], &secondaryBeginInfo));
+			RecordClusterDraws(frame.threadCommandBuffers[0], frame, scenePipeline, sceneOffset);
+			vkCheck(vkEndCommandBuffer(frame.threadCommandBuffers[0]));
+			return;
+		}
+
+		// Split the draws in contiguous chunks, one secondary command buffer per chunk, each with its own pool
+		const uint32_t drawCount = (uint32_t)drawItems.size();
+		chunkCount = std::min(maxChunks, (drawCount + MIN_DRAWS_PER_CHUNK - 1) / MIN_DRAWS_PER_CHUNK);
+		chunkCount = std::max(chunkCount, 1u);
+		const uint32_t chunkSize = (drawCount + chunkCount - 1) / chunkCount;
+
+		jobSystem.ParallelFor(chunkCount, 1, [&](uint32_t begin, uint32_t end)
+		{
+			for (uint32_t chunk = begin; chunk < end; chunk++)
+			{
+				VkCommandBuffer secondary = frame.threadCommandBuffers[chunk];
+				const uint32_t first = std::min(chunk * chunkSize, drawCount);
+				const uint32_t last = std::min(first + chunkSize, drawCount);
+
+				if (prepass)
+				{
+					VkCommandBuffer depthSecondary = frame.threadDepthCommandBuffers[chunk];
+					vkCheck(vkBeginCommandBuffer(depthSecondary, &depthSecondaryBeginInfo));
+					RecordDraws(depthSecondary, frame, depthPipeline, drawIndexSource, sceneOffset, drawItems, first, last, true);
+					vkCheck(vkEndCommandBuffer(depthSecondary));
+				}
+
+				vkCheck(vkBeginCommandBuffer(secondary, &secondaryBeginInfo));
+				RecordDraws(secondary, frame, scenePipeline, drawIndexSource, sceneOffset, drawItems, first, last);
+				vkCheck(vkEndCommandBuffer(secondary));
+			}
+		});
+	});
+
+	Jobs::TaskGraph::TaskId buildImGui = frameGraph.Add("Build ImGui", [&]
+	{
+		ImGui::NewFrame();
+		BuildImGui();
+		ImGui::Render();
+		draw_data = ImGui::GetDrawData();
+
+		// Record dear imgui primitives into its own secondary command buffer
+		vkCheck(vkBeginCommandBuffer(frame.imguiCommandBuffer, &overlaySecondaryBeginInfo));
+		ImGui_ImplVulkan_RenderDrawData(draw_data, frame.imguiCommandBuffer);
+		vkCheck(vkEndCommandBuffer(frame.imguiCommandBuffer));
+	});
+
+	frameGraph.DependsOn(cull, updateTransforms);
+	frameGraph.DependsOn(writeObjects, cull);
+	frameGraph.DependsOn(recordDraws, cull);
+
+	auto graphStart = std::chrono::high_resolution_clock::now();
+	frameGraph.Run(jobSystem);
+	frameGraphTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - graphStart).count();
+	recordTime = frameGraph.TaskTime(recordDraws);
+
+	frameStats.visibleObjects = (uint32_t)drawItems.size();
+	frameStats.taskTimes.clear();
+	for (Jobs::TaskGraph::TaskId i = 0; i < frameGraph.TaskCount(); i++)
+		frameStats.taskTimes.push_back({ frameGraph.TaskName(i), frameGraph.TaskTime(i) });
+	frameStats.bvh = bvhReport;
+	frameStats.lodTriangles = lodTriangles;
+	frameStats.fullTriangles = fullTriangles;
+	frameStats.meshletCandidates = meshletCandidates;
+
+	// Render graph
+	// Forward:  [Clear Draw Count -> Cluster Cull] -> [Light Cull] -> Swapchain -> [Depth Prepass] -> Scene -> [Depth Pyramid] -> ImGui
+	// Deferred: [Clear Draw Count -> Cluster Cull] -> [Depth Prepass] -> G-Buffer -> [Depth Pyramid] -> Deferred Lighting -> Composite -> ImGui
+	// The depth buffer and the G-buffer only live from the scene passes to the passes reading them
+	renderGraph.Reset();
+
+	// The acquired image is undefined and may only be written once the acquire semaphore, waited at color output, signaled
+	RenderGraph::ResourceState acquiredState = {};
+	acquiredState.writeStage = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT;
+	RenderGraph::ResourceId backbuffer = renderGraph.ImportImage("Swapchain", swapchainImages[frameIndex], swapchainImageViews[frameIndex],
+																  VK_IMAGE_ASPECT_COLOR_BIT, acquiredState, true);
+	// The depth pyramid and the deferred lighting read the depth buffer, it has to be sampled
+	const VkImageUsageFlags depthUsage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | (clusters || deferred ? VK_IMAGE_USAGE_SAMPLED_BIT : 0);
+	RenderGraph::ResourceId depth = renderGraph.CreateImage("Depth", { depthFormat, swapchainExtent, depthUsage, VK_IMAGE_ASPECT_DEPTH_BIT });
+
+	RenderGraph::ResourceId meshletDraws = UINT32_MAX;
+	RenderGraph::ResourceId meshletDrawCount = UINT32_MAX;
+	RenderGraph::ResourceId pyramid = UINT32_MAX;
+	if (clusters)
+	{
+		// The frame's previous use of its buffers completed before WaitTimelineValue returned
+		meshletDraws = renderGraph.ImportBuffer("Meshlet Draws", frame.meshletDrawBuffer.buffer, {}, false);
+		meshletDrawCount = renderGraph.ImportBuffer("Meshlet Draw Count", frame.meshletDrawCountBuffer.buffer, {}, false);
+
+		// Shared by every frame, the last frame left it written by its pyramid pass
+		RenderGraph::ResourceState pyramidState = {};
+		pyramidState.layout = VK_IMAGE_LAYOUT_GENERAL;
+		pyramidState.writeStage = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+		pyramidState.writeAccess = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+		pyramid = renderGraph.ImportImage("Depth Pyramid", depthPyramid.image.image, depthPyramid.view, VK_IMAGE_ASPECT_COLOR_BIT, pyramidState, true);
+
+		RenderGraph::PassId clearPass = renderGraph.AddPass("Clear Draw Count", [&](VkCommandBuffer cmd)
+		{
+			vkCmdFillBuffer(cmd, frame.meshletDrawCountBuffer.buffer, 0, sizeof(uint32_t), 0);
+		});
+		renderGraph.Write(clearPass, meshletDrawCount, RenderGraph::Access::TransferWrite);
+
+		RenderGraph::PassId cullPass = renderGraph.AddPass("Cluster Cull", [&](VkCommandBuffer cmd)
+		{
+			VkDescriptorSet cullSet = AllocateDescriptorSet(frame.descriptorAllocator, meshletCullSetLayout, {
+				BufferWrite(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, frame.cullBuffer.buffer, 0, sizeof(GPUCullData)),
+				BufferWrite(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, frame.objectBuffer.buffer, 0, VK_WHOLE_SIZE),
+				BufferWrite(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, geometryPool.meshletBuffer.buffer, 0, VK_WHOLE_SIZE),
+				BufferWrite(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, frame.meshletDrawBuffer.buffer, 0, VK_WHOLE_SIZE),
+				BufferWrite(4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, frame.meshletDrawCountBuffer.buffer, 0, sizeof(uint32_t)),
+				ImageWrite(5, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, depthPyramidSampler, depthPyramid.view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+			});
+
+			vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, meshletCullPipeline);
+			vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, meshletCullPipelineLayout, 0, 1, &cullSet, 0, nullptr);
+			if (!drawItems.empty())
+				vkCmdDispatch(cmd, (uint32_t)drawItems.size(), 1, 1);
+
+			// The count is read on the host once the frame completed, the render graph only orders device accesses
+			VkMemoryBarrier2 hostBarrier = {};
+			hostBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2;
+			hostBarrier.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+			hostBarrier.srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+			hostBarrier.dstStageMask = VK_PIPELINE_STAGE_2_HOST_BIT;
+			hostBarrier.dstAccessMask = VK_ACCESS_2_HOST_READ_BIT;
+
+			VkDependencyInfo dependencyInfo = {};
+			dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+			dependencyInfo.memoryBarrierCount = 1;
+			dependencyInfo.pMemoryBarriers = &hostBarrier;
+			vkCmdPipelineBarrier2(cmd, &dependencyInfo);
+		});
+		renderGraph.Read(cullPass, pyramid, RenderGraph::Access::ComputeSampled);
+		renderGraph.Write(cullPass, meshletDrawCount, RenderGraph::Access::ComputeStorageWrite);
+		renderGraph.Write(cullPass, meshletDraws, RenderGraph::Access::ComputeStorageWrite);
+	}
+
+	RenderGraph::ResourceId clusterLightCounts = UINT32_MAX;
+	RenderGraph::ResourceId clusterLightIndices = UINT32_MAX;
+	if (clusteredShading)
+	{
+		clusterLightCounts = renderGraph.ImportBuffer("Cluster Light Counts", frame.clusterLightCountBuffer.buffer, {}, false);
+		clusterLightIndices = renderGraph.ImportBuffer("Cluster Light Indices", frame.clusterLightIndexBuffer.buffer, {}, false);
+
+		RenderGraph::PassId lightCullPass = renderGraph.AddPass("Light Cull", [&](VkCommandBuffer cmd)
+		{
+			VkDescriptorSet lightCullSet = AllocateDescriptorSet(frame.descriptorAllocator, lightCullSetLayout, {
+				BufferWrite(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, frame.clusterBuffer.buffer, 0, sizeof(GPUClusterData)),
+				BufferWrite(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, frame.pointLightBuffer.buffer, 0, VK_WHOLE_SIZE),
+				BufferWrite(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, frame.clusterLightCountBuffer.buffer, 0, VK_WHOLE_SIZE),
+				BufferWrite(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, frame.clusterLightIndexBuffer.buffer, 0, VK_WHOLE_SIZE)
+			});
+
+			vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, lightCullPipeline);
+			vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, lightCullPipelineLayout, 0, 1, &lightCullSet, 0, nullptr);
+			vkCmdDispatch(cmd, (CLUSTER_COUNT + 63) / 64, 1, 1);
+		});
+		renderGraph.Write(lightCullPass, clusterLightCounts, RenderGraph::Access::ComputeStorageWrite);
+		renderGraph.Write(lightCullPass, clusterLightIndices, RenderGraph::Access::ComputeStorageWrite);
+	}
 
-	// Push Constant
-	MeshPushConstants constants;
-	constants.renderMatrix = model;
-	//vkCmdPushConstants(GetCurrentFrame().mainCommandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(MeshPushConstants), &constants);
+	if (prepass)
+	{
+		RenderGraph::PassId depthPass = renderGraph.AddPass("Depth Prepass", [&](VkCommandBuffer cmd)
+		{
+			VkRenderingAttachmentInfo depthAttachment = {};
+			depthAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+			depthAttachment.imageView = renderGraph.GetImageView(depth);
+			depthAttachment.imageLayout = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL;
+			depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+			depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+			depthAttachment.clearValue.depthStencil.depth = 1.0f;
+
+			VkRenderingInfo renderingInfo = {};
+			renderingInfo.sType = VK_STRUCTURE_TYPE_RENDERING_INFO;
+			renderingInfo.flags = VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT;
+			renderingInfo.renderArea.extent = swapchainExtent;
+			renderingInfo.renderArea.offset = { 0, 0 };
+			renderingInfo.layerCount = 1;
+			renderingInfo.pDepthAttachment = &depthAttachment;
+
+			vkCmdBeginRendering(cmd, &renderingInfo);
+			vkCmdExecuteCommands(cmd, chunkCount, frame.threadDepthCommandBuffers);
+			vkCmdEndRendering(cmd);
+		});
+		renderGraph.Write(depthPass, depth, RenderGraph::Access::DepthAttachment);
+		if (clusters)
+		{
+			renderGraph.Read(depthPass, meshletDraws, RenderGraph::Access::IndirectRead);
+			renderGraph.Read(depthPass, meshletDrawCount, RenderGraph::Access::IndirectRead);
+		}
+	}
+
+	RenderGraph::ResourceId gbuffer[GBUFFER_TARGET_COUNT] = {};
+	if (deferred)
+	{
+		const char* gbufferNames[GBUFFER_TARGET_COUNT] = { "G-Buffer Albedo", "G-Buffer Normal", "G-Buffer Specular" };
+		for (uint32_t i = 0; i < GBUFFER_TARGET_COUNT; i++)
+			gbuffer[i] = renderGraph.CreateImage(gbufferNames[i], { gbufferFormats[i], swapchainExtent, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_IMAGE_ASPECT_COLOR_BIT });
+	}
+
+	// Forward shades into the swapchain, deferred fills the G-buffer
+	RenderGraph::PassId scenePass = renderGraph.AddPass(deferred ? "G-Buffer" : "Scene", [&](VkCommandBuffer cmd)
+	{
+		VkRenderingAttachmentInfo colorAttachments[GBUFFER_TARGET_COUNT] = {};
+		const uint32_t colorAttachmentCount = deferred ? GBUFFER_TARGET_COUNT : 1;
+		for (uint32_t i = 0; i < colorAttachmentCount; i++)
+		{
+			colorAttachments[i].sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+			colorAttachments[i].imageView = renderGraph.GetImageView(deferred ? gbuffer[i] : backbuffer);
+			colorAttachments[i].imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+			// The lighting pass tells empty pixels by their depth, the G-buffer does not need clearing
+			colorAttachments[i].loadOp = deferred ? VK_ATTACHMENT_LOAD_OP_DONT_CARE : VK_ATTACHMENT_LOAD_OP_CLEAR;
+			colorAttachments[i].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+			colorAttachments[i].clearValue.color = sceneClearColor;
+		}
+
+		VkRenderingAttachmentInfo depthAttachment = {};
+		depthAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+		depthAttachment.imageView = renderGraph.GetImageView(depth);
+		depthAttachment.imageLayout = prepass ? VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL;
+		depthAttachment.loadOp = prepass ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR;
+		// The depth pyramid and deferred lighting passes read what the scene leaves behind
+		depthAttachment.storeOp = clusters || deferred ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		depthAttachment.clearValue.depthStencil.depth = 1.0f;
+
+		VkRenderingInfo renderingInfo = {};
+		renderingInfo.sType = VK_STRUCTURE_TYPE_RENDERING_INFO;
+		renderingInfo.flags = VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT;
+		renderingInfo.renderArea.extent = swapchainExtent;
+		renderingInfo.renderArea.offset = { 0, 0 };
+		renderingInfo.layerCount = 1;
+		renderingInfo.colorAttachmentCount = colorAttachmentCount;
+		renderingInfo.pColorAttachments = colorAttachments;
+		renderingInfo.pDepthAttachment = &depthAttachment;
+
+		vkCmdBeginRendering(cmd, &renderingInfo);
+		vkCmdExecuteCommands(cmd, chunkCount, frame.threadCommandBuffers);
+		vkCmdEndRendering(cmd);
+	});
+	if (deferred)
+	{
+		for (uint32_t i = 0; i < GBUFFER_TARGET_COUNT; i++)
+			renderGraph.Write(scenePass, gbuffer[i], RenderGraph::Access::ColorAttachment);
+	}
+	else
+	{
+		renderGraph.Write(scenePass, backbuffer, RenderGraph::Access::ColorAttachment);
+	}
+	if (prepass)
+		renderGraph.Read(scenePass, depth, RenderGraph::Access::DepthAttachmentRead);
+	else
+		renderGraph.Write(scenePass, depth, RenderGraph::Access::DepthAttachment);
+	if (clusteredShading)
+	{
+		renderGraph.Read(scenePass, clusterLightCounts, RenderGraph::Access::FragmentStorageRead);
+		renderGraph.Read(scenePass, clusterLightIndices, RenderGraph::Access::FragmentStorageRead);
+	}
+	if (clusters)
+	{
+		renderGraph.Read(scenePass, meshletDraws, RenderGraph::Access::IndirectRead);
+		renderGraph.Read(scenePass, meshletDrawCount, RenderGraph::Access::IndirectRead);
+
+		// Every level keeps the farthest depth of the texels below it, for next frame's occlusion test
+		RenderGraph::PassId pyramidPass = renderGraph.AddPass("Depth Pyramid", [&](VkCommandBuffer cmd)
+		{
+			vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, depthPyramidPipeline);
+
+			VkExtent2D sourceExtent = swapchainExtent;
+			for (uint32_t level = 0; level < depthPyramid.levelCount; level++)
+			{
+				// Level 0 samples the depth buffer, the others the level before them, still in GENERAL from its write
+				VkImageView sourceView = level == 0 ? renderGraph.GetImageView(depth) : depthPyramid.levels[level - 1];
+				VkImageLayout sourceLayout = level == 0 ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_GENERAL;
+				VkDescriptorSet pyramidSet = AllocateDescriptorSet(frame.descriptorAllocator, depthPyramidSetLayout, {
+					ImageWrite(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, depthPyramidSampler, sourceView, sourceLayout),
+					ImageWrite(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_NULL_HANDLE, depthPyramid.levels[level], VK_IMAGE_LAYOUT_GENERAL)
+				});
+
+				VkExtent2D levelExtent = { std::max(depthPyramid.extent.width >> level, 1u), std::max(depthPyramid.extent.height >> level, 1u) };
+				DepthPyramidPushConstants constants = { sourceExtent.width, sourceExtent.height, levelExtent.width, levelExtent.height };
+				vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, depthPyramidPipelineLayout, 0, 1, &pyramidSet, 0, nullptr);
+				vkCmdPushConstants(cmd, depthPyramidPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(DepthPyramidPushConstants), &constants);
+				vkCmdDispatch(cmd, (levelExtent.width + 7) / 8, (levelExtent.height + 7) / 8, 1);
+
+				// The next level reads this one
+				VkImageMemoryBarrier2 levelBarrier = ImageBarrier2(depthPyramid.image.image, VK_IMAGE_ASPECT_COLOR_BIT,
+																   VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL,
+																   VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+																   VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT);
+				levelBarrier.subresourceRange.baseMipLevel = level;
+				PipelineBarrier2(cmd, 1, &levelBarrier);
+
+				sourceExtent = levelExtent;
+			}
+		});
+		renderGraph.Read(pyramidPass, depth, RenderGraph::Access::ComputeSampled);
+		renderGraph.Write(pyramidPass, pyramid, RenderGraph::Access::ComputeStorageWrite);
+
+		depthPyramid.viewproj = cameraData.viewproj;
+		depthPyramid.builtFrame = frameNumber;
+		frame.meshletDrawsWritten = true;
+	}
+
+	if (deferred)
+	{
+		// Storage images can't be sRGB, the lighting pass writes a float image that the blit converts into the swapchain
+		RenderGraph::ResourceId lit = renderGraph.CreateImage("Lit", { litFormat, swapchainExtent, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_IMAGE_ASPECT_COLOR_BIT });
 
+		RenderGraph::PassId lightingPass = renderGraph.AddPass("Deferred Lighting", [&](VkCommandBuffer cmd)
+		{
+			VkDescriptorSet lightingSet = AllocateDescriptorSet(frame.descriptorAllocator, deferredLightingSetLayout, {
+				BufferWrite(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, frame.clusterBuffer.buffer, 0, sizeof(GPUClusterData)),
+				BufferWrite(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, frame.pointLightBuffer.buffer, 0, VK_WHOLE_SIZE),
+				BufferWrite(2, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, sceneParameterBuffer.buffer, sceneOffset, sizeof(GPUSceneData)),
+				ImageWrite(3, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, gbufferSampler, renderGraph.GetImageView(depth), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL),
+				ImageWrite(4, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, gbufferSampler, renderGraph.GetImageView(gbuffer[0]), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL),
+				ImageWrite(5, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, gbufferSampler, renderGraph.GetImageView(gbuffer[1]), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL),
+				ImageWrite(6, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, gbufferSampler, renderGraph.GetImageView(gbuffer[2]), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL),
+				ImageWrite(7, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_NULL_HANDLE, renderGraph.GetImageView(lit), VK_IMAGE_LAYOUT_GENERAL)
+			});
+
+			DeferredLightingPushConstants constants = {};
+			constants.clearColor = glm::vec4(sceneClearColor.float32[0], sceneClearColor.float32[1], sceneClearColor.float32[2], sceneClearColor.float32[3]);
+			constants.flags = deferredLightingFlags;
+
+			vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, deferredLightingPipeline);
+			vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, deferredLightingPipelineLayout, 0, 1, &lightingSet, 0, nullptr);
+			vkCmdPushConstants(cmd, deferredLightingPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(DeferredLightingPushConstants), &constants);
+			vkCmdDispatch(cmd, (swapchainExtent.width + DEFERRED_TILE_SIZE - 1) / DEFERRED_TILE_SIZE, (swapchainExtent.height + DEFERRED_TILE_SIZE - 1) / DEFERRED_TILE_SIZE, 1);
+		});
+		renderGraph.Read(lightingPass, depth, RenderGraph::Access::ComputeSampled);
+		for (uint32_t i = 0; i < GBUFFER_TARGET_COUNT; i++)
+			renderGraph.Read(lightingPass, gbuffer[i], RenderGraph::Access::ComputeSampled);
+		renderGraph.Write(lightingPass, lit, RenderGraph::Access::ComputeStorageWrite);
+
+		RenderGraph::PassId compositePass = renderGraph.AddPass("Composite", [&](VkCommandBuffer cmd)
+		{
+			VkImageBlit region = {};
+			region.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+			region.srcOffsets[1] = { (int32_t)swapchainExtent.width, (int32_t)swapchainExtent.height, 1 };
+			region.dstSubresource = region.srcSubresource;
+			region.dstOffsets[1] = region.srcOffsets[1];
+			vkCmdBlitImage(cmd, renderGraph.GetImage(lit), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+						   renderGraph.GetImage(backbuffer), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region, VK_FILTER_NEAREST);
+		});
+		renderGraph.Read(compositePass, lit, RenderGraph::Access::TransferRead);
+		renderGraph.Write(compositePass, backbuffer, RenderGraph::Access::TransferWrite);
+	}
 
-	vkCmdDraw(GetCurrentFrame().mainCommandBuffer, monkeyMesh.vertices.size(), 1, 0, 0);
+	// ImGui overlay, its render pass moves the image to PRESENT_SRC_KHR
+	RenderGraph::PassId imguiPass = renderGraph.AddPass("ImGui", [&](VkCommandBuffer cmd)
+	{
+		VkRenderPassBeginInfo overlayBeginInfo = {};
+		overlayBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+		overlayBeginInfo.framebuffer = framebuffers[frameIndex];
+		overlayBeginInfo.renderPass = overlayRenderPass;
+		overlayBeginInfo.renderArea.extent = swapchainExtent;
+		overlayBeginInfo.renderArea.offset = { 0, 0 };
+
+		vkCmdBeginRenderPass(cmd, &overlayBeginInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+		vkCmdExecuteCommands(cmd, 1, &frame.imguiCommandBuffer);
+		vkCmdEndRenderPass(cmd);
+	});
+	renderGraph.Write(imguiPass, backbuffer, RenderGraph::Access::ColorAttachment);
 
-	// Record dear imgui primitives into command buffer
-	ImGui_ImplVulkan_RenderDrawData(draw_data, GetCurrentFrame().mainCommandBuffer);
+	renderGraph.Compile();
+	renderGraph.Execute(cmd);
 
-	vkCmdEndRenderPass(GetCurrentFrame().mainCommandBuffer);
+	vkCmdWriteTimestamp(GetCurrentFrame().mainCommandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, GetCurrentFrame().timestampQueryPool, 1);
+	GetCurrentFrame().timestampsWritten = true;
 	vkCheck(vkEndCommandBuffer(GetCurrentFrame().mainCommandBuffer));
 
+	// Signal the binary semaphore for present and the next timeline value for the CPU
+	GetCurrentFrame().timelineValue = ++timelineValue;
+	VkSemaphore signalSemaphores[] = { GetCurrentFrame().renderSemaphore, timelineSemaphore };
+	uint64_t signalValues[] = { 0, GetCurrentFrame().timelineValue }; // the binary semaphore value is ignored
+
+	VkTimelineSemaphoreSubmitInfo timelineInfo = {};
+	timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+	timelineInfo.signalSemaphoreValueCount = 2;
+	timelineInfo.pSignalSemaphoreValues = signalValues;
+
 	VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
 	VkSubmitInfo submitInfo = {};
 	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.pNext = &timelineInfo;
 	submitInfo.commandBufferCount = 1;
 	submitInfo.pCommandBuffers = &GetCurrentFrame().mainCommandBuffer;
-	submitInfo.signalSemaphoreCount = 1;
-	submitInfo.pSignalSemaphores = &GetCurrentFrame().renderSemaphore;
+	submitInfo.signalSemaphoreCount = 2;
+	submitInfo.pSignalSemaphores = signalSemaphores;
 	submitInfo.waitSemaphoreCount = 1;
 	submitInfo.pWaitSemaphores = &GetCurrentFrame().presentSemaphore;
 	submitInfo.pWaitDstStageMask = &waitStage;
 
-	vkCheck(vkQueueSubmit(graphicsQueue, 1, &submitInfo, GetCurrentFrame().renderFence));
+	vkCheck(vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE));
 
 	VkPresentInfoKHR presentInfo = {};
 	presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -1667,7 +4894,24 @@ void Render(GLFWwindow* window)
 	presentInfo.pWaitSemaphores = &GetCurrentFrame().renderSemaphore;
 	presentInfo.pImageIndices = &frameIndex;
 
-	vkCheck(vkQueuePresentKHR(graphicsQueue, &presentInfo));
+	VkResult presentResult = vkQueuePresentKHR(graphicsQueue, &presentInfo);
+
+	GetCurrentFrame().inputTime = framePacing.inputTime;
+	GetCurrentFrame().latencyPending = true;
+	framePacing.presentLatencySum += (glfwGetTime() - framePacing.inputTime) * 1000.0;
+	framePacing.presentLatencyCount++;
+
+	if (presentResult == VK_ERROR_OUT_OF_DATE_KHR || presentResult == VK_SUBOPTIMAL_KHR)
+		swapchainOutOfDate = true;
+	else
+		vkCheck(presentResult);
+
+	if (drawIndexBenchmark.running)
+		UpdateDrawIndexBenchmark(recordTime);
+	else if (jobScalingBenchmark.running)
+		UpdateJobScalingBenchmark();
+	else if (lightingBenchmark.running)
+		UpdateLightingBenchmark();
 
 	frameNumber++;
 }
@@ -1678,10 +4922,12 @@ int main()
 	assert(rc);
 
 	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-	glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+	glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
 
 	GLFWwindow* window = glfwCreateWindow(width, height, "Vulkan", 0, 0);
 	assert(window);
+	glfwSetFramebufferSizeCallback(window, [](GLFWwindow*, int, int) { swapchainOutOfDate = true; });
+	glfwSetMouseButtonCallback(window, mouse_button_callback);
 
 	Init(window);
 
@@ -1710,12 +4956,12 @@ int main()
 	init_info.QueueFamily = graphicsQueueFamily;
 	init_info.Queue = graphicsQueue;
 	init_info.PipelineCache = nullptr;
-	init_info.DescriptorPool = descriptorPool;
+	init_info.DescriptorPool = imguiDescriptorPool;
 	init_info.Allocator = nullptr;
 	init_info.MinImageCount = 2;
 	init_info.ImageCount = 3;
 	init_info.CheckVkResultFn = nullptr;
-	ImGui_ImplVulkan_Init(&init_info, renderPass);
+	ImGui_ImplVulkan_Init(&init_info, overlayRenderPass);
 
 	// Upload Fonts
 	{
@@ -1743,117 +4989,46 @@ int main()
 	}
 
 	bool open = true;
-	ImGuiWindowFlags window_flags = ImGuiWindowFlags_NoFocusOnAppearing | ImGuiWindowFlags_NoNav;
 
 	float deltaTime = 0;
 
 	while (!glfwWindowShouldClose(window))
 	{
+		if (framePacing.limitFrameRate)
+			WaitForNextFrame();
+
 		glfwPollEvents();
+		framePacing.inputTime = glfwGetTime();
 		
 		// Measure speed
 		deltaTime = float(std::max(0.0, Timer::elapsed() / 1000.0));
 		Timer::record();
 
 		// Imgui stuff
-		// Start the Dear ImGui frame
+		// Start the Dear ImGui frame, the GLFW backend polls input so it stays on the main thread,
+		// the window itself is built by the frame graph in Render
 		ImGui_ImplVulkan_NewFrame();
 		ImGui_ImplGlfw_NewFrame();
-		ImGui::NewFrame();
 
 		std::stringstream ss;
 		ss << "Vulkan -> " << std::setprecision(2) << deltaTime * 1000.0f << "ms";
 		glfwSetWindowTitle(window, ss.str().c_str());
 
-		if (ImGui::Begin("Playground", NULL, window_flags))
-		{
-			ImGui::Text("Render Time: %.1f ms", deltaTime * 1000.0f);
-			ImGui::Separator();
-			if (ImGui::Button("Reload Shaders"))
-			{
-				CreatePipeline();
-			}
-			ImGui::Separator();
-			if (ImGui::CollapsingHeader("Light Properties", ImGuiTreeNodeFlags_DefaultOpen))
-			{
-				ImGui::Text("Light Color:");
-				ImGui::SameLine();
-				ImGui::ColorEdit4("##picker", (float*)&lightColor, ImGuiColorEditFlags_DisplayHex | ImGuiColorEditFlags_NoInputs | ImGuiColorEditFlags_NoLabel);
-				ImGui::Text("Light Position:       ");
-				ImGui::SameLine();
-				ImGui::DragFloat3("##lightPosition", (float*)&lightPosition, 1.0f, 0.0f, 0.0f, "%.2f", 0);
-				ImGui::Text("Diffuse Strength:     ");
-				ImGui::SameLine();
-				ImGui::DragFloat("##diffuseStrength", &diffuseStrength, 0.1f, 0.0f, 1.0f, "%.3f", ImGuiSliderFlags_AlwaysClamp);
-				ImGui::Text("Ambient Strength:     ");
-				ImGui::SameLine();
-				ImGui::DragFloat("##ambientStrength", &ambientStrength, 0.1f, 0.0f, 1.0f, "%.3f", ImGuiSliderFlags_AlwaysClamp);
-				ImGui::Text("Attenuation Linear:   ");
-				ImGui::SameLine();
-				ImGui::DragFloat("##attenuationLinear", &attenuationLinear, 0.01f, 0.0f, 1.0f, "%.3f", ImGuiSliderFlags_AlwaysClamp);
-				ImGui::Text("Attenuation Quadratic:");
-				ImGui::SameLine();
-				ImGui::DragFloat("##attenuationQuadratic", &attenuationQuadratic, 0.01f, 0.0f, 1.0f, "%.3f", ImGuiSliderFlags_AlwaysClamp);
-			}
-		}
-		ImGui::End();
-
 		if (glfwGetKey(window, GLFW_KEY_ESCAPE))
 			glfwSetWindowShouldClose(window, true);
 
-		ImGui::Render();
-		draw_data = ImGui::GetDrawData();
 		Render(window);
 	}
 
 	vkDeviceWaitIdle(device);
+	jobSystem.Stop();
 
 	ImGui_ImplVulkan_Shutdown();
 	ImGui_ImplGlfw_Shutdown();
 	ImGui::DestroyContext();
 
-	vkDestroyDescriptorSetLayout(device, sceneSetLayout, nullptr);
-	vkDestroyDescriptorSetLayout(device, singleTextureSetLayout, nullptr);
-	vkDestroySampler(device, blockySampler, nullptr);
-	vkDestroyImageView(device, diffuseTexture.imageView, nullptr);
-	vkDestroyImageView(device, specularMap.imageView, nullptr);
-	vkDestroyImageView(device, emissionMap.imageView, nullptr);
-	vkDestroyFence(device, uploadContext.uploadFence, nullptr);
-	vkDestroyCommandPool(device, uploadContext.commandPool, nullptr);
-	vmaDestroyBuffer(allocator, triangleMesh.vertexBuffer.buffer, triangleMesh.vertexBuffer.allocation);
-	vmaDestroyBuffer(allocator, monkeyMesh.vertexBuffer.buffer, monkeyMesh.vertexBuffer.allocation);
-	vmaDestroyBuffer(allocator, materialBuffer.buffer, materialBuffer.allocation);
-	vmaDestroyBuffer(allocator, lightBuffer.buffer, lightBuffer.allocation);
-	vmaDestroyImage(allocator, diffuseTexture.image.image, diffuseTexture.image.allocation);
-	vmaDestroyImage(allocator, specularMap.image.image, specularMap.image.allocation);
-	vmaDestroyImage(allocator, emissionMap.image.image, emissionMap.image.allocation);
-	vmaDestroyImage(allocator, depthImage.image, depthImage.allocation);
-	vkDestroyImageView(device, depthImageView, nullptr);
-	vkDestroyShaderModule(device, vertexShaderModule, nullptr);
-	vkDestroyShaderModule(device, fragmentShaderModule, nullptr);
-	vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
-	vkDestroyPipeline(device, graphicsPipeline, nullptr);
-	for (int i = 0; i < frame_overlap; i++)
-	{
-		vkDestroyCommandPool(device, frames[i].commandPool, nullptr);
-		vkDestroySemaphore(device, frames[i].renderSemaphore, nullptr);
-		vkDestroySemaphore(device, frames[i].presentSemaphore, nullptr);
-		vkDestroyFence(device, frames[i].renderFence, nullptr);
-		vmaDestroyBuffer(allocator, frames[i].cameraBuffer.buffer, frames[i].cameraBuffer.allocation);
-		vmaDestroyBuffer(allocator, frames[i].objectBuffer.buffer, frames[i].objectBuffer.allocation);
-	}
-	vmaDestroyBuffer(allocator, sceneParameterBuffer.buffer, sceneParameterBuffer.allocation);
-	vkDestroyDescriptorPool(device, descriptorPool, nullptr);
-	vkDestroyDescriptorSetLayout(device, objectSetLayout, nullptr);
-	vkDestroyDescriptorSetLayout(device, globalSetLayout, nullptr);
-	vmaDestroyAllocator(allocator);
-	vkDestroySwapchainKHR(device, swapchain, nullptr);
-	vkDestroyRenderPass(device, renderPass, nullptr);
-	for (int i = 0; i < framebuffers.size(); i++)
-	{
-		vkDestroyFramebuffer(device, framebuffers[i], nullptr);
-		vkDestroyImageView(device, swapchainImageViews[i], nullptr);
-	}
+	deletionQueue.Flush();
+
 	vkDestroyDevice(device, nullptr);
 	vkDestroySurfaceKHR(instance, surface, nullptr);
 	vkb::destroy_debug_utils_messenger(instance, debugMessenger);